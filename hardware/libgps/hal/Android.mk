@@ -17,6 +17,18 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_CFLAGS := -DHAVE_GPS_HARDWARE
 LOCAL_SHARED_LIBRARIES := liblog libcutils libhardware libc libutils
 LOCAL_SRC_FILES := gps_zkw.c
+LOCAL_SRC_FILES += aidq.c
+LOCAL_SRC_FILES += casic.c
+LOCAL_SRC_FILES += crc32.c
+LOCAL_SRC_FILES += epoch_shm.c
+LOCAL_SRC_FILES += geofence.c
+LOCAL_SRC_FILES += lastfix.c
+LOCAL_SRC_FILES += measurement.c
+LOCAL_SRC_FILES += motion.c
+LOCAL_SRC_FILES += navmsg.c
+LOCAL_SRC_FILES += power.c
+LOCAL_SRC_FILES += rawfan.c
+LOCAL_SRC_FILES += track.c
 
 ifeq ($(SUPL_ENABLED),1)
 LOCAL_SUPL_PATH=../asn-supl
@@ -35,6 +47,10 @@ LOCAL_C_INCLUDES += \
 LOCAL_CFLAGS += -DSUPL_ENABLED
 LOCAL_SRC_FILES += supl.c 
 LOCAL_SRC_FILES += casaid.c 
+LOCAL_SRC_FILES += subframe.c
+LOCAL_SRC_FILES += aidcache.c
+LOCAL_SRC_FILES += orbit.c
+LOCAL_SRC_FILES += rxaid.c
 endif
 
 #LOCAL_MODULE := gps.$(TARGET_BOARD_PLATFORM)
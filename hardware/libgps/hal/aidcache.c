@@ -0,0 +1,337 @@
+/*
+ * assistance kept across process and device restarts.
+ *
+ * what SUPL delivered and the ephemerides decoded from the sky are kept per
+ * element, each with the window of gps time it is good for: an ephemeris
+ * around its toe for the fit interval, an almanac around its toa, the
+ * models and the reference location from when they came in. a start hands
+ * the receiver whatever is still good without the network, and a SUPL
+ * request names what is held so the server only sends the rest.
+ *
+ * the file is written in two slots like the last fix (see lastfix.c).
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "aidcache.h"
+#include "crc32.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define EPH_MARGIN              1800            // s left for a held ephemeris to count as held
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *map = NULL;
+static AidCache cache;
+
+static int
+slot_valid(const AidCache *c) {
+        return c->magic == AIDCACHE_MAGIC && c->version == AIDCACHE_VERSION &&
+               c->size == sizeof(AidCache) && c->crc == crc32_buf(c, offsetof(AidCache, crc));
+}
+
+static void
+slot_write() {
+        unsigned char *slot;
+
+        if (map == NULL)
+                return;
+        cache.magic = AIDCACHE_MAGIC;
+        cache.version = AIDCACHE_VERSION;
+        cache.size = sizeof(AidCache);
+        cache.seq += 1;
+        cache.crc = crc32_buf(&cache, offsetof(AidCache, crc));
+        slot = map + (cache.seq & 1) * AIDCACHE_SLOT_SIZE;
+        memcpy(slot, &cache, sizeof(cache));
+        msync(slot, AIDCACHE_SLOT_SIZE, MS_ASYNC);
+}
+
+static int
+held(const AidValid *v, int64_t now) {
+        return v->until != 0 && v->from <= now && now < v->until;
+}
+
+/* the full week of a week number mod 1024, nearest to now */
+static int
+full_week(int week, int64_t now) {
+        int nw = (int)(now / GPS_WEEK_S);
+
+        week &= 1023;
+        return week + 1024 * ((nw - week + 512) / 1024);
+}
+
+/* week (mod 1024) and time of week in seconds, as gps seconds nearest to now */
+static int64_t
+gps_seconds(int *week, long tow, int64_t now) {
+        int64_t t;
+
+        *week = full_week(*week, now);
+        t = (int64_t)*week * GPS_WEEK_S + tow;
+        // a toe early in the next week comes with this week's number
+        if (t - now > GPS_WEEK_S / 2) {
+                t -= GPS_WEEK_S;
+                *week -= 1;
+        } else if (now - t > GPS_WEEK_S / 2) {
+                t += GPS_WEEK_S;
+                *week += 1;
+        }
+        return t;
+}
+
+static void
+put_eph(const struct supl_ephemeris_s *eph, int week, int64_t now) {
+        AidEph *e;
+        int64_t toe;
+        int fit;
+
+        if (eph->prn < 1 || eph->prn > MAX_EPHEMERIS || !eph->nav_model)
+                return;
+        e = &cache.eph[eph->prn - 1];
+        toe = gps_seconds(&week, eph->toe * 16L, now);
+        fit = eph->fit ? AIDCACHE_FIT_LONG : AIDCACHE_FIT;
+        // an older issue does not replace a newer one
+        if (e->v.until != 0 && toe + fit / 2 < e->v.until)
+                return;
+        e->v.from = toe - fit / 2;
+        e->v.until = toe + fit / 2;
+        e->week = week;
+        e->eph = *eph;
+}
+
+int
+aidcache_open(const char *path) {
+        const AidCache *a, *b;
+        int fd;
+        void *p;
+
+        if (map != NULL)
+                return 0;
+
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+                D("Can not open aid cache %s, errno = %d", path, errno);
+                return -1;
+        }
+        if (ftruncate(fd, 2 * AIDCACHE_SLOT_SIZE) < 0) {
+                D("Can not size aid cache, errno = %d", errno);
+                close(fd);
+                return -1;
+        }
+        p = mmap(NULL, 2 * AIDCACHE_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+                D("Can not map aid cache, errno = %d", errno);
+                return -1;
+        }
+
+        pthread_mutex_lock(&cache_lock);
+        map = p;
+        a = (const AidCache *)map;
+        b = (const AidCache *)(map + AIDCACHE_SLOT_SIZE);
+        if (slot_valid(a) && (!slot_valid(b) || (int32_t)(a->seq - b->seq) > 0))
+                cache = *a;
+        else if (slot_valid(b))
+                cache = *b;
+        pthread_mutex_unlock(&cache_lock);
+
+        D("aid cache %s: %s", path, cache.magic ? "loaded" : "empty");
+        return 0;
+}
+
+void
+aidcache_close() {
+        pthread_mutex_lock(&cache_lock);
+        if (map != NULL) {
+                munmap(map, 2 * AIDCACHE_SLOT_SIZE);
+                map = NULL;
+        }
+        pthread_mutex_unlock(&cache_lock);
+}
+
+/* what a SUPL session collected, now in gps seconds */
+void
+aidcache_put(const supl_assist_t *assist, int64_t now) {
+        int i, week;
+
+        pthread_mutex_lock(&cache_lock);
+        if (assist->set & SUPL_RRLP_ASSIST_IONO) {
+                cache.iono = assist->iono;
+                cache.iono_v.from = now;
+                cache.iono_v.until = now + AIDCACHE_IONO_VALID;
+        }
+        if (assist->set & SUPL_RRLP_ASSIST_UTC) {
+                cache.utc = assist->utc;
+                cache.utc_v.from = now;
+                cache.utc_v.until = now + AIDCACHE_UTC_VALID;
+        }
+        if (assist->set & SUPL_RRLP_ASSIST_REFLOC) {
+                cache.lat = assist->pos.lat;
+                cache.lon = assist->pos.lon;
+                cache.uncertainty = assist->pos.uncertainty;
+                cache.pos_v.from = now;
+                cache.pos_v.until = now + AIDCACHE_POS_VALID;
+        }
+        // the week of the reference time, or of now without one
+        week = (assist->set & SUPL_RRLP_ASSIST_REFTIME) ? assist->time.gps_week : (int)(now / GPS_WEEK_S);
+        for (i = 0; i < assist->cnt_eph; i++)
+                put_eph(&assist->eph[i], week, now);
+        for (i = 0; i < assist->cnt_alm; i++) {
+                const struct supl_almanac_s *alm = &assist->alm[i];
+                AidAlm *a;
+                int64_t toa;
+                int w = assist->alm_week;
+
+                if (alm->prn < 1 || alm->prn > MAX_EPHEMERIS)
+                        continue;
+                a = &cache.alm[alm->prn - 1];
+                toa = gps_seconds(&w, alm->toa * 4096L, now);
+                a->v.from = toa - AIDCACHE_ALM_VALID;
+                a->v.until = toa + AIDCACHE_ALM_VALID;
+                a->week = w;
+                a->alm = *alm;
+        }
+        slot_write();
+        pthread_mutex_unlock(&cache_lock);
+}
+
+/* an ephemeris decoded from the sky, week mod 1024 */
+void
+aidcache_put_eph(const struct supl_ephemeris_s *eph, int week, int64_t now) {
+        pthread_mutex_lock(&cache_lock);
+        put_eph(eph, week, now);
+        slot_write();
+        pthread_mutex_unlock(&cache_lock);
+}
+
+/* everything good at now into assist, the ephemeris weeks (mod 1024) into week.
+ * returns the number of ephemerides.
+ */
+int
+aidcache_get(supl_assist_t *assist, int *week, int64_t now) {
+        int i;
+
+        memset(assist, 0, sizeof(*assist));
+        pthread_mutex_lock(&cache_lock);
+        if (held(&cache.iono_v, now)) {
+                assist->set |= SUPL_RRLP_ASSIST_IONO;
+                assist->iono = cache.iono;
+        }
+        if (held(&cache.utc_v, now)) {
+                assist->set |= SUPL_RRLP_ASSIST_UTC;
+                assist->utc = cache.utc;
+        }
+        if (held(&cache.pos_v, now)) {
+                assist->set |= SUPL_RRLP_ASSIST_REFLOC;
+                assist->pos.lat = cache.lat;
+                assist->pos.lon = cache.lon;
+                assist->pos.uncertainty = cache.uncertainty;
+        }
+        for (i = 0; i < MAX_EPHEMERIS; i++) {
+                if (held(&cache.eph[i].v, now)) {
+                        week[assist->cnt_eph] = cache.eph[i].week & 1023;
+                        assist->eph[assist->cnt_eph++] = cache.eph[i].eph;
+                }
+                if (held(&cache.alm[i].v, now)) {
+                        assist->alm_week = cache.alm[i].week & 1023;
+                        assist->alm[assist->cnt_alm++] = cache.alm[i].alm;
+                }
+        }
+        if (assist->cnt_eph > 0)
+                assist->set |= SUPL_RRLP_ASSIST_EPHEMERIS;
+        pthread_mutex_unlock(&cache_lock);
+
+        return assist->cnt_eph;
+}
+
+/* gps seconds the reference location came in, 0 if it is not good at now */
+int64_t
+aidcache_pos_time(int64_t now) {
+        int64_t t = 0;
+
+        pthread_mutex_lock(&cache_lock);
+        if (held(&cache.pos_v, now))
+                t = cache.pos_v.from;
+        pthread_mutex_unlock(&cache_lock);
+        return t;
+}
+
+/* gps seconds until which at least need of the satellites in visible (bit
+ * prn - 1, 0 for any) keep an ephemeris with EPH_MARGIN left, now if they
+ * do not already
+ */
+int64_t
+aidcache_expiry(uint32_t visible, int need, int64_t now) {
+        int64_t until[MAX_EPHEMERIS], t;
+        int i, j, n = 0;
+
+        pthread_mutex_lock(&cache_lock);
+        for (i = 0; i < MAX_EPHEMERIS; i++) {
+                if (visible != 0 && !(visible & (1u << i)))
+                        continue;
+                if (!held(&cache.eph[i].v, now))
+                        continue;
+                // latest first
+                t = cache.eph[i].v.until - EPH_MARGIN;
+                for (j = n++; j > 0 && until[j - 1] < t; j--)
+                        until[j] = until[j - 1];
+                until[j] = t;
+        }
+        pthread_mutex_unlock(&cache_lock);
+
+        if (need < 1)
+                need = 1;
+        if (n < need || until[need - 1] < now)
+                return now;
+        return until[need - 1];
+}
+
+/* tell the SUPL request what is held, so only the rest comes */
+void
+aidcache_have(supl_ctx_t *ctx, int64_t now) {
+        int i, have = 0;
+
+        pthread_mutex_lock(&cache_lock);
+        if (held(&cache.iono_v, now))
+                have |= SUPL_RRLP_ASSIST_IONO;
+        if (held(&cache.utc_v, now))
+                have |= SUPL_RRLP_ASSIST_UTC;
+        for (i = 0; i < MAX_EPHEMERIS; i++) {
+                const AidEph *e = &cache.eph[i];
+                int64_t toe = e->v.from + (e->v.until - e->v.from) / 2;
+
+                // one about to run out is as good as missing
+                if (!held(&e->v, now) || e->v.until - now < EPH_MARGIN)
+                        continue;
+                supl_add_have_eph(ctx, i + 1, e->eph.IODC & 0xFF, e->week & 1023,
+                                  (int)((toe % GPS_WEEK_S) / 3600));
+                have |= SUPL_RRLP_ASSIST_EPHEMERIS;
+        }
+        pthread_mutex_unlock(&cache_lock);
+
+        supl_set_have(ctx, have);
+        D("aid cache holds 0x%x, %d ephemerides", have, ctx->p.nav.n);
+}
+
+void
+aidcache_clear() {
+        pthread_mutex_lock(&cache_lock);
+        memset(&cache, 0, sizeof(cache));
+        if (map != NULL) {
+                memset(map, 0, 2 * AIDCACHE_SLOT_SIZE);
+                msync(map, 2 * AIDCACHE_SLOT_SIZE, MS_ASYNC);
+        }
+        pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,69 @@
+#ifndef AIDCACHE_H
+#define AIDCACHE_H
+#include <stdint.h>
+#include "supl.h"
+
+#define AIDCACHE_MAGIC          0x43444941      // "AIDC"
+#define AIDCACHE_VERSION        1
+#define AIDCACHE_SLOT_SIZE      8192            // two pages per slot
+
+#define AIDCACHE_FIT            (4 * 3600)      // s, ephemeris fit interval with the fit flag clear
+#define AIDCACHE_FIT_LONG       (6 * 3600)      // with it set
+#define AIDCACHE_ALM_VALID      (7 * 86400)     // s around toa
+#define AIDCACHE_UTC_VALID      (7 * 86400)     // s from reception
+#define AIDCACHE_IONO_VALID     86400
+#define AIDCACHE_POS_VALID      3600
+
+#define GPS_WEEK_S              604800
+
+/* one assistance element and the gps seconds it is good for */
+typedef struct {
+        int64_t                 from;
+        int64_t                 until;          // 0: not held
+} AidValid;
+
+typedef struct {
+        AidValid                v;
+        int32_t                 week;           // full gps week of toe
+        int32_t                 fill;
+        struct supl_ephemeris_s eph;
+} AidEph;
+
+typedef struct {
+        AidValid                v;
+        int32_t                 week;
+        int32_t                 fill;
+        struct supl_almanac_s   alm;
+} AidAlm;
+
+/* the cache as it sits in each of the two slots of the file. the valid
+ * slot with the higher seq wins, see lastfix.h.
+ */
+typedef struct {
+        uint32_t                magic;
+        uint32_t                version;
+        uint32_t                seq;
+        uint32_t                size;           // sizeof(AidCache)
+        AidValid                iono_v;
+        struct supl_ionospheric_s iono;
+        AidValid                utc_v;
+        struct supl_utc_s       utc;
+        AidValid                pos_v;
+        double                  lat, lon;
+        int32_t                 uncertainty;    // 23.032 k
+        int32_t                 fill;
+        AidEph                  eph[MAX_EPHEMERIS];     // by prn - 1
+        AidAlm                  alm[MAX_EPHEMERIS];
+        uint32_t                crc;            // of everything before it
+} AidCache;
+
+int aidcache_open(const char *path);
+void aidcache_close();
+void aidcache_put(const supl_assist_t *assist, int64_t now);
+void aidcache_put_eph(const struct supl_ephemeris_s *eph, int week, int64_t now);
+int aidcache_get(supl_assist_t *assist, int *week, int64_t now);
+int64_t aidcache_pos_time(int64_t now);
+int64_t aidcache_expiry(uint32_t visible, int need, int64_t now);
+void aidcache_have(supl_ctx_t *ctx, int64_t now);
+void aidcache_clear();
+#endif
@@ -0,0 +1,460 @@
+/*
+ * aid frames to the receiver with delivery confirmed by its ACK-ACK/ACK-NAK.
+ *
+ * up to AIDQ_WINDOW frames are in flight, so the uart stays busy while the
+ * acks of the earlier ones come back. an ack names the message type only and
+ * the receiver answers in order, so it settles the oldest frame of that type
+ * in flight. a nak or no ack by AIDQ_ACK_WAIT after the frame has left the
+ * uart sends it again, up to AIDQ_RETRIES times. AID-INI carries the time of
+ * its last byte and is never sent again. commands (polls and the like)
+ * share the tty with the aid: aidq_cmd() writes them ahead of any aid not
+ * yet started, without waiting for an ack.
+ *
+ * a receiver that acks nothing would see every frame three times: after
+ * AIDQ_NOACK_AFTER timeouts without a single ack frames only go out once,
+ * no more than AIDQ_LINE_AHEAD bytes ahead of the uart. any ack of aid
+ * brings the acks back, so does a restart. a frame that does not get
+ * through is handed to the lost callback, for what was taken as delivered.
+ *
+ * the tty does not block: a frame cut short by a full output buffer goes on
+ * from where it stopped, nothing the queue holds is written before its last
+ * byte, not even after a reset. anything else written to the receiver could
+ * land inside it, so every command goes through aidq_cmd().
+ * aidq_want_write() tells the caller to wait for the tty to take more.
+ * the delivery of each message type is logged whenever the queue runs empty.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "aidq.h"
+#include "casic.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static AidFrame q[AIDQ_MAX];
+static AidStats stats[AIDQ_TYPES];
+static AidFrame *writing;                       // partly on the wire
+static unsigned int next_seq;
+static int line_bps = 9600;
+static long long line_free_at;                  // ms the uart is through what was written
+static int blocked;                             // the tty took less than it was given
+static int acks_seen;
+static int timeouts;
+static int noack;
+static aidq_lost_cb lost_cb;
+
+/* MSG (0x08) ephemerides and models, AID (0x0B) */
+static int
+aid_class(int id) {
+        return (id & 0xFF) == 0x08 || (id & 0xFF) == 0x0B;
+}
+
+static AidStats *
+stats_of(int id) {
+        int i;
+
+        for (i = 0; i < AIDQ_TYPES; i++) {
+                if (stats[i].id == id)
+                        return &stats[i];
+                if (stats[i].id == 0) {
+                        stats[i].id = id;
+                        return &stats[i];
+                }
+        }
+        // more types than slots, the last one takes the rest
+        return &stats[AIDQ_TYPES - 1];
+}
+
+static AidFrame *
+frame_free() {
+        int i;
+
+        for (i = 0; i < AIDQ_MAX; i++)
+                if (q[i].state == AIDQ_FREE)
+                        return &q[i];
+        return NULL;
+}
+
+static void
+frame_lost(const AidFrame *f) {
+        if (lost_cb != NULL && !f->cmd)
+                lost_cb(f->frame, f->len);
+}
+
+/* the oldest queued command */
+static AidFrame *
+cmd_oldest() {
+        AidFrame *f = NULL;
+        int i;
+
+        for (i = 0; i < AIDQ_MAX; i++) {
+                if (q[i].state != AIDQ_QUEUED || !q[i].cmd)
+                        continue;
+                if (f == NULL || (int)(q[i].seq - f->seq) < 0)
+                        f = &q[i];
+        }
+        return f;
+}
+
+/* the oldest frame in state, of type id (0 for any) */
+static AidFrame *
+frame_oldest(int state, int id) {
+        AidFrame *f = NULL;
+        int i;
+
+        for (i = 0; i < AIDQ_MAX; i++) {
+                if (q[i].state != state || (id != 0 && q[i].id != id))
+                        continue;
+                if (f == NULL || (int)(q[i].seq - f->seq) < 0)
+                        f = &q[i];
+        }
+        return f;
+}
+
+static int
+in_flight() {
+        int i, n = 0;
+
+        for (i = 0; i < AIDQ_MAX; i++)
+                if (q[i].state == AIDQ_SENT)
+                        n += 1;
+        return n;
+}
+
+/* bytes written and not yet out of the uart */
+static int
+line_ahead(long long now) {
+        if (line_free_at <= now)
+                return 0;
+        return (int)((line_free_at - now) * line_bps / (10 * 1000));
+}
+
+/* write the rest of f, its deadline counts the bytes still ahead of it on the line */
+static int
+frame_write(int fd, AidFrame *f, long long now) {
+        AidStats *st;
+        int ret;
+
+        do {
+                ret = write(fd, f->frame + f->off, f->len - f->off);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+                if (errno == EAGAIN)
+                        blocked = 1;
+                return -1;
+        }
+        if (line_free_at < now)
+                line_free_at = now;
+        line_free_at += (long long)ret * 10 * 1000 / line_bps;
+        f->off += ret;
+        if (f->off < f->len) {
+                writing = f;
+                blocked = 1;
+                return -1;
+        }
+        writing = NULL;
+        f->off = 0;
+
+        if (f->cmd) {
+                f->state = AIDQ_FREE;
+                return 0;
+        }
+        st = stats_of(f->id);
+        if (f->tries++ == 0)
+                st->sent += 1;
+        else
+                st->retried += 1;
+        if (noack) {
+                st->unconfirmed += 1;
+                f->state = AIDQ_FREE;
+                return 0;
+        }
+        f->state = AIDQ_SENT;
+        f->sent_at = now;
+        f->deadline = line_free_at + AIDQ_ACK_WAIT;
+        return 0;
+}
+
+/* delivery per message type since the queue last ran empty */
+static void
+report() {
+        int i;
+
+        for (i = 0; i < AIDQ_TYPES && stats[i].id != 0; i++) {
+                AidStats *st = &stats[i];
+
+                D("aid 0x%04x sent %d acked %d nacked %d retried %d failed %d unconfirmed %d, ack in %lld ms",
+                  st->id, st->sent, st->acked, st->nacked, st->retried, st->failed, st->unconfirmed,
+                  st->acked > 0 ? st->latency / st->acked : 0);
+        }
+        memset(stats, 0, sizeof(stats));
+}
+
+/* fill the window with the oldest queued frames, the line alone bounds it without acks */
+static void
+pump(int fd, long long now) {
+        AidFrame *f;
+
+        blocked = 0;
+        // a frame cut short goes on before anything else
+        if (writing != NULL && frame_write(fd, writing, now) < 0)
+                return;
+        // commands wait for nothing but the tty
+        while ((f = cmd_oldest()) != NULL) {
+                if (frame_write(fd, f, now) < 0)
+                        return;
+        }
+        while (noack ? line_ahead(now) < AIDQ_LINE_AHEAD : in_flight() < AIDQ_WINDOW) {
+                f = frame_oldest(AIDQ_QUEUED, 0);
+                if (f == NULL || frame_write(fd, f, now) < 0)
+                        break;
+        }
+        if (stats[0].id != 0 && frame_oldest(AIDQ_QUEUED, 0) == NULL && frame_oldest(AIDQ_SENT, 0) == NULL)
+                report();
+}
+
+/* a sent frame is not coming back: again, or given up */
+static void
+frame_retry(AidFrame *f) {
+        if (f->tries <= f->retries) {
+                f->state = AIDQ_QUEUED;
+                return;
+        }
+        stats_of(f->id)->failed += 1;
+        D("aid 0x%04x given up after %d tries", f->id, f->tries);
+        frame_lost(f);
+        f->state = AIDQ_FREE;
+}
+
+void
+aidq_init(int bps) {
+        pthread_mutex_lock(&q_lock);
+        if (bps > 0)
+                line_bps = bps;
+        pthread_mutex_unlock(&q_lock);
+}
+
+void
+aidq_set_lost_cb(aidq_lost_cb cb) {
+        pthread_mutex_lock(&q_lock);
+        lost_cb = cb;
+        pthread_mutex_unlock(&q_lock);
+}
+
+/* the receiver restarts, aid pending would land in the new run or not at all.
+ * commands stay, and so does the rest of a frame cut short: the receiver would
+ * take whatever follows as its payload. frames lost to the restart say nothing
+ * about its acks */
+void
+aidq_reset() {
+        int i;
+
+        pthread_mutex_lock(&q_lock);
+        for (i = 0; i < AIDQ_MAX; i++) {
+                if (q[i].state == AIDQ_FREE || q[i].cmd)
+                        continue;
+                frame_lost(&q[i]);
+                if (&q[i] == writing)
+                        q[i].cmd = 1;           // finished, never confirmed
+                else
+                        memset(&q[i], 0, sizeof(q[i]));
+        }
+        if (writing == NULL)
+                blocked = 0;
+        acks_seen = 0;
+        timeouts = 0;
+        noack = 0;
+        pthread_mutex_unlock(&q_lock);
+}
+
+/* AID-INI goes ahead of everything not yet written */
+static unsigned int
+head_seq() {
+        AidFrame *f = frame_oldest(AIDQ_QUEUED, 0);
+
+        return f != NULL ? f->seq - 1 : next_seq++;
+}
+
+/* the frames of buff (as cas_make_msg() builds them) into the queue, returns how many */
+int
+aidq_send(int fd, const unsigned char *buff, int len, long long now) {
+        AidFrame *f;
+        int i = 0, n = 0, total, id;
+
+        pthread_mutex_lock(&q_lock);
+        while (i + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE <= len &&
+               buff[i] == BIN_HEADER0 && buff[i + 1] == BIN_HEADER1) {
+                total = CASIC_HEAD_SIZE + casic_u2(buff + i + 2) + CASIC_CKSUM_SIZE;
+                if (i + total > len)
+                        break;
+                id = casic_u2(buff + i + 4);
+                f = total <= AIDQ_FRAME_MAX ? frame_free() : NULL;
+                if (f == NULL) {
+                        // written past the queue it could be cut short with nothing to finish it
+                        stats_of(id)->failed += 1;
+                        D("aid 0x%04x of %d bytes dropped, no room in the queue", id, total);
+                        if (lost_cb != NULL)
+                                lost_cb(buff + i, total);
+                } else {
+                        memset(f, 0, sizeof(*f));
+                        f->state = AIDQ_QUEUED;
+                        f->id = id;
+                        f->len = total;
+                        f->retries = id == ID_AID_INI ? 0 : AIDQ_RETRIES;
+                        f->seq = id == ID_AID_INI ? head_seq() : next_seq++;
+                        memcpy(f->frame, buff + i, total);
+                        n += 1;
+                }
+                i += total;
+        }
+        pump(fd, now);
+        pthread_mutex_unlock(&q_lock);
+        return n;
+}
+
+/* len bytes for the receiver that expect no ack, returns 1 if queued */
+int
+aidq_cmd(int fd, const unsigned char *buff, int len, long long now) {
+        AidFrame *f;
+
+        pthread_mutex_lock(&q_lock);
+        f = len > 0 && len <= AIDQ_FRAME_MAX ? frame_free() : NULL;
+        if (f == NULL) {
+                pthread_mutex_unlock(&q_lock);
+                D("command of %d bytes dropped", len);
+                return 0;
+        }
+        memset(f, 0, sizeof(*f));
+        f->state = AIDQ_QUEUED;
+        f->cmd = 1;
+        f->len = len;
+        f->seq = next_seq++;
+        memcpy(f->frame, buff, len);
+        pump(fd, now);
+        pthread_mutex_unlock(&q_lock);
+        return 1;
+}
+
+/* bytes the tty still has to take before a frame queued now can start:
+ * the rest of a frame cut short and the commands waiting */
+int
+aidq_ahead() {
+        int i, n;
+
+        pthread_mutex_lock(&q_lock);
+        n = writing != NULL ? writing->len - writing->off : 0;
+        for (i = 0; i < AIDQ_MAX; i++)
+                if (q[i].state == AIDQ_QUEUED && q[i].cmd && &q[i] != writing)
+                        n += q[i].len;
+        pthread_mutex_unlock(&q_lock);
+        return n;
+}
+
+/* 1 while the tty holds back frames, the caller polls it for writing */
+int
+aidq_want_write() {
+        int ret;
+
+        pthread_mutex_lock(&q_lock);
+        ret = blocked;
+        pthread_mutex_unlock(&q_lock);
+        return ret;
+}
+
+/* ACK-ACK (ok) or ACK-NAK for message type id */
+void
+aidq_ack(int fd, int id, int ok, long long now) {
+        AidFrame *f;
+        AidStats *st;
+
+        pthread_mutex_lock(&q_lock);
+        if (aid_class(id)) {
+                // late for its frame or not, the receiver does ack aid
+                acks_seen += 1;
+                if (noack) {
+                        D("aid 0x%04x acked, aid is confirmed again", id);
+                        noack = 0;
+                        timeouts = 0;
+                }
+        }
+        f = frame_oldest(AIDQ_SENT, id);
+        if (f != NULL) {
+                st = stats_of(id);
+                if (ok) {
+                        st->acked += 1;
+                        st->latency += now - f->sent_at;
+                        f->state = AIDQ_FREE;
+                } else {
+                        st->nacked += 1;
+                        D("aid 0x%04x nacked, try %d", id, f->tries);
+                        frame_retry(f);
+                }
+        }
+        pump(fd, now);
+        pthread_mutex_unlock(&q_lock);
+}
+
+/* ms until aidq_tick() is due, -1 for none */
+int
+aidq_timeout(long long now) {
+        long long t = -1;
+        int i;
+
+        pthread_mutex_lock(&q_lock);
+        for (i = 0; i < AIDQ_MAX; i++) {
+                if (q[i].state == AIDQ_SENT && (t < 0 || q[i].deadline < t))
+                        t = q[i].deadline;
+        }
+        if (frame_oldest(AIDQ_QUEUED, 0) != NULL) {
+                long long w = now + AIDQ_ACK_WAIT;
+
+                // without acks the next frames go once the line has room,
+                // a write that failed is tried again after a while
+                if (noack && !blocked && line_ahead(now) >= AIDQ_LINE_AHEAD)
+                        w = line_free_at - (long long)AIDQ_LINE_AHEAD * 10 * 1000 / line_bps;
+                if (t < 0 || w < t)
+                        t = w;
+        }
+        pthread_mutex_unlock(&q_lock);
+
+        if (t < 0)
+                return -1;
+        return t > now ? (int)(t - now) : 0;
+}
+
+void
+aidq_tick(int fd, long long now) {
+        int i;
+
+        pthread_mutex_lock(&q_lock);
+        for (i = 0; i < AIDQ_MAX; i++) {
+                AidFrame *f = &q[i];
+
+                if (f->state != AIDQ_SENT || f->deadline > now)
+                        continue;
+                if (!noack && acks_seen == 0 && ++timeouts >= AIDQ_NOACK_AFTER) {
+                        D("no acks from the receiver, aid goes out unconfirmed");
+                        noack = 1;
+                }
+                if (noack) {
+                        stats_of(f->id)->unconfirmed += 1;
+                        f->state = AIDQ_FREE;
+                        continue;
+                }
+                D("aid 0x%04x not acked, try %d", f->id, f->tries);
+                frame_retry(f);
+        }
+        pump(fd, now);
+        pthread_mutex_unlock(&q_lock);
+}
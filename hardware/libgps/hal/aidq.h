@@ -0,0 +1,59 @@
+#ifndef AIDQ_H
+#define AIDQ_H
+
+#define AIDQ_MAX                128             // frames queued or in flight, a full set of every constellation
+#define AIDQ_FRAME_MAX          160             // bytes, larger frames are dropped
+#define AIDQ_WINDOW             4               // frames in flight before waiting for an ack
+#define AIDQ_ACK_WAIT           500             // ms after the last byte is out
+#define AIDQ_RETRIES            2
+#define AIDQ_NOACK_AFTER        AIDQ_WINDOW     // timeouts without any ack: the receiver does not ack aid
+#define AIDQ_LINE_AHEAD         (AIDQ_WINDOW * AIDQ_FRAME_MAX)  // bytes written ahead of the uart without acks
+#define AIDQ_TYPES              8
+
+enum {
+        AIDQ_FREE = 0,
+        AIDQ_QUEUED,                            // waiting for a place in the window
+        AIDQ_SENT,                              // written, waiting for the ack
+};
+
+/* one aid frame */
+typedef struct {
+        int                     state;          // AIDQ_FREE...
+        int                     id;
+        int                     len;
+        int                     off;            // bytes on the wire while it is cut short
+        int                     tries;
+        int                     retries;        // allowed
+        int                     cmd;            // a command, written ahead of the aid and not acked
+        unsigned int            seq;
+        long long               sent_at;
+        long long               deadline;
+        unsigned char           frame[AIDQ_FRAME_MAX];
+} AidFrame;
+
+/* delivery of one message type */
+typedef struct {
+        int                     id;
+        int                     sent;
+        int                     acked;
+        int                     nacked;
+        int                     retried;
+        int                     failed;
+        int                     unconfirmed;    // written to a receiver that does not ack
+        long long               latency;        // ms, sum over acked
+} AidStats;
+
+/* an aid frame that did not get through: nacked, given up, dropped or reset */
+typedef void (*aidq_lost_cb)(const unsigned char *frame, int len);
+
+void aidq_init(int bps);
+void aidq_set_lost_cb(aidq_lost_cb cb);
+void aidq_reset();
+int aidq_send(int fd, const unsigned char *buff, int len, long long now);
+int aidq_cmd(int fd, const unsigned char *buff, int len, long long now);
+int aidq_ahead();
+int aidq_want_write();
+void aidq_ack(int fd, int id, int ok, long long now);
+int aidq_timeout(long long now);
+void aidq_tick(int fd, long long now);
+#endif
@@ -15,34 +15,6 @@ unsigned int calc_checksum(unsigned int data[], int n)
         return sum;
 }
 
-unsigned int cas_make_msg(int id, int *msg, int n, unsigned char *buff)
-{
-        int i;
-        int ckSum;
-        char head[6];
-
-        head[0] = 0xBA;
-        head[1] = 0xCE;
-        head[2] = (char)(n & 0xFF);		// LENGTH
-        head[3] = (char)(n >> 8);
-        head[4] = (char)(id & 0xFF);	// CLASS	ID
-        head[5] = (char)(id >> 8);		// MESSAGE	ID
-
-        // 32-bit Sum Algorithm
-        //
-        ckSum = (id << 16) + n;
-        for (i = 0; i < (n / 4); i++)
-        {
-                ckSum += msg[i];
-        }
-        //
-        memcpy(buff, head, 6);
-        memcpy(buff + 6, (char *)msg, n);
-        memcpy(buff + 6 + n, (char *)(&ckSum), 4);
-
-        return (n + 10);
-}
-
 void supl2cas_ini(supl_assist_t *ctx, AID_INI_STR *cas_ini)
 {
         cas_ini->flags		= 0x00;
@@ -50,17 +22,16 @@ void supl2cas_ini(supl_assist_t *ctx, AID_INI_STR *cas_ini)
         if (ctx->set & SUPL_RRLP_ASSIST_REFTIME) {
                 cas_ini->tow	  = ctx->time.gps_tow * 0.08;
                 cas_ini->wn			= ctx->time.gps_week + 2048;
-                cas_ini->flags  |= 0x02;
+                cas_ini->flags  |= AID_INI_TIME_VALID;
         }
 
         if (ctx->set & SUPL_RRLP_ASSIST_REFLOC) {
                 cas_ini->xOrLat		= ctx->pos.lat;
                 cas_ini->yOrLon		= ctx->pos.lon;
                 cas_ini->zOrAlt		= 0;
-                cas_ini->posAcc		= 5000;
-                //cas_ini->posAcc		= ctx->pos.uncertainty;
-                //cas_ini->posAcc		= 10.0*(pow(1.1, ctx->pos.uncertainty)-1);
-                cas_ini->flags		|= 0x21;
+                // 3GPP TS 23.032 uncertainty code, 10 * (1.1 ^ k - 1) m
+                cas_ini->posAcc		= 10.0 * (pow(1.1, ctx->pos.uncertainty & 0x7f) - 1);
+                cas_ini->flags		|= AID_INI_POS_VALID | AID_INI_POS_LLA;
         }
 
         cas_ini->timeSource	= 0;
@@ -136,3 +107,112 @@ void supl2cas_iono(struct supl_ionospheric_s *iono_ctx, FIX_IONO_STR *cas_iono)
         cas_iono->valid			= NAVIGATION_MESSAGE_AVAILABLE;
         cas_iono->wordCheckSum	= calc_checksum((unsigned int *)cas_iono, sizeof(FIX_IONO_STR) / 4);
 }
+
+void supl2cas_bds_eph(unsigned short wn, struct supl_bds_ephemeris_s *eph_ctx, BD2_FIX_EPHEMERIS_STR *cas_eph)
+{
+        cas_eph->ura				  = eph_ctx->urai;
+        cas_eph->svid			    = eph_ctx->prn;
+        cas_eph->aodc			    = eph_ctx->aodc;
+        cas_eph->aode			    = eph_ctx->aode;
+        cas_eph->kepler.sqra	= eph_ctx->A_sqrt;
+        cas_eph->kepler.es		= eph_ctx->e;
+        cas_eph->kepler.m0		= eph_ctx->M0;
+        cas_eph->kepler.i0		= eph_ctx->i0;
+        cas_eph->kepler.idot  = eph_ctx->i_dot;
+        cas_eph->kepler.omega0	  = eph_ctx->OMEGA_0;
+        cas_eph->kepler.omegadot	= eph_ctx->OMEGA_dot;
+        cas_eph->kepler.w		  = eph_ctx->w;
+        cas_eph->kepler.deltn	= eph_ctx->delta_n;
+        cas_eph->kepler.cic		= eph_ctx->Cic;
+        cas_eph->kepler.cis		= eph_ctx->Cis;
+        cas_eph->kepler.crc		= eph_ctx->Crc;
+        cas_eph->kepler.crs		= eph_ctx->Crs;
+        cas_eph->kepler.cuc		= eph_ctx->Cuc;
+        cas_eph->kepler.cus		= eph_ctx->Cus;
+        cas_eph->kepler.toe		= eph_ctx->toe;
+        cas_eph->kepler.wne		= wn;
+        //
+        cas_eph->svClock.toc	= eph_ctx->toc;
+        cas_eph->svClock.af0	= eph_ctx->AF0;
+        cas_eph->svClock.af1	= eph_ctx->AF1;
+        cas_eph->svClock.af2	= eph_ctx->AF2;
+        cas_eph->svClock.tgd1	= eph_ctx->tgd1;
+        //
+        cas_eph->health			  = eph_ctx->health;
+        if (cas_eph->health == 0)
+        {
+                cas_eph->valid = NAVIGATION_MESSAGE_AVAILABLE;
+        }
+        else
+        {
+                cas_eph->valid = NAVIGATION_MESSAGE_UNHEALTHY;
+        }
+        cas_eph->wordCheckSum	= calc_checksum((unsigned int *)cas_eph, sizeof(BD2_FIX_EPHEMERIS_STR) / 4);
+}
+
+// BDT-UTC has no reference time, the offset holds for the whole week
+// wn: BDS week now, the D1 model has no reference time of its own and runs
+// from the start of the current week
+void supl2cas_bds_utc(unsigned short wn, struct supl_bds_utc_s *utc_ctx, FIX_UTC_STR *cas_utc)
+{
+        int dlsf = utc_ctx->delta_tlsf - utc_ctx->delta_tls;
+
+        cas_utc->a0				= utc_ctx->a0;
+        cas_utc->a1				= utc_ctx->a1;
+        cas_utc->dn				= utc_ctx->dn;
+        cas_utc->dtls			= utc_ctx->delta_tls;
+        cas_utc->dtlsf			= utc_ctx->delta_tlsf;
+        cas_utc->tot				= 0;
+        cas_utc->wnlsf			= utc_ctx->wnlsf;
+        cas_utc->wnt				= wn & 0xFF;
+        // BDT has taken no leap second back since 2006, the next one is at most one away, DN is 0..6
+        if (utc_ctx->delta_tls >= 0 && dlsf >= -1 && dlsf <= 1 && utc_ctx->dn <= 6)
+                cas_utc->valid		= NAVIGATION_MESSAGE_AVAILABLE;
+        else
+                cas_utc->valid		= NAVIGATION_MESSAGE_ABSENCE;
+        cas_utc->wordCheckSum	= calc_checksum((unsigned int *)cas_utc, sizeof(FIX_UTC_STR) / 4);
+}
+
+// nt, n4: the day of tb, taugps: GLONASS against GPS time
+void supl2cas_glo_eph(unsigned short nt, unsigned char n4, int taugps, struct supl_glo_ephemeris_s *eph_ctx, GLN_FIX_EPHEMERIS_STR *cas_eph)
+{
+        cas_eph->svid			= eph_ctx->slot;
+        cas_eph->freq			= eph_ctx->freq;
+        cas_eph->x				= eph_ctx->x;
+        cas_eph->y				= eph_ctx->y;
+        cas_eph->z				= eph_ctx->z;
+        cas_eph->vx				= eph_ctx->vx;
+        cas_eph->vy				= eph_ctx->vy;
+        cas_eph->vz				= eph_ctx->vz;
+        cas_eph->ax				= eph_ctx->ax;
+        cas_eph->ay				= eph_ctx->ay;
+        cas_eph->az				= eph_ctx->az;
+        cas_eph->taun			= eph_ctx->tau;
+        cas_eph->dtaun			= eph_ctx->dtau;
+        cas_eph->gamman			= eph_ctx->gamma;
+        cas_eph->taugps			= taugps;
+        cas_eph->tb				= eph_ctx->tb;
+        cas_eph->nt				= nt;
+        cas_eph->n4				= n4;
+        cas_eph->en				= eph_ctx->en;
+        cas_eph->ft				= eph_ctx->ft;
+        cas_eph->p1				= eph_ctx->p1;
+        cas_eph->p2				= eph_ctx->p2;
+        cas_eph->m				= eph_ctx->m;
+        //
+        cas_eph->health			= eph_ctx->health;
+        if (cas_eph->freq == SUPL_GLO_FREQ_NONE)
+        {
+                // no channel to search on
+                cas_eph->valid = NAVIGATION_MESSAGE_ABSENCE;
+        }
+        else if (cas_eph->health == 0)
+        {
+                cas_eph->valid = NAVIGATION_MESSAGE_AVAILABLE;
+        }
+        else
+        {
+                cas_eph->valid = NAVIGATION_MESSAGE_UNHEALTHY;
+        }
+        cas_eph->wordCheckSum	= calc_checksum((unsigned int *)cas_eph, sizeof(GLN_FIX_EPHEMERIS_STR) / 4);
+}
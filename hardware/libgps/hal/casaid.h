@@ -5,14 +5,17 @@
 #include <time.h>
 #include <sys/time.h>
 #include "supl.h"
-
-#define BIN_HEADER0						0xBA
-#define BIN_HEADER1						0xCE
+#include "casic.h"
 
 #define ID_RXM_GPS_EPH					0x0708
-#define ID_AID_INI 						0x010B
 #define ID_RXM_GPS_UTC					0x0508
 #define ID_RXM_GPS_ION					0x0608
+#define ID_RXM_BDS_UTC					0x0008
+#define ID_RXM_BDS_ION					0x0108
+#define ID_RXM_BDS_EPH					0x0208
+#define ID_RXM_GLN_EPH					0x0808
+
+#define BDS_WEEK_OFFSET					1356		// gps week of the BDT epoch, 2006-01-01
 
 #define MAX_EPHEMERIS 32
 
@@ -78,6 +81,94 @@ typedef struct _GPS_FIX_EPHEMERIS_STR
 
 } GPS_FIX_EPHEMERIS_STR;
 
+// ============================================================
+// BD2定点开普勒轨道参数(星历)
+typedef struct _BD2_FIX_KEPLER_EPH_STR
+{
+        unsigned int				sqra;				// 32
+        unsigned int				es;					// 32
+        int							w;					// 32*
+        int							m0;					// 32*
+        int							i0;					// 32*
+        int							omega0;				// 32*
+        int							omegadot;			// 24*
+        short int					deltn;				// 16*
+        short int					idot;				// 14*
+        int							cuc;				// 18*
+        int							cus;				// 18*
+        int							crc;				// 18*
+        int							crs;				// 18*
+        int							cic;				// 18*
+        int							cis;				// 18*
+        unsigned int				toe;				// 17
+        unsigned short int			wne;				// 13
+        unsigned short int			reserved;
+
+} BD2_FIX_KEPLER_EPH_STR;
+
+// ============================================================
+// BD2定点时钟修正参数
+typedef struct _BD2_FIX_SV_CLOCK_STR
+{
+        unsigned int				toc;				// 17
+        int							af0;				// 24*
+        int							af1;				// 22*
+        short int					af2;				// 11*
+        short int					tgd1;				// 10*
+
+} BD2_FIX_SV_CLOCK_STR;
+
+// ============================================================
+// BD2定点星历
+typedef struct _BD2_FIX_EPHEMERIS_STR
+{
+        unsigned int				wordCheckSum;
+        BD2_FIX_KEPLER_EPH_STR		kepler;
+        BD2_FIX_SV_CLOCK_STR		svClock;
+        unsigned char				aodc;				// 5
+        unsigned char				aode;				// 5
+        unsigned char				ura;				// 4
+        unsigned char				health;				// 1
+        unsigned char				svid;
+        unsigned char				valid;
+        unsigned short int 			sow;				// 6秒
+
+} BD2_FIX_EPHEMERIS_STR;
+
+// ============================================================
+// GLONASS定点星历(ECEF坐标)
+typedef struct _GLN_FIX_EPHEMERIS_STR
+{
+        unsigned int			wordCheckSum;
+        int						x;						// 27*
+        int						y;						// 27*
+        int						z;						// 27*
+        int						vx;						// 24*
+        int						vy;						// 24*
+        int						vz;						// 24*
+        signed char				ax;						// 5*
+        signed char				ay;						// 5*
+        signed char				az;						// 5*
+        signed char				dtaun;					// 5*
+        int						taun;					// 22*
+        int						taugps;					// 22*
+        short int				gamman;					// 11*
+        unsigned short int		nt;						// 11
+        unsigned char			n4;						// 5
+        unsigned char			tb;						// 7
+        unsigned char			en;						// 5
+        unsigned char			ft;						// 4
+        unsigned char			p1;						// 2
+        unsigned char			p2;						// 1
+        unsigned char			m;						// 2
+        unsigned char			health;					// Bn
+        signed char				freq;					// 频率号 -7..6
+        unsigned char			svid;					// 1..24
+        unsigned char			valid;
+        unsigned char			reserved;
+
+} GLN_FIX_EPHEMERIS_STR;
+
 // ============================================================
 // 定点UTC(GPS和BD2采用相同的信息格式)
 typedef struct _FIX_UTC_STR
@@ -112,24 +203,6 @@ typedef struct _FIX_IONO_STR
 
 } FIX_IONO_STR;
 
-// 辅助信息（位置，时间，频率）
-typedef struct  _AID_INI_STR
-{
-        double							xOrLat;
-        double							yOrLon;
-        double							zOrAlt;
-        double							tow;
-        float							df;
-        float							posAcc;
-        float							tAcc;
-        float							fAcc;
-        unsigned int					res;
-        unsigned short int				wn;
-        unsigned char					timeSource;
-        unsigned char					flags;
-
-} AID_INI_STR;
-
 typedef struct
 {
         double							xOrLat, yOrLon, zOrAlt;
@@ -151,9 +224,11 @@ typedef struct
 
 } AID_REQ_STR;
 
-unsigned int cas_make_msg(int id, int *msg, int n, unsigned char *buff);
 void supl2cas_ini(supl_assist_t *ctx, AID_INI_STR *cas_int);
 void supl2cas_eph(unsigned short wn, struct supl_ephemeris_s *eph_ctx, GPS_FIX_EPHEMERIS_STR *cas_eph);
 void supl2cas_utc(struct supl_utc_s *utc_ctx, FIX_UTC_STR *cas_utc);
 void supl2cas_iono(struct supl_ionospheric_s *iono_ctx, FIX_IONO_STR *cas_iono);
+void supl2cas_bds_eph(unsigned short wn, struct supl_bds_ephemeris_s *eph_ctx, BD2_FIX_EPHEMERIS_STR *cas_eph);
+void supl2cas_bds_utc(unsigned short wn, struct supl_bds_utc_s *utc_ctx, FIX_UTC_STR *cas_utc);
+void supl2cas_glo_eph(unsigned short nt, unsigned char n4, int taugps, struct supl_glo_ephemeris_s *eph_ctx, GLN_FIX_EPHEMERIS_STR *cas_eph);
 #endif
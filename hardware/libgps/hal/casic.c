@@ -0,0 +1,224 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "casic.h"
+
+unsigned short casic_u2(const unsigned char *p)
+{
+        return (unsigned short)(p[0] | (p[1] << 8));
+}
+
+unsigned int casic_u4(const unsigned char *p)
+{
+        return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+float casic_r4(const unsigned char *p)
+{
+        float f;
+        memcpy(&f, p, sizeof(f));
+        return f;
+}
+
+double casic_r8(const unsigned char *p)
+{
+        double d;
+        memcpy(&d, p, sizeof(d));
+        return d;
+}
+
+unsigned int cas_make_msg(int id, int *msg, int n, unsigned char *buff)
+{
+        int i;
+        int ckSum;
+        char head[6];
+
+        head[0] = 0xBA;
+        head[1] = 0xCE;
+        head[2] = (char)(n & 0xFF);		// LENGTH
+        head[3] = (char)(n >> 8);
+        head[4] = (char)(id & 0xFF);	// CLASS	ID
+        head[5] = (char)(id >> 8);		// MESSAGE	ID
+
+        // 32-bit Sum Algorithm
+        //
+        ckSum = (id << 16) + n;
+        for (i = 0; i < (n / 4); i++)
+        {
+                ckSum += msg[i];
+        }
+        //
+        memcpy(buff, head, 6);
+        memcpy(buff + 6, (char *)msg, n);
+        memcpy(buff + 6 + n, (char *)(&ckSum), 4);
+
+        return (n + 10);
+}
+
+int casic_send_msg(int fd, int id, const void *msg, int n)
+{
+        unsigned char buff[CASIC_HEAD_SIZE + CASIC_MAX_PAYLOAD + CASIC_CKSUM_SIZE];
+        int payload[CASIC_MAX_PAYLOAD / 4];
+        int len, ret;
+
+        if (fd < 0 || n < 0 || n > CASIC_MAX_PAYLOAD)
+                return -1;
+
+        memcpy(payload, msg, n);
+        len = cas_make_msg(id, payload, n, buff);
+        do {
+                ret = write(fd, buff, len);
+        } while (ret < 0 && errno == EINTR);
+
+        return ret;
+}
+
+// NMEA command into buff, body without '$' and checksum: "PCAS10,0"
+int casic_make_cmd(const char *body, char *buff, int size)
+{
+        unsigned char sum = 0;
+        const char *p;
+        int len;
+
+        for (p = body; *p; p++)
+                sum ^= (unsigned char)*p;
+        len = snprintf(buff, size, "$%s*%02X\r\n", body, sum);
+        if (len <= 0 || len >= size)
+                return -1;
+        return len;
+}
+
+int casic_send_cmd(int fd, const char *body)
+{
+        char buff[128];
+        int len, ret;
+
+        if (fd < 0)
+                return -1;
+        len = casic_make_cmd(body, buff, sizeof(buff));
+        if (len < 0)
+                return -1;
+        do {
+                ret = write(fd, buff, len);
+        } while (ret < 0 && errno == EINTR);
+
+        return ret;
+}
+
+// CFG-MSG into buff: output the message every rate epochs, 0 to turn it off
+unsigned int casic_make_enable(int id, int rate, unsigned char *buff)
+{
+        int cfg[1];
+        unsigned char *c = (unsigned char *)cfg;
+
+        c[0] = id & 0xFF;
+        c[1] = (id >> 8) & 0xFF;
+        c[2] = rate & 0xFF;
+        c[3] = (rate >> 8) & 0xFF;
+
+        return cas_make_msg(ID_CFG_MSG, cfg, sizeof(cfg), buff);
+}
+
+int casic_enable_msg(int fd, int id, int rate)
+{
+        unsigned char buff[CASIC_HEAD_SIZE + 4 + CASIC_CKSUM_SIZE];
+        int len, ret;
+
+        if (fd < 0)
+                return -1;
+        len = casic_make_enable(id, rate, buff);
+        do {
+                ret = write(fd, buff, len);
+        } while (ret < 0 && errno == EINTR);
+
+        return ret;
+}
+
+static int casic_check(const unsigned char *frame, int len)
+{
+        int i;
+        unsigned int ckSum;
+
+        ckSum = (casic_u2(frame + 4) << 16) + len;
+        for (i = 0; i < len / 4; i++)
+        {
+                ckSum += casic_u4(frame + CASIC_HEAD_SIZE + i * 4);
+        }
+
+        return ckSum == casic_u4(frame + CASIC_HEAD_SIZE + len);
+}
+
+void casic_parser_init(CasicParser *p, casic_frame_callback cb, void *arg)
+{
+        memset(p, 0, sizeof(*p));
+        p->callback = cb;
+        p->arg = arg;
+}
+
+int casic_parser_busy(CasicParser *p)
+{
+        return p->pos > 0;
+}
+
+/* feed bytes starting at a frame header (or inside a pending frame).
+ * returns the number of bytes consumed. a frame that lies completely in
+ * data is checked and handed to the callback in place, without a copy.
+ */
+int casic_parser_feed(CasicParser *p, const unsigned char *data, int n)
+{
+        int need, take;
+
+        if (p->pos == 0 && n >= CASIC_HEAD_SIZE
+                        && data[0] == BIN_HEADER0 && data[1] == BIN_HEADER1) {
+                int len = casic_u2(data + 2);
+                int total = CASIC_HEAD_SIZE + len + CASIC_CKSUM_SIZE;
+
+                if (len > CASIC_MAX_PAYLOAD)
+                        return 1;
+                if (total <= n) {
+                        if (casic_check(data, len) && p->callback)
+                                p->callback(p->arg, casic_u2(data + 4), data + CASIC_HEAD_SIZE, len);
+                        return total;
+                }
+        }
+
+        take = 0;
+        while (take < n) {
+                unsigned char c = data[take];
+
+                if ((p->pos == 0 && c != BIN_HEADER0) || (p->pos == 1 && c != BIN_HEADER1)) {
+                        p->pos = 0;
+                        return take + 1;
+                }
+                if (p->pos < CASIC_HEAD_SIZE) {
+                        p->buff[p->pos++] = c;
+                        take += 1;
+                        if (p->pos == CASIC_HEAD_SIZE) {
+                                p->len = casic_u2(p->buff + 2);
+                                if (p->len > CASIC_MAX_PAYLOAD) {
+                                        p->pos = 0;
+                                        return take;
+                                }
+                        }
+                        continue;
+                }
+
+                need = CASIC_HEAD_SIZE + p->len + CASIC_CKSUM_SIZE - p->pos;
+                if (need > n - take)
+                        need = n - take;
+                memcpy(p->buff + p->pos, data + take, need);
+                p->pos += need;
+                take += need;
+
+                if (p->pos == CASIC_HEAD_SIZE + p->len + CASIC_CKSUM_SIZE) {
+                        if (casic_check(p->buff, p->len) && p->callback)
+                                p->callback(p->arg, casic_u2(p->buff + 4), p->buff + CASIC_HEAD_SIZE, p->len);
+                        p->pos = 0;
+                        break;
+                }
+        }
+
+        return take;
+}
@@ -0,0 +1,82 @@
+#ifndef CASIC_H
+#define CASIC_H
+
+#define BIN_HEADER0						0xBA
+#define BIN_HEADER1						0xCE
+
+// message id: (message id << 8) | class id
+#define ID_ACK_NAK						0x0005
+#define ID_ACK_ACK						0x0105
+#define ID_CFG_MSG						0x0106
+#define ID_RXM_MEASX					0x1002
+#define ID_RXM_SFRBX					0x1202
+#define ID_AID_INI						0x010B
+
+#define CASIC_HEAD_SIZE					6
+#define CASIC_CKSUM_SIZE				4
+#define CASIC_MAX_PAYLOAD				2048
+
+// RXM-MEASX: 16 bytes header, then 32 bytes per measurement
+#define MEASX_HEAD_SIZE					16
+#define MEASX_MEAS_SIZE					32
+
+#define MEASX_TRK_PR_VALID				0x01
+#define MEASX_TRK_CP_VALID				0x02
+#define MEASX_TRK_HALFCYC				0x04
+
+// RXM-SFRBX: 8 bytes header, then 30 bit words in U4
+#define SFRBX_HEAD_SIZE					8
+#define SFRBX_MAX_WORDS					10
+
+#define CASIC_GNSS_GPS					0
+#define CASIC_GNSS_BDS					1
+#define CASIC_GNSS_GLN					2
+
+// AID-INI flags
+#define AID_INI_POS_VALID				0x01
+#define AID_INI_TIME_VALID				0x02
+#define AID_INI_POS_LLA					0x20
+
+// initial position, time and frequency
+typedef struct
+{
+        double						xOrLat;
+        double						yOrLon;
+        double						zOrAlt;
+        double						tow;			// s
+        float						df;
+        float						posAcc;			// m
+        float						tAcc;			// s
+        float						fAcc;
+        unsigned int				res;
+        unsigned short int			wn;
+        unsigned char				timeSource;
+        unsigned char				flags;
+} AID_INI_STR;
+
+typedef void (*casic_frame_callback)(void *arg, int id, const unsigned char *payload, int len);
+
+typedef struct {
+        int							pos;
+        int							len;
+        casic_frame_callback		callback;
+        void						*arg;
+        unsigned char				buff[CASIC_HEAD_SIZE + CASIC_MAX_PAYLOAD + CASIC_CKSUM_SIZE];
+} CasicParser;
+
+void casic_parser_init(CasicParser *p, casic_frame_callback cb, void *arg);
+int casic_parser_busy(CasicParser *p);
+int casic_parser_feed(CasicParser *p, const unsigned char *data, int n);
+
+unsigned int cas_make_msg(int id, int *msg, int n, unsigned char *buff);
+int casic_send_msg(int fd, int id, const void *msg, int n);
+int casic_enable_msg(int fd, int id, int rate);
+int casic_send_cmd(int fd, const char *body);
+unsigned int casic_make_enable(int id, int rate, unsigned char *buff);
+int casic_make_cmd(const char *body, char *buff, int size);
+
+unsigned short casic_u2(const unsigned char *p);
+unsigned int casic_u4(const unsigned char *p);
+float casic_r4(const unsigned char *p);
+double casic_r8(const unsigned char *p);
+#endif
@@ -0,0 +1,29 @@
+#include <pthread.h>
+#include "crc32.h"
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void
+crc_init() {
+        uint32_t c;
+        int i, k;
+
+        for (i = 0; i < 256; i++) {
+                c = i;
+                for (k = 0; k < 8; k++)
+                        c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                crc_table[i] = c;
+        }
+}
+
+uint32_t
+crc32_buf(const void *p, int n) {
+        const unsigned char *b = p;
+        uint32_t c = 0xFFFFFFFF;
+
+        pthread_once(&crc_once, crc_init);
+        while (n-- > 0)
+                c = crc_table[(c ^ *b++) & 0xFF] ^ (c >> 8);
+        return c ^ 0xFFFFFFFF;
+}
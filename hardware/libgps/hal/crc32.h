@@ -0,0 +1,7 @@
+#ifndef CRC32_H
+#define CRC32_H
+#include <stdint.h>
+
+/* ieee 802.3 crc, the one zlib and the track blocks use */
+uint32_t crc32_buf(const void *p, int n);
+#endif
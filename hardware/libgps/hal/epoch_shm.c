@@ -0,0 +1,85 @@
+/*
+ * publish the latest epoch into a shared file mapping.
+ *
+ * local readers map the same file and copy a consistent snapshot with
+ * epoch_shm_read(), no syscall and no lock, so the reader thread pays
+ * the same two stores and a memcpy however many readers there are.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "epoch_shm.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static EpochShm *epoch_shm = NULL;
+
+int
+epoch_shm_open(const char *path) {
+        int fd;
+        void *p;
+
+        if (epoch_shm != NULL)
+                return 0;
+
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+                D("Can not open epoch shm %s, errno = %d", path, errno);
+                return -1;
+        }
+        if (ftruncate(fd, sizeof(EpochShm)) < 0) {
+                D("Can not size epoch shm, errno = %d", errno);
+                close(fd);
+                return -1;
+        }
+        p = mmap(NULL, sizeof(EpochShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+                D("Can not map epoch shm, errno = %d", errno);
+                return -1;
+        }
+
+        epoch_shm = (EpochShm *)p;
+        memset(epoch_shm, 0, sizeof(EpochShm));
+        epoch_shm->magic = EPOCH_SHM_MAGIC;
+        epoch_shm->version = EPOCH_SHM_VERSION;
+        D("epoch shm mapped at %s", path);
+        return 0;
+}
+
+void
+epoch_shm_close() {
+        if (epoch_shm == NULL)
+                return;
+        munmap(epoch_shm, sizeof(EpochShm));
+        epoch_shm = NULL;
+}
+
+void
+epoch_shm_publish(const GpsLocation *fix, const GpsSvStatus *sv_status) {
+        uint32_t seq;
+
+        if (epoch_shm == NULL)
+                return;
+
+        seq = epoch_shm->seq;
+        __atomic_store_n(&epoch_shm->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        epoch_shm->fix = *fix;
+        epoch_shm->sv_status = *sv_status;
+        epoch_shm->generation += 1;
+
+        __atomic_store_n(&epoch_shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
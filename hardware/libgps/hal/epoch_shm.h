@@ -0,0 +1,46 @@
+#ifndef EPOCH_SHM_H
+#define EPOCH_SHM_H
+#include <stdint.h>
+#include <string.h>
+#include <hardware/gps.h>
+
+#define EPOCH_SHM_MAGIC         0x45504f43      // "EPOC"
+#define EPOCH_SHM_VERSION       1
+
+/* one completed epoch, published under a seqlock.
+ * seq is odd while the writer is inside; generation counts epochs so
+ * readers can poll it without taking a snapshot. sv azimuths carry the
+ * +720 used-in-fix mark, same as the framework sees them.
+ */
+typedef struct {
+        uint32_t                magic;
+        uint32_t                version;
+        uint32_t                seq;
+        uint32_t                generation;
+        GpsLocation             fix;
+        GpsSvStatus             sv_status;
+} EpochShm;
+
+int epoch_shm_open(const char *path);
+void epoch_shm_close();
+void epoch_shm_publish(const GpsLocation *fix, const GpsSvStatus *sv_status);
+
+/* reader side: map the file read only and call this. returns the
+ * generation of the copied snapshot, 0 if nothing was published yet.
+ */
+static inline uint32_t
+epoch_shm_read(const EpochShm *shm, EpochShm *out) {
+        uint32_t s1, s2;
+
+        do {
+                s1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+                if (s1 & 1)
+                        continue;
+                memcpy(out, shm, sizeof(*out));
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                s2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+        } while ((s1 & 1) || s1 != s2);
+
+        return out->generation;
+}
+#endif
@@ -0,0 +1,386 @@
+/*
+ * HAL side geofencing.
+ *
+ * fences are kept in a uniform lat/lon grid: every fence is linked into the
+ * hash buckets of the cells its bounding box covers, so a fix only looks at
+ * the fences of its own cell, the few fences too big for the grid, and the
+ * fences it is currently inside of (to notice exits). only transitions are
+ * reported to the framework.
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "geofence.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define EARTH_RADIUS    6378137.0
+#define DEG2RAD(x)      ((x) * M_PI / 180.0)
+
+struct geofence_s;
+
+struct geofence_cell_s {
+        int                     cell_lat;
+        int                     cell_lon;
+        struct geofence_s       *fence;
+        struct geofence_cell_s  *next;
+};
+
+struct geofence_s {
+        int                     used;
+        int32_t                 id;
+        double                  lat, lon;
+        double                  radius;
+        int                     monitor;        // transitions to report
+        int                     state;          // last reported transition
+        int                     paused;
+        unsigned int            stamp;          // last evaluated in this round
+        int                     ncells;
+        struct geofence_cell_s  *cells;         // NULL: in the big list
+        struct geofence_s       *next_big;
+        struct geofence_s       *next_watch;
+};
+
+static struct {
+        GpsGeofenceCallbacks    callbacks;
+        pthread_mutex_t         lock;
+        int                     available;
+        unsigned int            stamp;
+        GpsUtcTime              last_time;      // of the last fix checked
+        double                  last_lat;
+        double                  last_lon;
+        struct geofence_s       fences[GEOFENCE_MAX];
+        struct geofence_cell_s  *buckets[GEOFENCE_HASH_SIZE];
+        struct geofence_s       *big;
+        struct geofence_s       *watch;
+} gf = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int
+cell_of(double deg) {
+        return (int)floor(deg / GEOFENCE_GRID_DEG);
+}
+
+static unsigned int
+cell_hash(int cell_lat, int cell_lon) {
+        return ((unsigned int)cell_lat * 73856093u ^ (unsigned int)cell_lon * 19349663u) & (GEOFENCE_HASH_SIZE - 1);
+}
+
+static double
+geofence_distance(double lat1, double lon1, double lat2, double lon2) {
+        // equirectangular, plenty for fences up to tens of km
+        double x = DEG2RAD(lon2 - lon1) * cos(DEG2RAD((lat1 + lat2) / 2));
+        double y = DEG2RAD(lat2 - lat1);
+        return sqrt(x * x + y * y) * EARTH_RADIUS;
+}
+
+static struct geofence_s *
+geofence_find(int32_t id) {
+        int i;
+        for (i = 0; i < GEOFENCE_MAX; i++) {
+                if (gf.fences[i].used && gf.fences[i].id == id)
+                        return &gf.fences[i];
+        }
+        return NULL;
+}
+
+static void
+geofence_index(struct geofence_s *f) {
+        double dlat = f->radius / EARTH_RADIUS * 180.0 / M_PI;
+        double clat = cos(DEG2RAD(f->lat));
+        double dlon = clat > 1e-6 ? dlat / clat : 360.0;
+        int lat0 = cell_of(f->lat - dlat), lat1 = cell_of(f->lat + dlat);
+        int lon0 = cell_of(f->lon - dlon), lon1 = cell_of(f->lon + dlon);
+        int i, j, n;
+
+        f->ncells = (lat1 - lat0 + 1) * (lon1 - lon0 + 1);
+        if (f->ncells > GEOFENCE_MAX_CELLS)
+                f->cells = NULL;
+        else
+                f->cells = calloc(f->ncells, sizeof(struct geofence_cell_s));
+
+        if (f->cells == NULL) {
+                f->ncells = 0;
+                f->next_big = gf.big;
+                gf.big = f;
+                return;
+        }
+
+        n = 0;
+        for (i = lat0; i <= lat1; i++) {
+                for (j = lon0; j <= lon1; j++) {
+                        struct geofence_cell_s *c = &f->cells[n++];
+                        unsigned int h = cell_hash(i, j);
+                        c->cell_lat = i;
+                        c->cell_lon = j;
+                        c->fence = f;
+                        c->next = gf.buckets[h];
+                        gf.buckets[h] = c;
+                }
+        }
+}
+
+static void
+geofence_unindex(struct geofence_s *f) {
+        struct geofence_s **pf;
+        int n;
+
+        for (n = 0; n < f->ncells; n++) {
+                struct geofence_cell_s *c = &f->cells[n];
+                struct geofence_cell_s **pc = &gf.buckets[cell_hash(c->cell_lat, c->cell_lon)];
+                while (*pc && *pc != c)
+                        pc = &(*pc)->next;
+                if (*pc)
+                        *pc = c->next;
+        }
+        free(f->cells);
+        f->cells = NULL;
+        f->ncells = 0;
+
+        for (pf = &gf.big; *pf; pf = &(*pf)->next_big) {
+                if (*pf == f) {
+                        *pf = f->next_big;
+                        break;
+                }
+        }
+        for (pf = &gf.watch; *pf; pf = &(*pf)->next_watch) {
+                if (*pf == f) {
+                        *pf = f->next_watch;
+                        break;
+                }
+        }
+}
+
+void
+geofence_init(GpsGeofenceCallbacks *callbacks) {
+        pthread_mutex_lock(&gf.lock);
+        gf.callbacks = *callbacks;
+        pthread_mutex_unlock(&gf.lock);
+        D("geofence initialized");
+}
+
+void
+geofence_add_area(int32_t geofence_id, double latitude, double longitude, double radius_meters,
+                  int last_transition, int monitor_transitions,
+                  int notification_responsiveness_ms, int unknown_timer_ms) {
+        struct geofence_s *f = NULL;
+        int status = GPS_GEOFENCE_OPERATION_SUCCESS;
+        int i;
+
+        // every fix is checked, whatever the framework asks for
+        (void)notification_responsiveness_ms;
+        (void)unknown_timer_ms;
+
+        pthread_mutex_lock(&gf.lock);
+        if (geofence_find(geofence_id) != NULL) {
+                status = GPS_GEOFENCE_ERROR_ID_EXISTS;
+        }
+        else if (monitor_transitions & ~(GPS_GEOFENCE_ENTERED | GPS_GEOFENCE_EXITED | GPS_GEOFENCE_UNCERTAIN)) {
+                status = GPS_GEOFENCE_ERROR_INVALID_TRANSITION;
+        }
+        else {
+                for (i = 0; i < GEOFENCE_MAX; i++) {
+                        if (!gf.fences[i].used) {
+                                f = &gf.fences[i];
+                                break;
+                        }
+                }
+                if (f == NULL)
+                        status = GPS_GEOFENCE_ERROR_TOO_MANY_GEOFENCES;
+        }
+
+        if (f != NULL) {
+                memset(f, 0, sizeof(*f));
+                f->used = 1;
+                f->id = geofence_id;
+                f->lat = latitude;
+                f->lon = longitude;
+                f->radius = radius_meters;
+                f->monitor = monitor_transitions;
+                f->state = last_transition;
+                geofence_index(f);
+                // anything but a known outside must be checked on the next fix
+                if (f->state != GPS_GEOFENCE_EXITED) {
+                        f->next_watch = gf.watch;
+                        gf.watch = f;
+                }
+                D("add geofence %d: %f, %f, r = %.0f, cells = %d", geofence_id,
+                  latitude, longitude, radius_meters, f->ncells);
+        }
+        pthread_mutex_unlock(&gf.lock);
+
+        if (gf.callbacks.geofence_add_callback)
+                gf.callbacks.geofence_add_callback(geofence_id, status);
+}
+
+void
+geofence_pause(int32_t geofence_id) {
+        struct geofence_s *f;
+        int status = GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+
+        pthread_mutex_lock(&gf.lock);
+        f = geofence_find(geofence_id);
+        if (f != NULL) {
+                f->paused = 1;
+                status = GPS_GEOFENCE_OPERATION_SUCCESS;
+        }
+        pthread_mutex_unlock(&gf.lock);
+
+        if (gf.callbacks.geofence_pause_callback)
+                gf.callbacks.geofence_pause_callback(geofence_id, status);
+}
+
+void
+geofence_resume(int32_t geofence_id, int monitor_transitions) {
+        struct geofence_s *f;
+        int status = GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+
+        pthread_mutex_lock(&gf.lock);
+        f = geofence_find(geofence_id);
+        if (f != NULL) {
+                f->paused = 0;
+                f->monitor = monitor_transitions;
+                status = GPS_GEOFENCE_OPERATION_SUCCESS;
+        }
+        pthread_mutex_unlock(&gf.lock);
+
+        if (gf.callbacks.geofence_resume_callback)
+                gf.callbacks.geofence_resume_callback(geofence_id, status);
+}
+
+void
+geofence_remove_area(int32_t geofence_id) {
+        struct geofence_s *f;
+        int status = GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+
+        pthread_mutex_lock(&gf.lock);
+        f = geofence_find(geofence_id);
+        if (f != NULL) {
+                geofence_unindex(f);
+                f->used = 0;
+                status = GPS_GEOFENCE_OPERATION_SUCCESS;
+        }
+        pthread_mutex_unlock(&gf.lock);
+
+        if (gf.callbacks.geofence_remove_callback)
+                gf.callbacks.geofence_remove_callback(geofence_id, status);
+}
+
+#define GEOFENCE_MAX_EVENTS     32
+
+struct geofence_event_s {
+        int32_t id;
+        int32_t transition;
+};
+
+/* check one candidate, queue an event if it crossed its boundary */
+static void
+geofence_check(struct geofence_s *f, const GpsLocation *loc, struct geofence_s **watch,
+               struct geofence_event_s *events, int *nevents) {
+        int inside;
+        int transition;
+
+        if (f->stamp == gf.stamp)
+                return;
+        f->stamp = gf.stamp;
+
+        if (f->paused) {
+                if (f->state != GPS_GEOFENCE_EXITED) {
+                        f->next_watch = *watch;
+                        *watch = f;
+                }
+                return;
+        }
+
+        inside = geofence_distance(f->lat, f->lon, loc->latitude, loc->longitude) <= f->radius;
+        transition = inside ? GPS_GEOFENCE_ENTERED : GPS_GEOFENCE_EXITED;
+        if (inside) {
+                f->next_watch = *watch;
+                *watch = f;
+        }
+        if (transition == f->state)
+                return;
+        if (f->monitor & transition) {
+                if (*nevents >= GEOFENCE_MAX_EVENTS) {
+                        // no room for the event, the transition is seen again next fix
+                        if (!inside) {
+                                f->next_watch = *watch;
+                                *watch = f;
+                        }
+                        return;
+                }
+                events[*nevents].id = f->id;
+                events[*nevents].transition = transition;
+                *nevents += 1;
+        }
+        f->state = transition;
+}
+
+void
+geofence_update(const GpsLocation *loc) {
+        struct geofence_event_s events[GEOFENCE_MAX_EVENTS];
+        struct geofence_s *watch = NULL;
+        struct geofence_s *f, *next;
+        struct geofence_cell_s *c;
+        int cell_lat, cell_lon;
+        int nevents = 0;
+        int report_available = 0;
+        int i;
+
+        if (!(loc->flags & GPS_LOCATION_HAS_LAT_LONG))
+                return;
+
+        pthread_mutex_lock(&gf.lock);
+        // gga and rmc of one epoch carry the same fix, same time and same place
+        if (loc->timestamp == gf.last_time && loc->latitude == gf.last_lat && loc->longitude == gf.last_lon) {
+                pthread_mutex_unlock(&gf.lock);
+                return;
+        }
+        gf.last_time = loc->timestamp;
+        gf.last_lat = loc->latitude;
+        gf.last_lon = loc->longitude;
+        if (!gf.available) {
+                gf.available = 1;
+                report_available = 1;
+        }
+
+        gf.stamp += 1;
+        // the old watch list goes first, checking relinks next_watch
+        for (f = gf.watch; f; f = next) {
+                next = f->next_watch;
+                geofence_check(f, loc, &watch, events, &nevents);
+        }
+        cell_lat = cell_of(loc->latitude);
+        cell_lon = cell_of(loc->longitude);
+        for (c = gf.buckets[cell_hash(cell_lat, cell_lon)]; c; c = c->next) {
+                if (c->cell_lat == cell_lat && c->cell_lon == cell_lon)
+                        geofence_check(c->fence, loc, &watch, events, &nevents);
+        }
+        for (f = gf.big; f; f = f->next_big)
+                geofence_check(f, loc, &watch, events, &nevents);
+        gf.watch = watch;
+        pthread_mutex_unlock(&gf.lock);
+
+        if (report_available && gf.callbacks.geofence_status_callback)
+                gf.callbacks.geofence_status_callback(GPS_GEOFENCE_AVAILABLE, (GpsLocation *)loc);
+
+        if (gf.callbacks.geofence_transition_callback == NULL)
+                return;
+        for (i = 0; i < nevents; i++) {
+                D("geofence %d transition %d", events[i].id, events[i].transition);
+                gf.callbacks.geofence_transition_callback(events[i].id, (GpsLocation *)loc,
+                                events[i].transition, loc->timestamp);
+        }
+}
@@ -0,0 +1,18 @@
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+#include <hardware/gps.h>
+
+#define GEOFENCE_MAX            512
+#define GEOFENCE_HASH_SIZE      1024            // buckets, power of 2
+#define GEOFENCE_GRID_DEG       0.01            // cell size, about 1.1 km of latitude
+#define GEOFENCE_MAX_CELLS      64              // bigger fences are checked on every fix
+
+void geofence_init(GpsGeofenceCallbacks *callbacks);
+void geofence_add_area(int32_t geofence_id, double latitude, double longitude, double radius_meters,
+                       int last_transition, int monitor_transitions,
+                       int notification_responsiveness_ms, int unknown_timer_ms);
+void geofence_pause(int32_t geofence_id);
+void geofence_resume(int32_t geofence_id, int monitor_transitions);
+void geofence_remove_area(int32_t geofence_id);
+void geofence_update(const GpsLocation *loc);
+#endif
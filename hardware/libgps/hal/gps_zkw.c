@@ -40,9 +40,24 @@
 #include <hardware/gps.h>
 #include <cutils/properties.h>
 
+#include "aidq.h"
+#include "casic.h"
+#include "epoch_shm.h"
+#include "geofence.h"
+#include "lastfix.h"
+#include "measurement.h"
+#include "motion.h"
+#include "navmsg.h"
+#include "power.h"
+#include "rawfan.h"
+#include "track.h"
 #if SUPL_ENABLED
 #include "supl.h"
 #include "casaid.h"
+#include "subframe.h"
+#include "aidcache.h"
+#include "orbit.h"
+#include "rxaid.h"
 #endif
 /* the name of the qemud-controlled socket */
 
@@ -81,7 +96,9 @@ typedef enum {
 enum {
         CMD_QUIT  = 0,
         CMD_START = 1,
-        CMD_STOP  = 2
+        CMD_STOP  = 2,
+        CMD_AID_INI = 3,        // injected time or position to the receiver
+        CMD_RESTART = 4         // + the PCAS10 restart, 0 to 2
 };
 
 
@@ -108,8 +125,24 @@ static GpsState  _gps_state[1];
 
 static char tty_name[16] = "/dev/ttyGNSS";
 static int tty_baud = B9600;
+static int tty_bps = 9600;
+static int fix_extrapolate = 0;
+static char epoch_shm_path[64] = "";
+static char raw_stream_path[64] = "";
+static char track_path[64] = "";
+static int track_blocks = TRACK_BLOCKS;
+static char lastfix_path[64] = "";
+static int lastfix_interval = LASTFIX_INTERVAL;
+static int duty_cycle = 0;
+static int duty_wake_period = MOTION_WAKE_PERIOD / 1000;
+static int power_hold = POWER_HOLD;
 static char supl_host[64] = "supl.qxwz.com";
 static char supl_port[16] = "7275";
+static char supl_tls_cache[64] = "";
+static int supl_connect_timeout = 0;
+static int supl_bds = 1;
+static int supl_glonass = 0;
+static char aid_cache_path[64] = "";
 
 static void
 remove_comments(char *s) {
@@ -190,8 +223,10 @@ load_conf() {
                                 } else if (strcmp(key, "TTY_BAUD") == 0) {
                                         int temp = 0;
                                         sscanf(value, "%d", &temp);
-                                        temp = int2baud(temp);
-                                        if (temp) tty_baud = temp;
+                                        if (int2baud(temp)) {
+                                                tty_baud = int2baud(temp);
+                                                tty_bps = temp;
+                                        }
                                         D("Load tty baud: %d\n", tty_baud);
                                 } else if (strcmp(key, "SUPL_HOST") == 0) {
                                         memset(supl_host, 0, sizeof(supl_host));
@@ -201,6 +236,57 @@ load_conf() {
                                         memset(supl_port, 0, sizeof(supl_port));
                                         strncpy(supl_port, value, sizeof(supl_port) - 1);
                                         D("Load supl port: %s\n", supl_port);
+                                } else if (strcmp(key, "SUPL_TLS_CACHE") == 0) {
+                                        memset(supl_tls_cache, 0, sizeof(supl_tls_cache));
+                                        strncpy(supl_tls_cache, value, sizeof(supl_tls_cache) - 1);
+                                        D("Load supl tls cache: %s\n", supl_tls_cache);
+                                } else if (strcmp(key, "SUPL_CONNECT_TIMEOUT") == 0) {
+                                        sscanf(value, "%d", &supl_connect_timeout);
+                                        D("Load supl connect timeout: %d\n", supl_connect_timeout);
+                                } else if (strcmp(key, "SUPL_BDS") == 0) {
+                                        sscanf(value, "%d", &supl_bds);
+                                        D("Load supl bds: %d\n", supl_bds);
+                                } else if (strcmp(key, "SUPL_GLONASS") == 0) {
+                                        sscanf(value, "%d", &supl_glonass);
+                                        D("Load supl glonass: %d\n", supl_glonass);
+                                } else if (strcmp(key, "AID_CACHE") == 0) {
+                                        memset(aid_cache_path, 0, sizeof(aid_cache_path));
+                                        strncpy(aid_cache_path, value, sizeof(aid_cache_path) - 1);
+                                        D("Load aid cache: %s\n", aid_cache_path);
+                                } else if (strcmp(key, "FIX_EXTRAPOLATE") == 0) {
+                                        sscanf(value, "%d", &fix_extrapolate);
+                                        D("Load fix extrapolate: %d\n", fix_extrapolate);
+                                } else if (strcmp(key, "EPOCH_SHM") == 0) {
+                                        memset(epoch_shm_path, 0, sizeof(epoch_shm_path));
+                                        strncpy(epoch_shm_path, value, sizeof(epoch_shm_path) - 1);
+                                        D("Load epoch shm: %s\n", epoch_shm_path);
+                                } else if (strcmp(key, "RAW_STREAM") == 0) {
+                                        memset(raw_stream_path, 0, sizeof(raw_stream_path));
+                                        strncpy(raw_stream_path, value, sizeof(raw_stream_path) - 1);
+                                        D("Load raw stream: %s\n", raw_stream_path);
+                                } else if (strcmp(key, "TRACK_FILE") == 0) {
+                                        memset(track_path, 0, sizeof(track_path));
+                                        strncpy(track_path, value, sizeof(track_path) - 1);
+                                        D("Load track file: %s\n", track_path);
+                                } else if (strcmp(key, "TRACK_BLOCKS") == 0) {
+                                        sscanf(value, "%d", &track_blocks);
+                                        D("Load track blocks: %d\n", track_blocks);
+                                } else if (strcmp(key, "LAST_FIX") == 0) {
+                                        memset(lastfix_path, 0, sizeof(lastfix_path));
+                                        strncpy(lastfix_path, value, sizeof(lastfix_path) - 1);
+                                        D("Load last fix file: %s\n", lastfix_path);
+                                } else if (strcmp(key, "LAST_FIX_INTERVAL") == 0) {
+                                        sscanf(value, "%d", &lastfix_interval);
+                                        D("Load last fix interval: %d\n", lastfix_interval);
+                                } else if (strcmp(key, "DUTY_CYCLE") == 0) {
+                                        sscanf(value, "%d", &duty_cycle);
+                                        D("Load duty cycle: %d\n", duty_cycle);
+                                } else if (strcmp(key, "DUTY_WAKE_PERIOD") == 0) {
+                                        sscanf(value, "%d", &duty_wake_period);
+                                        D("Load duty wake period: %d\n", duty_wake_period);
+                                } else if (strcmp(key, "POWER_HOLD") == 0) {
+                                        sscanf(value, "%d", &power_hold);
+                                        D("Load power hold: %d\n", power_hold);
                                 }
                         }
                 }
@@ -404,6 +490,127 @@ static const AGpsRilInterface zkwAGpsRilInterface = {
 
 #endif
 
+static long long
+get_monotonic_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* the clock of timeReference in inject_time, elapsedRealtime */
+static long long
+get_elapsed_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long
+get_realtime_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#define  GPS_EPOCH_UNIX_MS       315964800000LL  // 1980-01-06
+#define  GPS_LEAP_SECONDS        18
+
+#if SUPL_ENABLED
+/* gps seconds by the system clock, 0 while it is not set */
+static long long
+get_gps_s() {
+        long long ms = get_realtime_ms();
+
+        if (ms <= GPS_EPOCH_UNIX_MS)
+                return 0;
+        return (ms - GPS_EPOCH_UNIX_MS) / 1000 + GPS_LEAP_SECONDS;
+}
+#endif
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       A I D   P O S I T I O N                         *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+#define  AID_POS_SPEED           30.0            // m/s the device may have moved in the first hour
+#define  AID_POS_DRIFT           3.0             // m/s on average after that
+#define  AID_POS_MAX             500000.0        // m, a worse position is not sent
+
+enum {
+        AID_POS_NONE = 0,
+        AID_POS_LASTFIX,
+        AID_POS_INJECTED,
+        AID_POS_SUPL,
+};
+
+typedef struct {
+        double          lat;
+        double          lon;
+        double          alt;
+        double          acc;                    // m at ref_ms, 0 for none
+        long long       ref_ms;                 // elapsed realtime
+} AidPos;
+
+static AidPos aid_injected_pos;
+static AidPos aid_supl_pos;
+/* the framework injects time and position from its own thread */
+static pthread_mutex_t aid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* what the uncertainty of a position has grown to after age ms */
+static double
+aid_pos_acc(double acc, long long age) {
+        double t = age > 0 ? age / 1000.0 : 0;
+
+        if (t <= 3600)
+                return acc + t * AID_POS_SPEED;
+        return acc + 3600 * AID_POS_SPEED + (t - 3600) * AID_POS_DRIFT;
+}
+
+static int
+aid_pos_better(AidPos *best, const AidPos *c, double acc, long long now) {
+        if (c->acc <= 0 || (best->acc > 0 && acc >= best->acc))
+                return 0;
+        *best = *c;
+        best->acc = acc;
+        best->ref_ms = now;
+        return 1;
+}
+
+/* the best of the stored fix, the injected and the supl reference location
+ * with the uncertainty it has by now, returns its source */
+static int
+aid_pos_best(AidPos *best) {
+        long long now = get_elapsed_ms();
+        int source = AID_POS_NONE;
+        LastFix fix;
+        AidPos c, injected;
+
+        pthread_mutex_lock(&aid_lock);
+        injected = aid_injected_pos;
+        pthread_mutex_unlock(&aid_lock);
+        memset(best, 0, sizeof(*best));
+        // a fix from the future means the clock was set back, its age is unknown
+        if (lastfix_get(&fix) == 0 && get_realtime_ms() >= fix.time) {
+                c.lat = fix.latitude;
+                c.lon = fix.longitude;
+                c.alt = fix.altitude;
+                c.acc = fix.accuracy;
+                if (aid_pos_better(best, &c, aid_pos_acc(fix.accuracy, get_realtime_ms() - fix.time), now))
+                        source = AID_POS_LASTFIX;
+        }
+        if (aid_pos_better(best, &injected, aid_pos_acc(injected.acc, now - injected.ref_ms), now))
+                source = AID_POS_INJECTED;
+        if (aid_pos_better(best, &aid_supl_pos, aid_pos_acc(aid_supl_pos.acc, now - aid_supl_pos.ref_ms), now))
+                source = AID_POS_SUPL;
+
+        if (best->acc > AID_POS_MAX)
+                return AID_POS_NONE;
+        return source;
+}
+
 #if SUPL_ENABLED
 /*****************************************************************/
 /*****************************************************************/
@@ -413,7 +620,7 @@ static const AGpsRilInterface zkwAGpsRilInterface = {
 /*****************************************************************/
 /*****************************************************************/
 
-static time_t last_supl_time = 0;
+static long long last_supl_time = 0;        // monotonic ms the last session ended, 0 for none
 static time_t
 utc_time(int week, long tow) {
         time_t t;
@@ -547,35 +754,222 @@ supl_consume_1(supl_assist_t *ctx) {
         return 1;
 }
 
+#define AID_BUFF_SIZE           16384           // one segment: the ephemerides of every constellation, models
+
+static int supl_eph_sent;                      // ephemerides of the session at the receiver
+static int supl_eph_budget;
+static int supl_bds_sent;
+static int supl_bds_budget;                    // BDS gets a budget of its own
+static int supl_glo_sent;
+static int supl_glo_budget;
+static int supl_segments;
+
+/*
+ * ephemerides in the order the receiver can use them: highest first from the
+ * best aid position at time of week tow (s, < 0 unknown), none below the mask,
+ * none it already holds (see rxaid.c) and no more than budget bytes of uart
+ * time. without a position or a time
+ * they go in as they are, still within the budget.
+ */
+#define AID_EPH_ELEV_MASK       5.0             // deg
+#define AID_EPH_UART_MS         2000            // uart time the ephemerides of one start may take
+
 static int
-supl2cas_aid(supl_assist_t *ctx, unsigned char *buff) {
-        D("SUPL 2 Casic Aid.");
+aid_eph_budget() {
+        return tty_bps / 10 * AID_EPH_UART_MS / 1000;
+}
+
+static int
+aid_eph_pack(struct supl_ephemeris_s *eph, const int *week, int n, double tow,
+             unsigned char *buff, int *budget) {
         GPS_FIX_EPHEMERIS_STR uTempGpsEph;
+        double el[MAX_EPHEMERIS], az[MAX_EPHEMERIS];
+        int order[MAX_EPHEMERIS];
+        int size = sizeof(GPS_FIX_EPHEMERIS_STR) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE;
+        int i, j, k, cnt = 0, length = 0;
+        AidPos pos;
+
+        if (n > MAX_EPHEMERIS)
+                n = MAX_EPHEMERIS;
+        for (i = 0; i < n; i++)
+                order[i] = i;
+        if (tow >= 0 && aid_pos_best(&pos) != AID_POS_NONE) {
+                orbit_look(eph, n, tow, pos.lat, pos.lon, pos.alt, el, az);
+                for (i = 1; i < n; i++) {
+                        k = order[i];
+                        for (j = i; j > 0 && el[order[j - 1]] < el[k]; j--)
+                                order[j] = order[j - 1];
+                        order[j] = k;
+                }
+                while (n > 0 && el[order[n - 1]] < AID_EPH_ELEV_MASK)
+                        n--;
+        }
+        for (i = 0; i < n && *budget >= size; i++) {
+                k = order[i];
+                memset(&uTempGpsEph, 0, sizeof(GPS_FIX_EPHEMERIS_STR));
+                supl2cas_eph((unsigned short)week[k], &eph[k], &uTempGpsEph);
+                if (uTempGpsEph.valid != NAVIGATION_MESSAGE_AVAILABLE)
+                        continue;
+                // the receiver has this issue or a newer one
+                if (!rxaid_wanted(&uTempGpsEph))
+                        continue;
+                length += cas_make_msg(ID_RXM_GPS_EPH, (int *)(&uTempGpsEph), sizeof(GPS_FIX_EPHEMERIS_STR), buff + length);
+                rxaid_sent(&uTempGpsEph);
+                *budget -= size;
+                cnt += 1;
+        }
+        D("Pack %d of %d ephemerides, %d bytes left", cnt, n, *budget);
+        return length;
+}
+
+/* BDS ephemerides as they came, the healthy ones within budget bytes */
+static int
+aid_bds_pack(struct supl_bds_ephemeris_s *eph, int n, int week, unsigned char *buff, int *budget) {
+        BD2_FIX_EPHEMERIS_STR uTempBdsEph;
+        int size = sizeof(BD2_FIX_EPHEMERIS_STR) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE;
+        int i, cnt = 0, length = 0;
+
+        for (i = 0; i < n && *budget >= size; i++) {
+                memset(&uTempBdsEph, 0, sizeof(BD2_FIX_EPHEMERIS_STR));
+                supl2cas_bds_eph((unsigned short)week, &eph[i], &uTempBdsEph);
+                if (uTempBdsEph.valid != NAVIGATION_MESSAGE_AVAILABLE)
+                        continue;
+                length += cas_make_msg(ID_RXM_BDS_EPH, (int *)(&uTempBdsEph), sizeof(BD2_FIX_EPHEMERIS_STR), buff + length);
+                *budget -= size;
+                cnt += 1;
+        }
+        D("Pack %d of %d BDS ephemerides, %d bytes left", cnt, n, *budget);
+        return length;
+}
+
+/*
+ * GLONASS ephemerides name their time only as tb of the Moscow day: the day
+ * (nt of the four year interval n4) is the one around the reference time,
+ * and the time model gives the offset to GPS time at it.
+ */
+#define GLO_EPOCH_UNIX          820443600LL     // 1996-01-01 00:00 Moscow
+#define GLO_FOUR_YEARS          1461            // days
+
+static int
+aid_glo_pack(supl_assist_t *ctx, int n, unsigned char *buff, int *budget) {
+        GLN_FIX_EPHEMERIS_STR uTempGloEph;
+        struct supl_glo_ephemeris_s *eph = &ctx->glo.eph[ctx->glo.cnt_eph - n];
+        int size = sizeof(GLN_FIX_EPHEMERIS_STR) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE;
+        double tow = ctx->time.gps_tow * 0.08, dt, tau = 0;
+        long long glo;
+        int i, day, sod, taugps = 0, cnt = 0, length = 0;
+
+        glo = (long long)(ctx->time.gps_week + 2048) * 604800 + (long long)tow +
+              GPS_EPOCH_UNIX_MS / 1000 - GPS_LEAP_SECONDS - GLO_EPOCH_UNIX;
+        day = (int)(glo / 86400);
+        sod = (int)(glo % 86400);
+        if (ctx->set & SUPL_RRLP_ASSIST_GLO_TIME) {
+                dt = tow - ctx->glo.time.ref * 16.0;
+                if (dt > 302400)
+                        dt -= 604800;
+                else if (dt < -302400)
+                        dt += 604800;
+                tau = ctx->glo.time.a0 * pow(2.0, -35) + ctx->glo.time.a1 * pow(2.0, -51) * dt +
+                      ctx->glo.time.a2 * pow(2.0, -68) * dt * dt;
+                taugps = (int)floor(tau * pow(2.0, 30) + 0.5);
+        }
+
+        for (i = 0; i < n && *budget >= size; i++) {
+                int d = day;
+
+                // tb half a day off the reference is on the day next to it
+                if (eph[i].tb * 900 - sod > 43200)
+                        d -= 1;
+                else if (sod - eph[i].tb * 900 > 43200)
+                        d += 1;
+                memset(&uTempGloEph, 0, sizeof(GLN_FIX_EPHEMERIS_STR));
+                supl2cas_glo_eph((unsigned short)(d % GLO_FOUR_YEARS + 1), (unsigned char)(d / GLO_FOUR_YEARS + 1),
+                                 taugps, &eph[i], &uTempGloEph);
+                if (uTempGloEph.valid != NAVIGATION_MESSAGE_AVAILABLE)
+                        continue;
+                length += cas_make_msg(ID_RXM_GLN_EPH, (int *)(&uTempGloEph), sizeof(GLN_FIX_EPHEMERIS_STR), buff + length);
+                *budget -= size;
+                cnt += 1;
+        }
+        D("Pack %d of %d GLONASS ephemerides, tau gps %g s, %d bytes left", cnt, n, tau, *budget);
+        return length;
+}
+
+/* what one RRLP segment brought (set), ephemerides once the week is known */
+static int
+supl2cas_aid(supl_assist_t *ctx, int set, unsigned char *buff) {
+        D("SUPL 2 Casic Aid: 0x%x.", set);
+        int week[MAX_EPHEMERIS];
         AID_INI_STR uTempAidIni;
         FIX_UTC_STR uTempUtc;
         FIX_IONO_STR uTempIon;
+        AidPos pos;
 
         int cnt;
         int length = 0;
 
         memset(&uTempAidIni, 0, sizeof(AID_INI_STR));
-        supl2cas_ini(ctx, &uTempAidIni);
+        if (set & (SUPL_RRLP_ASSIST_REFTIME | SUPL_RRLP_ASSIST_REFLOC))
+                supl2cas_ini(ctx, &uTempAidIni);
+        // the time only with the segment it came in
+        if (!(set & SUPL_RRLP_ASSIST_REFTIME))
+                uTempAidIni.flags &= ~AID_INI_TIME_VALID;
+        // it was right on arrival, by the time its last byte is in the
+        // receiver the session and the uart ahead of it have passed
+        if (uTempAidIni.flags & AID_INI_TIME_VALID) {
+                int queued = 0;
+                long long age = get_monotonic_ms() -
+                                ((long long)ctx->time.stamp.tv_sec * 1000 + ctx->time.stamp.tv_usec / 1000);
+
+                if (_gps_state->fd >= 0)
+                        ioctl(_gps_state->fd, TIOCOUTQ, &queued);
+                queued += aidq_ahead();
+                age += (queued + sizeof(uTempAidIni) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE) * 10 * 1000LL / tty_bps;
+                uTempAidIni.tow += age / 1000.0;
+                if (uTempAidIni.tow >= 604800) {
+                        uTempAidIni.tow -= 604800;
+                        uTempAidIni.wn += 1;
+                }
+                D("SUPL reference time aged %lld ms", age);
+        }
+        // the reference location only goes in if nothing better is known
+        if ((set & SUPL_RRLP_ASSIST_REFLOC) && (uTempAidIni.flags & AID_INI_POS_VALID)) {
+                aid_supl_pos.lat = uTempAidIni.xOrLat;
+                aid_supl_pos.lon = uTempAidIni.yOrLon;
+                aid_supl_pos.alt = 0;
+                aid_supl_pos.acc = uTempAidIni.posAcc;
+                aid_supl_pos.ref_ms = get_elapsed_ms();
+        }
+        uTempAidIni.flags &= ~(AID_INI_POS_VALID | AID_INI_POS_LLA);
+        if ((set & (SUPL_RRLP_ASSIST_REFTIME | SUPL_RRLP_ASSIST_REFLOC)) && aid_pos_best(&pos) != AID_POS_NONE) {
+                uTempAidIni.xOrLat = pos.lat;
+                uTempAidIni.yOrLon = pos.lon;
+                uTempAidIni.zOrAlt = pos.alt;
+                uTempAidIni.posAcc = pos.acc;
+                uTempAidIni.flags |= AID_INI_POS_VALID | AID_INI_POS_LLA;
+        }
         if (uTempAidIni.flags) {
                 length += cas_make_msg(ID_AID_INI,     (int *)(&uTempAidIni),   sizeof(uTempAidIni),      buff + length);
                 D("Pack Casic Ini message.");
         }
-        for (cnt = 0; cnt < ctx->cnt_eph; cnt++) {
-                if (ctx->set & SUPL_RRLP_ASSIST_REFTIME) {
-                        memset(&uTempGpsEph, 0, sizeof(GPS_FIX_EPHEMERIS_STR));
-                        supl2cas_eph((unsigned short)ctx->time.gps_week, &ctx->eph[cnt], &uTempGpsEph);
-                        if (uTempGpsEph.valid != NAVIGATION_MESSAGE_AVAILABLE)
-                                continue;
-                        length += cas_make_msg(ID_RXM_GPS_EPH,   (int *)(&uTempGpsEph),  sizeof(GPS_FIX_EPHEMERIS_STR),  buff + length);
-                        D("Pack Casic Eph message %d.", cnt);
-                }
+        if ((ctx->set & SUPL_RRLP_ASSIST_REFTIME) && supl_eph_sent < ctx->cnt_eph) {
+                for (cnt = supl_eph_sent; cnt < ctx->cnt_eph; cnt++)
+                        week[cnt] = ctx->time.gps_week;
+                length += aid_eph_pack(&ctx->eph[supl_eph_sent], &week[supl_eph_sent], ctx->cnt_eph - supl_eph_sent,
+                                       ctx->time.gps_tow * 0.08, buff + length, &supl_eph_budget);
+                supl_eph_sent = ctx->cnt_eph;
+        }
+        if ((ctx->set & SUPL_RRLP_ASSIST_REFTIME) && supl_bds_sent < ctx->bds.cnt_eph) {
+                length += aid_bds_pack(&ctx->bds.eph[supl_bds_sent], ctx->bds.cnt_eph - supl_bds_sent,
+                                       ctx->time.gps_week + 2048 - BDS_WEEK_OFFSET, buff + length, &supl_bds_budget);
+                supl_bds_sent = ctx->bds.cnt_eph;
+        }
+        if ((ctx->set & SUPL_RRLP_ASSIST_REFTIME) && supl_glo_sent < ctx->glo.cnt_eph) {
+                length += aid_glo_pack(ctx, ctx->glo.cnt_eph - supl_glo_sent, buff + length, &supl_glo_budget);
+                supl_glo_sent = ctx->glo.cnt_eph;
         }
 
-        if (ctx->set & SUPL_RRLP_ASSIST_UTC) {
+        if (set & SUPL_RRLP_ASSIST_UTC) {
                 memset(&uTempUtc, 0, sizeof(FIX_UTC_STR));
                 supl2cas_utc(&ctx->utc, &uTempUtc);
                 if (uTempUtc.valid == NAVIGATION_MESSAGE_AVAILABLE) {
@@ -584,7 +978,7 @@ supl2cas_aid(supl_assist_t *ctx, unsigned char *buff) {
                 }
         }
 
-        if (ctx->set & SUPL_RRLP_ASSIST_IONO) {
+        if (set & SUPL_RRLP_ASSIST_IONO) {
                 memset(&uTempIon, 0, sizeof(FIX_IONO_STR));
                 supl2cas_iono(&ctx->iono, &uTempIon);
                 if (uTempIon.valid == NAVIGATION_MESSAGE_AVAILABLE) {
@@ -593,125 +987,409 @@ supl2cas_aid(supl_assist_t *ctx, unsigned char *buff) {
                 }
         }
 
+        // the BDS utc model takes its week from the reference time
+        if ((set & SUPL_RRLP_ASSIST_BDS_UTC) && (ctx->set & SUPL_RRLP_ASSIST_REFTIME)) {
+                memset(&uTempUtc, 0, sizeof(FIX_UTC_STR));
+                supl2cas_bds_utc(ctx->time.gps_week + 2048 - BDS_WEEK_OFFSET, &ctx->bds.utc, &uTempUtc);
+                if (uTempUtc.valid == NAVIGATION_MESSAGE_AVAILABLE) {
+                        length += cas_make_msg(ID_RXM_BDS_UTC,   (int *)(&uTempUtc),    sizeof(FIX_UTC_STR),      buff + length);
+                        D("Pack Casic BDS_UTC message.");
+                }
+        }
+
+        if (set & SUPL_RRLP_ASSIST_BDS_IONO) {
+                memset(&uTempIon, 0, sizeof(FIX_IONO_STR));
+                supl2cas_iono(&ctx->bds.iono, &uTempIon);
+                if (uTempIon.valid == NAVIGATION_MESSAGE_AVAILABLE) {
+                        length += cas_make_msg(ID_RXM_BDS_ION,   (int *)(&uTempIon),    sizeof(FIX_IONO_STR),      buff + length);
+                        D("Pack Casic BDS_ION message.");
+                }
+        }
+
         return length;
 }
 
-static int
-is_supl_needed() {
-        time_t now = time(NULL);
-        if (now - last_supl_time > 3600) {
-                D("Supl needed: %lu vs %lu", now, last_supl_time);
-                return 1;
+/*
+ * a session is due once the cached ephemerides stop covering the sky: fewer
+ * than AID_COVER of the satellites last seen above AID_SKY_ELEV (or than
+ * AID_EPH_NEED, with no recent sky) keep one. it starts AID_PREFETCH ahead
+ * of that while navigating, and right at the start if it is already so.
+ */
+#define AID_COVER               0.75
+#define AID_EPH_NEED            6
+#define AID_SKY_ELEV            10              // deg
+#define AID_SKY_AGE             1800000         // ms a seen sky stays the one to cover
+#define AID_PREFETCH            900             // s
+#define SUPL_MIN_INTERVAL       300000          // ms between sessions
+#define SUPL_SCHED_PERIOD       60000           // ms between looks at the cache while navigating
+
+static uint32_t aid_sky;                        // bit prn - 1
+static long long aid_sky_ms;
+static int supl_active;                         // started, sessions are scheduled
+static long long supl_next_check;
+
+/* the gps satellites above the mask in a reported sky */
+static void
+aid_sky_update(const GpsSvStatus *sv) {
+        uint32_t mask = 0;
+        int i;
+
+        for (i = 0; i < sv->num_svs && i < GPS_MAX_SVS; i++) {
+                const GpsSvInfo *info = &sv->sv_list[i];
+
+                if (info->prn >= 1 && info->prn <= 32 && info->elevation >= AID_SKY_ELEV)
+                        mask |= 1u << (info->prn - 1);
+        }
+        if (mask != 0) {
+                aid_sky = mask;
+                aid_sky_ms = get_monotonic_ms();
         }
-        D("Supl is not timeout");
-        return 0;
 }
 
-static unsigned char is_supl_thread_running = 0;
+/* monotonic ms a session is due at, also the next look at the cache */
+static long long
+supl_due(long long now) {
+        long long gps_s = get_gps_s();
+        long long until, due;
+        uint32_t sky = 0;
+        int need = AID_EPH_NEED, n;
+
+        if (aid_sky != 0 && now - aid_sky_ms < AID_SKY_AGE) {
+                sky = aid_sky;
+                n = __builtin_popcount(sky);
+                need = (int)ceil(n * AID_COVER);
+        }
+        until = aidcache_expiry(sky, need, gps_s);
+        due = now + (until - AID_PREFETCH - gps_s) * 1000;
+        if (last_supl_time != 0 && due < last_supl_time + SUPL_MIN_INTERVAL)
+                due = last_supl_time + SUPL_MIN_INTERVAL;
+        D("Supl due in %lld s, %d of sky 0x%08x needed", (due - now) / 1000, need, sky);
+        return due;
+}
 
-static void
-zkw_supl_thread(void *arg) {
-        D("Start supl thread, arg = 0x%p\n", arg);
+/* the supl session runs in the reader thread, see supl_tick() */
+#define SUPL_CELL_WAIT          2000            // ms for the RIL to answer request_refloc
 
-        unsigned char *buff;
-        int len = 0;
-        int err = 0;
-        supl_assist_t assist;
-        GpsState *s = (GpsState *)arg;
-        int fd = s->fd;
+enum {
+        SUPL_IDLE = 0,
+        SUPL_WAIT_CELL,                         // refloc and setid requested
+        SUPL_SESSION,                           // supl_ctx.fd in the epoll set
+};
 
-        D("Check tty fd");
-        if (fd < 0) {
-                D("Invalid tty fd: %d", fd);
-                goto SuplEnd;
-        }
+static int supl_phase = SUPL_IDLE;
+static long long supl_cell_deadline;
+static supl_assist_t supl_assist;
+static int supl_fd = -1;
 
-        /*
-        #if SUPL_TEST
-          if (fd != -1) {
-            char reboot_cmd[] = "$PCAS10,2*1E\r\n";
-            write(fd, reboot_cmd, strlen(reboot_cmd));
-          }
-        #endif
-        */
+/* when due: ask the RIL for the cell and the set id, the session follows */
+static void
+supl_begin(long long now) {
+        long long due;
+        int held, bytes;
 
-        D("Reset supl_ctx");
-        supl_ctx_new(&supl_ctx);
-        D("Request refloc and setid");
-        agpsRilCallbacks->request_refloc(AGPS_RIL_REQUEST_REFLOC_CELLID);
-        agpsRilCallbacks->request_setid(AGPS_RIL_REQUEST_SETID_MSISDN);
-        // usleep(1000 * 1000);
-
-        D("Check cell info");
-        if (supl_ctx.p.set == 0) {
-                D("No cell info present.");
-#if SUPL_TEST
-                supl_set_lte_cell(&supl_ctx, 460, 0, 22548, 193790209, 0);
-#else
-                goto SuplEnd;
-#endif
+        if (supl_phase != SUPL_IDLE || !supl_active)
+                return;
+        due = supl_due(now);
+        if (due > now) {
+                supl_next_check = due < now + SUPL_SCHED_PERIOD ? due : now + SUPL_SCHED_PERIOD;
+                return;
         }
 
-        D("Check msisdn");
-        if (supl_ctx.p.msisdn[0] == 0) {
-                D("No msisdn present.");
-                supl_set_msisdn(&supl_ctx, "+8613588889999");
-        }
+        D("Reset supl_ctx");
+        supl_ctx_new(&supl_ctx);
+        supl_request(&supl_ctx, (supl_bds ? SUPL_REQUEST_BDS : 0) | (supl_glonass ? SUPL_REQUEST_GLONASS : 0));
+        // only what the cache does not hold comes down
+        aidcache_have(&supl_ctx, get_gps_s());
+        if (agpsRilCallbacks != NULL) {
+                D("Request refloc and setid");
+                agpsRilCallbacks->request_refloc(AGPS_RIL_REQUEST_REFLOC_CELLID);
+                agpsRilCallbacks->request_setid(AGPS_RIL_REQUEST_SETID_MSISDN);
+        }
+        // what the receiver holds comes back while the network is busy
+        rxaid_stats(&held, &bytes, 1);
+        rxaid_poll(_gps_state->fd, now);
+        supl_phase = SUPL_WAIT_CELL;
+        supl_cell_deadline = now + SUPL_CELL_WAIT;
+}
 
-        D("Download assist data");
-        err = supl_get_assist(&supl_ctx, supl_host, supl_port, &assist);
-        supl_close(&supl_ctx);
-        if (err < 0) {
-                D("SUPL protocol error %d\n", err);
-                goto SuplEnd;
-        }
-#if SUPL_TEST
-        supl_consume_1(&assist);
-#endif
+/* each RRLP segment goes to the receiver while the next one downloads, so
+ * the uart and the network transfer overlap */
+static void
+supl_segment(void *arg, supl_assist_t *assist, int set, int last) {
+        GpsState *s = (GpsState *)arg;
+        unsigned char *buff;
+        int len = 0;
 
-        D("Alloc aid buff");
-        buff = (unsigned char *)calloc(1, 8192);
+        buff = (unsigned char *)calloc(1, AID_BUFF_SIZE);
         if (buff == NULL) {
                 D("Alloc aid buff failed.");
-                goto SuplEnd;
+                return;
         }
-        D("Pack aid data");
-        len = supl2cas_aid(&assist, buff);
-        if (len > 0) {
-                write(fd, buff, len);
-                D("Send CasicAidMessage: %d bytes.", len);
+        len = supl2cas_aid(assist, set, buff);
+        if (len > 0 && s->fd >= 0) {
+                aidq_send(s->fd, buff, len, get_monotonic_ms());
+                D("Send CasicAidMessage segment %d%s: %d bytes.", supl_segments, last ? " (last)" : "", len);
         }
-        last_supl_time = time(NULL);
-        D("Update last supl time: %lu", last_supl_time);
 #if SUPL_TEST
-        FILE *f = fopen("/data/agpshal.bin", "wb");
+        FILE *f = fopen("/data/agpshal.bin", supl_segments == 0 ? "wb" : "ab");
         if (f != NULL) {
                 fwrite(buff, 1, len, f);
                 fclose(f);
         }
 #endif
+        supl_segments += 1;
         free(buff);
+}
 
-        D("Free supl_ctx");
+/* uart time the ephemerides the receiver already held would have taken */
+static void
+aid_saved_report(const char *what) {
+        int n, bytes;
+
+        rxaid_stats(&n, &bytes, 1);
+        if (n > 0)
+                D("%s: %d ephemerides held by the receiver left out, %d bytes, %d ms of uart",
+                  what, n, bytes, bytes * 10 * 1000 / tty_bps);
+}
+
+/* the session is over, whatever came keeps for the next start */
+static void
+supl_deliver(supl_assist_t *assist) {
+#if SUPL_TEST
+        supl_consume_1(assist);
+#endif
+        aid_saved_report("supl session");
+        if (assist->set != 0 || assist->cnt_eph > 0)
+                aidcache_put(assist, get_gps_s());
+}
+
+static void
+supl_end(int epoll_fd) {
+        if (supl_fd >= 0)
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, supl_fd, NULL);
+        supl_fd = -1;
+        supl_close(&supl_ctx);
         supl_ctx_free(&supl_ctx);
+        supl_phase = SUPL_IDLE;
+        last_supl_time = get_monotonic_ms();
+        supl_next_check = last_supl_time;
+}
+
+/* follow the session: resolver, connect race and socket each have their own fd */
+static void
+supl_watch(int epoll_fd) {
+        struct epoll_event ev;
 
-SuplEnd:
-        is_supl_thread_running = 0;
-        D("Endof supl thread");
+        if (supl_ctx.state == SUPL_STATE_DONE) {
+                supl_deliver(&supl_assist);
+                supl_end(epoll_fd);
+                return;
+        }
+        if (supl_ctx.state == SUPL_STATE_FAILED) {
+                D("SUPL protocol error %d", supl_ctx.err);
+                supl_deliver(&supl_assist);
+                supl_end(epoll_fd);
+                return;
+        }
+
+        if (supl_fd >= 0 && supl_fd != supl_session_fd(&supl_ctx))
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, supl_fd, NULL);
+        supl_fd = supl_session_fd(&supl_ctx);
+        ev.events = ((supl_ctx.events & SUPL_WANT_READ) ? EPOLLIN : 0) |
+                    ((supl_ctx.events & SUPL_WANT_WRITE) ? EPOLLOUT : 0);
+        ev.data.fd = supl_fd;
+        // a closed socket left the set, its successor may have the same number
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, supl_fd, &ev) < 0 && errno == ENOENT)
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, supl_fd, &ev);
 }
 
+/* ms until supl_tick() is due, -1 for none */
+static int
+supl_timeout(long long now) {
+        if (supl_phase == SUPL_IDLE && supl_active)
+                return supl_next_check > now ? (int)(supl_next_check - now) : 0;
+        if (supl_phase == SUPL_WAIT_CELL)
+                return supl_cell_deadline > now ? (int)(supl_cell_deadline - now) : 0;
+        if (supl_phase == SUPL_SESSION)
+                return supl_session_timeout(&supl_ctx, now);
+        return -1;
+}
 
-/*
+/* after every epoll_wait: start the session once the cell is known, apply the deadlines */
 static void
-supl_start() {
-  GpsState *state = _gps_state;
-  int thread = state->callbacks.create_thread_cb("ZkwSuplThread", zkw_supl_thread, state);
-  if (!thread) {
-    D("Could not create supl thread: %s", strerror(errno));
-    return;
-  }
-}
-*/
+supl_tick(GpsState *s, int epoll_fd, long long now) {
+        if (supl_phase == SUPL_IDLE) {
+                if (supl_active && now >= supl_next_check)
+                        supl_begin(now);
+        } else if (supl_phase == SUPL_WAIT_CELL) {
+                if (supl_ctx.p.set == 0 && now < supl_cell_deadline)
+                        return;
+                if (supl_ctx.p.set == 0) {
+                        D("No cell info present.");
+#if SUPL_TEST
+                        supl_set_lte_cell(&supl_ctx, 460, 0, 22548, 193790209, 0);
+#else
+                        supl_end(epoll_fd);
+                        return;
+#endif
+                }
+                if (supl_ctx.p.msisdn[0] == 0) {
+                        D("No msisdn present.");
+                        supl_set_msisdn(&supl_ctx, "+8613588889999");
+                }
+                D("Download assist data");
+                supl_set_segment_cb(&supl_ctx, supl_segment, s);
+                supl_eph_sent = 0;
+                supl_eph_budget = aid_eph_budget();
+                supl_bds_sent = 0;
+                supl_bds_budget = aid_eph_budget();
+                supl_glo_sent = 0;
+                supl_glo_budget = aid_eph_budget();
+                supl_segments = 0;
+                if (supl_session_start(&supl_ctx, supl_host, supl_port, &supl_assist, now) < 0) {
+                        D("SUPL protocol error %d", supl_ctx.err);
+                        supl_end(epoll_fd);
+                        return;
+                }
+                supl_phase = SUPL_SESSION;
+                supl_watch(epoll_fd);
+        } else if (supl_phase == SUPL_SESSION && supl_session_timeout(&supl_ctx, now) == 0) {
+                supl_session_handle(&supl_ctx, now);
+                supl_watch(epoll_fd);
+        }
+}
+
+/* 1 if the event was for the supl socket */
+static int
+supl_handle(int epoll_fd, int fd) {
+        if (supl_phase != SUPL_SESSION || fd != supl_fd)
+                return 0;
+        supl_session_handle(&supl_ctx, get_monotonic_ms());
+        supl_watch(epoll_fd);
+        return 1;
+}
+
+/* start: a session right away if the cache does not cover the sky, so it
+ * overlaps the receiver coming up */
+static void
+supl_schedule(long long now) {
+        supl_active = 1;
+        supl_next_check = now;
+        supl_begin(now);
+}
+
+static void
+supl_cancel(int epoll_fd) {
+        supl_active = 0;
+        if (supl_phase == SUPL_IDLE)
+                return;
+        D("Cancel supl in phase %d", supl_phase);
+        supl_session_cancel(&supl_ctx);
+        supl_end(epoll_fd);
+        // cut short, the next start may try again
+        last_supl_time = 0;
+}
+
+/* the reference location of the cache as the supl position, with its age */
+static void
+aid_cache_restore_pos() {
+        static supl_assist_t assist;
+        long long now = get_gps_s();
+        long long t = aidcache_pos_time(now);
+        int week[MAX_EPHEMERIS];
+
+        if (t == 0)
+                return;
+        aidcache_get(&assist, week, now);
+        aid_supl_pos.lat = assist.pos.lat;
+        aid_supl_pos.lon = assist.pos.lon;
+        aid_supl_pos.alt = 0;
+        aid_supl_pos.acc = 10.0 * (pow(1.1, assist.pos.uncertainty & 0x7f) - 1);
+        aid_supl_pos.ref_ms = get_elapsed_ms() - (now - t) * 1000;
+        D("aid cache position %.6f %.6f, %lld s old", assist.pos.lat, assist.pos.lon, now - t);
+}
+
+/* hand what is still good back to the receiver after a power cycle: the
+ * ephemerides decoded from the sky go into the cache first */
+static void
+aid_cache_inject(GpsState *s) {
+        static supl_assist_t assist;
+        struct supl_ephemeris_s eph[SUBFRAME_GPS_MAX];
+        int week[SUBFRAME_GPS_MAX];
+        FIX_UTC_STR uTempUtc;
+        FIX_IONO_STR uTempIon;
+        unsigned char *buff;
+        long long now = get_gps_s();
+        int cnt, n, budget = aid_eph_budget();
+        int length = 0;
+
+        n = subframe_gps_eph(eph, week, SUBFRAME_GPS_MAX);
+        for (cnt = 0; cnt < n; cnt++)
+                aidcache_put_eph(&eph[cnt], week[cnt], now);
+        n = aidcache_get(&assist, week, now);
+        if (s->fd < 0 || (n == 0 && !(assist.set & (SUPL_RRLP_ASSIST_UTC | SUPL_RRLP_ASSIST_IONO))))
+                return;
+
+        buff = (unsigned char *)calloc(1, (n + 2) * (sizeof(GPS_FIX_EPHEMERIS_STR) + 10));
+        if (buff == NULL)
+                return;
+        length += aid_eph_pack(assist.eph, week, n, now > 0 ? now % GPS_WEEK_S : -1, buff, &budget);
+        if (assist.set & SUPL_RRLP_ASSIST_UTC) {
+                memset(&uTempUtc, 0, sizeof(FIX_UTC_STR));
+                supl2cas_utc(&assist.utc, &uTempUtc);
+                if (uTempUtc.valid == NAVIGATION_MESSAGE_AVAILABLE)
+                        length += cas_make_msg(ID_RXM_GPS_UTC, (int *)(&uTempUtc), sizeof(FIX_UTC_STR), buff + length);
+        }
+        if (assist.set & SUPL_RRLP_ASSIST_IONO) {
+                memset(&uTempIon, 0, sizeof(FIX_IONO_STR));
+                supl2cas_iono(&assist.iono, &uTempIon);
+                if (uTempIon.valid == NAVIGATION_MESSAGE_AVAILABLE)
+                        length += cas_make_msg(ID_RXM_GPS_ION, (int *)(&uTempIon), sizeof(FIX_IONO_STR), buff + length);
+        }
+        if (length > 0) {
+                aidq_send(s->fd, buff, length, get_monotonic_ms());
+                D("Send %d cached ephemerides, set 0x%x: %d bytes.", n, assist.set, length);
+        }
+        free(buff);
+}
+
+static long long aid_cache_due = 0;     // monotonic ms the cache goes in without the poll answer, 0 for none
+
+/* at start: learn what the receiver kept over the stop, the cache follows the answer */
+static void
+aid_cache_start(GpsState *s, long long now) {
+        rxaid_reset();
+        aid_cache_due = 0;
+        if (rxaid_poll(s->fd, now) > 0)
+                aid_cache_due = now + rxaid_poll_ms(tty_bps);
+        else
+                aid_cache_inject(s);
+}
+
+/* the receiver has answered the poll, or it is too late to wait for it */
+static void
+aid_cache_ready(GpsState *s) {
+        if (aid_cache_due == 0)
+                return;
+        aid_cache_due = 0;
+        aid_cache_inject(s);
+        aid_saved_report("cache");
+}
+
+/* ms until aid_cache_tick() is due, -1 for none */
+static int
+aid_cache_timeout(long long now) {
+        if (aid_cache_due == 0)
+                return -1;
+        return aid_cache_due > now ? (int)(aid_cache_due - now) : 0;
+}
+
+static void
+aid_cache_tick(GpsState *s, long long now) {
+        if (aid_cache_due > 0 && now >= aid_cache_due)
+                aid_cache_ready(s);
+}
+
 #endif
 /*****************************************************************/
 /*****************************************************************/
@@ -723,14 +1401,25 @@ supl_start() {
 
 #define  NMEA_MAX_SIZE  83
 #define  MAX_SV_PRN 256
+
+/* fix extrapolation, see nmea_reader_extrapolate() */
+#define  EARTH_RADIUS            6378137.0
+#define  EXTRAPOLATE_MIN_SPEED   0.5             // m/s, below this bearing is noise
+#define  EXTRAPOLATE_MAX_LATENCY 1500            // ms, beyond this the clock is not trusted
+#define  EXTRAPOLATE_UERE        3.0             // m per unit of dop
+#define  GPS_LOCATION_IS_EXTRAPOLATED 0x0100     // private flag, ignored by the framework
+
 typedef struct {
         int     pos;
         int     overflow;
+        long long epoch_start;
         int     utc_year;
         int     utc_mon;
         int     utc_day;
         int     utc_diff;
         GpsLocation  fix;
+        GpsLocation  epoch_fix;         // last delivered fix of this epoch
+        float   hdop;                   // of the last GGA, accuracy holds the pdop
         GpsStatus status;
 #if GPS_SV_INCLUDE
         GpsSvStatus  sv_status;
@@ -866,9 +1555,9 @@ nmea_reader_update_time( NmeaReader*  r, Token  tok )
         tm.tm_mday  = r->utc_day;
         tm.tm_isdst = -1;
 
-        // report utctime instead of localtime
-        fix_time = mktime( &tm );// + r->utc_diff;
-        r->fix.timestamp = (long long)fix_time * 1000;
+        // report utctime instead of localtime, to the ms the receiver gives
+        fix_time = timegm( &tm );
+        r->fix.timestamp = (long long)fix_time * 1000 + (long long)((seconds - tm.tm_sec) * 1000 + 0.5);
         //D("NmeaReaderUpdateTime, utcdiff=%d, fix_time=%d", r->utc_diff, fix_time);
         return 0;
 }
@@ -1041,6 +1730,61 @@ nmea_reader_encode_sv_status(NmeaReader*  r) {    // encode used_in_fix flag
         }
 }
 
+/* latency between the receiver's epoch and now, in ms.
+ * prefer system time against the fix time, fall back to the time spent
+ * receiving this epoch plus the uart time of the first sentence when the
+ * system clock does not agree with gps time.
+ */
+static long long
+nmea_reader_latency( NmeaReader*  r )
+{
+        long long latency = get_realtime_ms() - r->fix.timestamp;
+
+        if (latency >= 0 && latency <= EXTRAPOLATE_MAX_LATENCY)
+                return latency;
+
+        if (r->epoch_start == 0)
+                return -1;
+
+        return get_monotonic_ms() - r->epoch_start + (NMEA_MAX_SIZE * 10 * 1000) / tty_bps;
+}
+
+/* project the fix forward to delivery time along speed and bearing.
+ * the correction never exceeds the accuracy, accuracy holds the dop.
+ */
+static void
+nmea_reader_extrapolate( NmeaReader*  r, GpsLocation*  loc )
+{
+        long long latency;
+        double dist, brg, clat;
+
+        if ((loc->flags & (GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING)) !=
+                        (GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING))
+                return;
+        if (loc->speed < EXTRAPOLATE_MIN_SPEED)
+                return;
+
+        latency = nmea_reader_latency(r);
+        if (latency <= 0 || latency > EXTRAPOLATE_MAX_LATENCY)
+                return;
+
+        dist = loc->speed * latency / 1000.0;
+        if ((loc->flags & GPS_LOCATION_HAS_ACCURACY) && dist > loc->accuracy * EXTRAPOLATE_UERE)
+                dist = loc->accuracy * EXTRAPOLATE_UERE;
+
+        brg  = loc->bearing * M_PI / 180.0;
+        clat = cos(loc->latitude * M_PI / 180.0);
+
+        loc->latitude += dist * cos(brg) / EARTH_RADIUS * 180.0 / M_PI;
+        if (clat > 1e-6)
+                loc->longitude += dist * sin(brg) / (EARTH_RADIUS * clat) * 180.0 / M_PI;
+        loc->timestamp += latency;
+        loc->flags |= GPS_LOCATION_IS_EXTRAPOLATED;
+#if NMEA_DEBUG
+        D("extrapolated %.2f m over %lld ms", dist, latency);
+#endif
+}
+
 static void
 nmea_reader_parse( NmeaReader*  r )
 {
@@ -1109,6 +1853,7 @@ nmea_reader_parse( NmeaReader*  r )
                 Token  tok_longitude     = nmea_tokenizer_get(tzer,4);
                 Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,5);
                 Token  tok_isPix         = nmea_tokenizer_get(tzer,6);
+                Token  tok_hdop          = nmea_tokenizer_get(tzer,8);
                 Token  tok_altitude      = nmea_tokenizer_get(tzer,9);
                 Token  tok_altitudeUnits = nmea_tokenizer_get(tzer,10);
 
@@ -1119,23 +1864,11 @@ nmea_reader_parse( NmeaReader*  r )
                                                    tok_longitude,
                                                    tok_longitudeHemi.p[0]);
                         nmea_reader_update_altitude(r, tok_altitude, tok_altitudeUnits);
+                        r->hdop = str2float(tok_hdop.p, tok_hdop.end);
                 }
-                else {
-#if SUPL_ENABLED
-                        D("Unfixed, try to use supl, flag = %d", is_supl_thread_running);
-                        if (is_supl_thread_running == 0 && is_supl_needed()) {
-                                GpsState *s = _gps_state;
-                                is_supl_thread_running = 1;
-                                int tid = s->callbacks.create_thread_cb("ZKWSuplThread", zkw_supl_thread, s);
-                                if (!tid) {
-                                        D("Could not create supl thread: %s", strerror(errno));
-                                        is_supl_thread_running = 0;
-                                }
-                                else {
-                                        D("ZKW SUPL thread created. tid = 0x%X", tid);
-                                }
-                        }
-#endif
+                else if (tok_isPix.p[0] == '0' || tok_isPix.p[0] == '\0') {
+                        // the fix is lost, the epoch published from here on has none
+                        r->epoch_fix.flags = 0;
                 }
                 memset(r->sv_used_in_fix, 0, MAX_SV_PRN);
         } else if ( !memcmp(tok.p, "GSA", 3) ) {
@@ -1201,10 +1934,22 @@ nmea_reader_parse( NmeaReader*  r )
                         nmea_reader_update_bearing( r, tok_bearing );
                         nmea_reader_update_speed  ( r, tok_speed );
                 }
+                else if (tok_fixStatus.p[0] == 'V') {
+                        r->epoch_fix.flags = 0;
+                }
 #if GPS_SV_INCLUDE
                 r->sv_status_changed = 1;   // update sv status when receive gps, that's last sv status.
 #endif
 
+        } else if ( !memcmp(tok.p, "VTG", 3) ) {
+                Token  tok_bearing       = nmea_tokenizer_get(tzer,1);
+                Token  tok_speed         = nmea_tokenizer_get(tzer,5);
+                Token  tok_mode          = nmea_tokenizer_get(tzer,9);
+
+                if (tok_mode.p[0] != 'N') {
+                        nmea_reader_update_bearing( r, tok_bearing );
+                        nmea_reader_update_speed  ( r, tok_speed );
+                }
         } else if ( !memcmp(tok.p, "GSV", 3) ) {
 #if GPS_SV_INCLUDE
                 Token  tok_noSatellites  = nmea_tokenizer_get(tzer, 3);
@@ -1313,9 +2058,19 @@ nmea_reader_parse( NmeaReader*  r )
                 p += snprintf(p, end-p, " time=%s", asctime( &utc ));
                 D("%s", temp);
 #endif
+                geofence_update(&r->fix);
+                r->epoch_fix = r->fix;
                 if (r->callback) {
-                        r->callback( &r->fix );
+                        if (fix_extrapolate) {
+                                GpsLocation  loc = r->fix;
+                                nmea_reader_extrapolate(r, &loc);
+                                r->callback( &loc );
+                        }
+                        else {
+                                r->callback( &r->fix );
+                        }
                         r->fix.flags = 0;
+                        r->epoch_start = 0;
                 }
                 else {
 #if NMEA_DEBUG
@@ -1334,6 +2089,11 @@ nmea_reader_parse( NmeaReader*  r )
                 if (r->sv_callback) {
                         // D("Reprot sv status 2.");
                         nmea_reader_encode_sv_status(r);
+#if SUPL_ENABLED
+                        aid_sky_update(&r->sv_status);
+#endif
+                        epoch_shm_publish(&r->epoch_fix, &r->sv_status);
+                        track_record(&r->epoch_fix, &r->sv_status);
                         r->sv_callback(&r->sv_status);
 
                         r->sv_status.num_svs = 0;
@@ -1369,6 +2129,9 @@ nmea_reader_addc( NmeaReader*  r, int  c )
                 return;
         }
 
+        if (r->pos == 0 && r->epoch_start == 0)
+                r->epoch_start = get_monotonic_ms();
+
         r->in[r->pos] = (char)c;
         r->pos       += 1;
 
@@ -1414,6 +2177,178 @@ gps_state_done( GpsState*  s )
         close( s->fd );
         s->fd = -1;
         s->init = 0;
+
+        epoch_shm_close();
+        rawfan_close();
+        track_close();
+        lastfix_close();
+#if SUPL_ENABLED
+        aidcache_close();
+#endif
+}
+
+#define  GPS_WEEK_MS             604800000LL
+#define  AID_CLOCK_DRIFT         50e-6           // elapsed realtime drift, s/s
+
+/* last injected time, utc_ms 0 for none, under aid_lock */
+typedef struct {
+        long long       utc_ms;
+        long long       ref_ms;                 // elapsed realtime of utc_ms
+        int             unc_ms;
+} AidTime;
+
+static AidTime aid_time;
+
+/* what the receiver starts from, goes out ahead of any other aid */
+static void
+aid_ini_send( GpsState*  s )
+{
+        AID_INI_STR  ini;
+        AidPos       pos;
+        AidTime      t;
+        long long    age, gps_ms;
+        int          queued = 0, source;
+        int          payload[sizeof(AID_INI_STR) / 4];
+        unsigned char  frame[sizeof(AID_INI_STR) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE];
+
+        if (s->fd < 0)
+                return;
+        memset( &ini, 0, sizeof(ini) );
+        source = aid_pos_best( &pos );
+        if (source != AID_POS_NONE) {
+                ini.xOrLat = pos.lat;
+                ini.yOrLon = pos.lon;
+                ini.zOrAlt = pos.alt;
+                ini.posAcc = pos.acc;
+                ini.flags = AID_INI_POS_VALID | AID_INI_POS_LLA;
+                D("aid position from %d: %.6f %.6f pacc %.0f", source, pos.lat, pos.lon, pos.acc);
+        }
+        pthread_mutex_lock( &aid_lock );
+        t = aid_time;
+        pthread_mutex_unlock( &aid_lock );
+        if (t.utc_ms == 0) {
+                if (ini.flags) {
+                        memcpy( payload, &ini, sizeof(ini) );
+                        aidq_send( s->fd, frame, cas_make_msg( ID_AID_INI, payload, sizeof(ini), frame ), get_monotonic_ms() );
+                }
+                return;
+        }
+
+        // the receiver takes the time when the last byte is in, behind
+        // whatever the uart still holds and the rest of a frame cut short
+        ioctl( s->fd, TIOCOUTQ, &queued );
+        queued += aidq_ahead();
+        age = get_elapsed_ms() - t.ref_ms;
+        gps_ms = t.utc_ms + age - GPS_EPOCH_UNIX_MS + GPS_LEAP_SECONDS * 1000LL;
+        gps_ms += (queued + sizeof(ini) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE) * 10 * 1000LL / tty_bps;
+        ini.wn = gps_ms / GPS_WEEK_MS;
+        ini.tow = (gps_ms % GPS_WEEK_MS) / 1000.0;
+        ini.tAcc = t.unc_ms / 1000.0 + age / 1000.0 * AID_CLOCK_DRIFT;
+        ini.flags |= AID_INI_TIME_VALID;
+        memcpy( payload, &ini, sizeof(ini) );
+        aidq_send( s->fd, frame, cas_make_msg( ID_AID_INI, payload, sizeof(ini), frame ), get_monotonic_ms() );
+        D("aid time: week %d tow %.3f tacc %.3f", ini.wn, ini.tow, ini.tAcc);
+}
+
+/* commands to the receiver go through the aid queue, a direct write could
+ * land inside an aid frame the tty cut short */
+static void
+gps_cmd( int  fd, const char*  body )
+{
+        char  buff[128];
+        int   len;
+
+        if (fd < 0)
+                return;
+        len = casic_make_cmd( body, buff, sizeof(buff) );
+        if (len > 0)
+                aidq_cmd( fd, (const unsigned char *)buff, len, get_monotonic_ms() );
+}
+
+/* a sentence that already carries its checksum */
+static void
+gps_raw( int  fd, const char*  sentence )
+{
+        if (fd >= 0)
+                aidq_cmd( fd, (const unsigned char *)sentence, strlen(sentence), get_monotonic_ms() );
+}
+
+static void
+gps_enable_msg( int  fd, int  id, int  rate )
+{
+        unsigned char  buff[CASIC_HEAD_SIZE + 4 + CASIC_CKSUM_SIZE];
+
+        if (fd >= 0)
+                aidq_cmd( fd, buff, casic_make_enable( id, rate, buff ), get_monotonic_ms() );
+}
+
+/* PCAS10 restart for the next start, -1 for none */
+static int restart_pending = -1;
+
+#define  GPS_RESTART_SETTLE  200        // ms for the receiver to come back up before any aid goes in
+
+/* in the gps thread, the caller waits GPS_RESTART_SETTLE after the tty is
+ * through the command before the next aid. the reset keeps the rest of a
+ * frame cut short, the command follows it */
+static void
+gps_restart( GpsState*  s, int restart )
+{
+        char  cmd[16];
+
+        aidq_reset();
+        snprintf( cmd, sizeof(cmd), "PCAS10,%d", restart );
+        gps_cmd( s->fd, cmd );
+        D("%s", cmd);
+#if SUPL_ENABLED
+        if (restart > 0)
+                rxaid_reset();
+#endif
+}
+
+/* what goes to the receiver when a session starts */
+static void
+gps_start_aid( GpsState*  s )
+{
+        aid_ini_send( s );
+
+#if SUPL_ENABLED
+        aid_cache_start(s, get_monotonic_ms());
+        gps_enable_msg(s->fd, ID_RXM_SFRBX, 1);
+#endif
+}
+
+/* the gps thread owns the tty, restarts go through it */
+static void
+gps_state_restart( GpsState*  s, int restart )
+{
+        char  cmd = CMD_RESTART + restart;
+        int   ret;
+
+        do {
+                ret=write( s->control[0], &cmd, 1 );
+        }
+        while (ret < 0 && errno == EINTR);
+
+        if (ret != 1)
+                D("Could not send CMD_RESTART command: ret=%d: %s",
+                  ret, strerror(errno));
+}
+
+/* injected time and position too, the thread builds the AID-INI from them */
+static void
+gps_state_aid_ini( GpsState*  s )
+{
+        char  cmd = CMD_AID_INI;
+        int   ret;
+
+        do {
+                ret=write( s->control[0], &cmd, 1 );
+        }
+        while (ret < 0 && errno == EINTR);
+
+        if (ret != 1)
+                D("Could not send CMD_AID_INI command: ret=%d: %s",
+                  ret, strerror(errno));
 }
 
 static void
@@ -1422,6 +2357,12 @@ gps_state_start( GpsState*  s )
         char  cmd = CMD_START;
         int   ret;
 
+        // the restart goes ahead, the start aid waits for it to settle
+        if (restart_pending >= 0) {
+                gps_state_restart( s, restart_pending );
+                restart_pending = -1;
+        }
+
         do {
                 ret=write( s->control[0], &cmd, 1 );
         }
@@ -1432,22 +2373,9 @@ gps_state_start( GpsState*  s )
                   ret, strerror(errno));
 
 #if GPS_SV_INCLUDE
-        write(s->fd,gps_idle_off,strlen(gps_idle_off));
+        gps_raw(s->fd, gps_idle_off);
         D("%s",gps_idle_off);
 #endif
-
-        /*
-        #if SUPL_ENABLED
-          if (is_supl_needed() && is_supl_thread_running == 0) {
-            int tid = s->callbacks.create_thread_cb("zkw_supl_thread", zkw_supl_thread, s);
-            if (!tid) {
-              D("Could not create supl thread: %s", strerror(errno));
-              return;
-            }
-            D("ZKW SUPL thread created. tid = 0x%X", tid);
-          }
-        #endif
-        */
 }
 
 
@@ -1467,7 +2395,7 @@ gps_state_stop( GpsState*  s )
                   ret, strerror(errno));
 
 #if GPS_SV_INCLUDE
-        write(s->fd,gps_idle_on,strlen(gps_idle_on));
+        gps_raw(s->fd, gps_idle_on);
         D("%s",gps_idle_on);
 #endif
 }
@@ -1502,6 +2430,83 @@ epoll_deregister( int  epoll_fd, int  fd )
         return ret;
 }
 
+static int
+epoll_modify( int  epoll_fd, int  fd, unsigned int  events )
+{
+        struct epoll_event  ev;
+        int                 ret;
+
+        ev.events  = events;
+        ev.data.fd = fd;
+        do {
+                ret = epoll_ctl( epoll_fd, EPOLL_CTL_MOD, fd, &ev );
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+}
+
+/* receiver commands for a duty state change, see motion.c.
+ * PCAS03 rates: GGA,GLL,GSA,GSV,RMC,VTG, empty fields stay as they are.
+ */
+static void
+duty_apply( int  fd, int  from, int  to )
+{
+        char  rate[64];
+
+        switch (to) {
+        case DUTY_FULL:
+                if (from == DUTY_REDUCED)
+                        gps_cmd(fd, "PCAS03,1,,1,1,1,1");
+                break;
+        case DUTY_REDUCED:
+                snprintf(rate, sizeof(rate), "PCAS03,%d,,%d,%d,%d,%d",
+                         MOTION_REDUCED_EVERY, MOTION_REDUCED_EVERY, MOTION_REDUCED_EVERY,
+                         MOTION_REDUCED_EVERY, MOTION_REDUCED_EVERY);
+                gps_cmd(fd, rate);
+                break;
+        case DUTY_IDLE:
+                // wake up at full rate
+                if (from == DUTY_REDUCED)
+                        gps_cmd(fd, "PCAS03,1,,1,1,1,1");
+                gps_raw(fd, gps_idle_on);
+                break;
+        case DUTY_WAKE:
+                gps_raw(fd, gps_idle_off);
+                break;
+        }
+}
+
+/* binary frames interleaved with the nmea stream */
+static void
+gps_casic_frame( void*  arg, int  id, const unsigned char*  payload, int  len )
+{
+        GpsState*  s = (GpsState*) arg;
+
+        switch (id) {
+        case ID_ACK_ACK:
+        case ID_ACK_NAK:
+                if (len >= 2)
+                        aidq_ack( s->fd, casic_u2(payload), id == ID_ACK_ACK, get_monotonic_ms() );
+                break;
+        case ID_RXM_MEASX:
+                measurement_decode_measx(payload, len);
+                break;
+        case ID_RXM_SFRBX:
+                navmsg_decode_sfrbx(payload, len);
+                break;
+#if SUPL_ENABLED
+        case ID_RXM_GPS_EPH:
+                if (rxaid_update(payload, len))
+                        aid_cache_ready(s);
+                break;
+#endif
+        default:
+#if NMEA_DEBUG
+                D("casic frame 0x%04x, %d bytes", id, len);
+#endif
+                break;
+        }
+}
+
 /* this is the main thread, it waits for commands from gps_state_start/stop and,
  * when started, messages from the QEMU GPS daemon. these are simple NMEA sentences
  * that must be parsed to be converted into GPS fixes sent to the framework
@@ -1511,35 +2516,116 @@ gps_state_thread( void*  arg )
 {
         GpsState*   state = (GpsState*) arg;
         NmeaReader  reader[1];
+        CasicParser casic[1];
         int         epoll_fd   = epoll_create(2);
         int         started    = 0;
         int         gps_fd     = state->fd;
         int         control_fd = state->control[1];
         int         t_sec = -1;
+        long long   fix_seen   = 0;
+        long long   restart_settle = 0;
+        int         start_aid  = 0;
+        unsigned int  gps_events = EPOLLIN;
 
         nmea_reader_init( reader );
+        casic_parser_init( casic, gps_casic_frame, state );
 
         // register control file descriptors for polling
         epoll_register( epoll_fd, control_fd );
         epoll_register( epoll_fd, gps_fd );
+        if (raw_stream_path[0] != 0)
+                rawfan_open( raw_stream_path, epoll_fd );
 
         D("gps thread running");
 
         // now loop
         for (;;) {
-                struct epoll_event   events[2];
-                int                  ne, nevents;
-
-                nevents = epoll_wait( epoll_fd, events, 2, -1 );
+                struct epoll_event   events[3 + RAWFAN_MAX_CLIENTS];
+                int                  ne, nevents, duty;
+                int                  timeout;
+
+                // standby hold time, and the duty cycle while started
+                timeout = power_timeout( get_monotonic_ms() );
+                if (started && duty_cycle) {
+                        int  t = motion_timeout( get_monotonic_ms() );
+                        if (t >= 0 && (timeout < 0 || t < timeout))
+                                timeout = t;
+                }
+                {
+                        int  t = aidq_timeout( get_monotonic_ms() );
+                        if (t >= 0 && (timeout < 0 || t < timeout))
+                                timeout = t;
+                }
+                if (restart_settle > 0) {
+                        long long  t = restart_settle - get_monotonic_ms();
+                        if (t < 0)
+                                t = 0;
+                        if (timeout < 0 || t < timeout)
+                                timeout = (int)t;
+                }
+#if SUPL_ENABLED
+                {
+                        int  t = supl_timeout( get_monotonic_ms() );
+                        if (t >= 0 && (timeout < 0 || t < timeout))
+                                timeout = t;
+                }
+                {
+                        int  t = aid_cache_timeout( get_monotonic_ms() );
+                        if (t >= 0 && (timeout < 0 || t < timeout))
+                                timeout = t;
+                }
+#endif
+                // aid cut short by a full tty goes on once it takes more
+                {
+                        unsigned int  want = aidq_want_write() ? EPOLLIN | EPOLLOUT : EPOLLIN;
+                        if (want != gps_events && epoll_modify( epoll_fd, gps_fd, want ) == 0)
+                                gps_events = want;
+                }
+                nevents = epoll_wait( epoll_fd, events, 3 + RAWFAN_MAX_CLIENTS, timeout );
                 if (nevents < 0) {
                         if (errno != EINTR)
                                 D("epoll_wait() unexpected error: %s", strerror(errno));
                         continue;
                 }
+                power_tick( get_monotonic_ms() );
+                // the receiver is back from a restart, the aid held back goes in
+                if (restart_settle > 0 && get_monotonic_ms() >= restart_settle) {
+                        restart_settle = 0;
+                        if (start_aid)
+                                gps_start_aid( state );
+                        else
+                                aid_ini_send( state );
+                        start_aid = 0;
+                }
+                aidq_tick( gps_fd, get_monotonic_ms() );
+#if SUPL_ENABLED
+                aid_cache_tick( state, get_monotonic_ms() );
+                supl_tick( state, epoll_fd, get_monotonic_ms() );
+#endif
+                if (started && duty_cycle) {
+                        // idle receiver is due for a wake up, or back to sleep
+                        int  from = motion_state();
+                        duty = motion_tick( get_monotonic_ms() );
+                        if (duty >= 0)
+                                duty_apply( gps_fd, from, duty );
+                }
+                if (nevents == 0)
+                        continue;
 #if NMEA_DEBUG
                 D("gps thread received %d events", nevents);
 #endif
                 for (ne = 0; ne < nevents; ne++) {
+                        // raw stream subscribers come and go on their own
+                        if (rawfan_handle(events[ne].data.fd, events[ne].events))
+                                continue;
+#if SUPL_ENABLED
+                        if (supl_handle(epoll_fd, events[ne].data.fd))
+                                continue;
+#endif
+                        if (events[ne].data.fd != gps_fd && events[ne].data.fd != control_fd) {
+                                // closed earlier in this batch, stale event
+                                continue;
+                        }
                         if ((events[ne].events & (EPOLLERR|EPOLLHUP)) != 0) {
                                 D("EPOLLERR or EPOLLHUP after epoll_wait() !?");
                                 return;
@@ -1558,6 +2644,9 @@ gps_state_thread( void*  arg )
 
                                         if (cmd == CMD_QUIT) {
                                                 D("gps thread quitting on demand");
+#if SUPL_ENABLED
+                                                supl_cancel( epoll_fd );
+#endif
                                                 return;
                                         }
                                         else if (cmd == CMD_START) {
@@ -1578,13 +2667,38 @@ gps_state_thread( void*  arg )
                                                                 reader->status.status = GPS_STATUS_SESSION_BEGIN;
                                                                 reader->status_callback(&reader->status);
                                                         }
+                                                        if (duty_cycle)
+                                                                motion_reset( duty_wake_period * 1000 );
+                                                        if (restart_settle > 0)
+                                                                start_aid = 1;
+                                                        else
+                                                                gps_start_aid( state );
+#if SUPL_ENABLED
+                                                        supl_schedule( get_monotonic_ms() );
+#endif
 
                                                 }
                                         }
+                                        else if (cmd == CMD_AID_INI) {
+                                                // a settling restart sends it anyway
+                                                if (restart_settle == 0)
+                                                        aid_ini_send( state );
+                                        }
+                                        else if (cmd >= CMD_RESTART && cmd <= CMD_RESTART + 2) {
+                                                gps_restart( state, cmd - CMD_RESTART );
+                                                restart_settle = get_monotonic_ms() + GPS_RESTART_SETTLE +
+                                                                 aidq_ahead() * 10 * 1000LL / tty_bps;
+                                        }
                                         else if (cmd == CMD_STOP) {
                                                 if (started) {
                                                         D("gps thread stopping");
                                                         started = 0;
+#if SUPL_ENABLED
+                                                        supl_cancel( epoll_fd );
+#endif
+                                                        // leave the receiver at full rate for the next start
+                                                        if (duty_cycle && motion_state() == DUTY_REDUCED)
+                                                                duty_apply( gps_fd, DUTY_REDUCED, DUTY_FULL );
                                                         if (reader->status_callback) {
                                                                 reader->status.status = GPS_STATUS_SESSION_END;
                                                                 reader->status_callback(&reader->status);
@@ -1601,7 +2715,7 @@ gps_state_thread( void*  arg )
                                 }
                                 else if (fd == gps_fd)
                                 {
-                                        char  buff[128];
+                                        unsigned char  buff[2048];
                                         // D("gps fd event");
                                         for (;;) {
                                                 int  nn, ret;
@@ -1618,8 +2732,29 @@ gps_state_thread( void*  arg )
 #if NMEA_DEBUG
                                                 D("gps fd received: %.*s bytes: %d", ret, buff, ret);
 #endif
-                                                for (nn = 0; nn < ret; nn++)
+                                                for (nn = 0; nn < ret; ) {
+                                                        if (casic_parser_busy(casic) || buff[nn] == BIN_HEADER0) {
+                                                                nn += casic_parser_feed(casic, buff + nn, ret - nn);
+                                                                continue;
+                                                        }
                                                         nmea_reader_addc( reader, buff[nn] );
+                                                        nn += 1;
+                                                }
+                                                // fan out only after the fixes went up
+                                                rawfan_push( buff, ret );
+
+                                                if (started && reader->epoch_fix.timestamp != fix_seen) {
+                                                        long long  now = get_monotonic_ms();
+                                                        fix_seen = reader->epoch_fix.timestamp;
+                                                        power_fix( now );
+                                                        lastfix_update( &reader->epoch_fix, now );
+                                                        if (duty_cycle) {
+                                                                int  from = motion_state();
+                                                                duty = motion_update( &reader->epoch_fix, reader->hdop, now );
+                                                                if (duty >= 0)
+                                                                        duty_apply( gps_fd, from, duty );
+                                                        }
+                                                }
                                         }
                                         // D("gps fd event end");
                                 }
@@ -1665,6 +2800,24 @@ gps_state_init( GpsState*  state)
 
         D("gps will read from %s", state->device);
 
+        aidq_init(tty_bps);
+#if SUPL_ENABLED
+        aidq_set_lost_cb(rxaid_lost);
+#endif
+        if (epoch_shm_path[0] != 0)
+                epoch_shm_open(epoch_shm_path);
+        if (track_path[0] != 0)
+                track_open(track_path, track_blocks);
+        if (lastfix_path[0] != 0)
+                lastfix_open(lastfix_path, lastfix_interval);
+#if SUPL_ENABLED
+        if (supl_tls_cache[0] != 0)
+                supl_set_tls_cache(supl_tls_cache);
+        supl_set_connect_timeout(supl_connect_timeout);
+        if (aid_cache_path[0] != 0 && aidcache_open(aid_cache_path) == 0)
+                aid_cache_restore_pos();
+#endif
+
         if ( socketpair( AF_LOCAL, SOCK_STREAM, 0, state->control ) < 0 ) {
                 D("could not create thread control socket pair: %s", strerror(errno));
                 goto Fail;
@@ -1702,12 +2855,18 @@ zkw_gps_init(GpsCallbacks* callbacks)
         GpsState*  s = _gps_state;
         s->callbacks = *callbacks;
         load_conf();
+        power_init( power_hold );
         if (!s->init)
                 gps_state_init(s);
 
         if (s->fd < 0)
                 return -1;
 
+        if (s->callbacks.set_capabilities_cb)
+                s->callbacks.set_capabilities_cb(GPS_CAPABILITY_GEOFENCING |
+                                                GPS_CAPABILITY_MEASUREMENTS |
+                                                GPS_CAPABILITY_NAV_MESSAGES);
+
         return 0;
 }
 
@@ -1718,21 +2877,7 @@ zkw_gps_cleanup(void)
 
         if (s->init)
                 gps_state_done(s);
-}
-
-static void gps_hardware_power( int state )
-{
-        int fd = open( "/proc/gps", O_RDWR );
-        if ( fd <= 0 ) {
-                D( "/proc/gps open faild, errno %d\r\n", errno );
-                return;
-        }
-        if ( state ) {
-                write( fd , "1", 1 );
-        } else {
-                write( fd , "0", 1 );
-        }
-        close( fd );
+        power_off();
 }
 
 static int
@@ -1744,7 +2889,7 @@ zkw_gps_start()
                 D("%s: called with uninitialized state !!", __FUNCTION__);
                 return -1;
         }
-        gps_hardware_power( 1 );
+        power_start( get_monotonic_ms() );
         D("%s: called", __FUNCTION__);
         gps_state_start(s);
         return 0;
@@ -1760,7 +2905,7 @@ zkw_gps_stop()
                 D("%s: called with uninitialized state !!", __FUNCTION__);
                 return -1;
         }
-        gps_hardware_power( 0 );
+        power_stop( get_monotonic_ms() );
         D("%s: called", __FUNCTION__);
         gps_state_stop(s);
         return 0;
@@ -1769,19 +2914,87 @@ zkw_gps_stop()
 static int
 zkw_gps_inject_time(GpsUtcTime time, int64_t timeReference, int uncertainty)
 {
+        GpsState*  s = _gps_state;
+
+        if (time <= GPS_EPOCH_UNIX_MS)
+                return -1;
+        pthread_mutex_lock( &aid_lock );
+        aid_time.utc_ms = time;
+        aid_time.ref_ms = timeReference;
+        aid_time.unc_ms = uncertainty > 0 ? uncertainty : 0;
+        pthread_mutex_unlock( &aid_lock );
+        D("%s: %lld at %lld +- %d ms", __FUNCTION__, (long long)time, (long long)timeReference, uncertainty);
+
+        if (s->init && power_state() == POWER_ACTIVE)
+                gps_state_aid_ini( s );
         return 0;
 }
 
 static int
 zkw_gps_inject_location(double latitude, double longitude, float accuracy)
 {
+        GpsState*  s = _gps_state;
+
+        if (accuracy <= 0)
+                return -1;
+        pthread_mutex_lock( &aid_lock );
+        aid_injected_pos.lat = latitude;
+        aid_injected_pos.lon = longitude;
+        aid_injected_pos.alt = 0;
+        aid_injected_pos.acc = accuracy;
+        aid_injected_pos.ref_ms = get_elapsed_ms();
+        pthread_mutex_unlock( &aid_lock );
+        D("%s: %.6f %.6f +- %.0f m", __FUNCTION__, latitude, longitude, accuracy);
+
+        if (s->init && power_state() == POWER_ACTIVE)
+                gps_state_aid_ini( s );
         return 0;
 }
 
+/*
+ * map what is to be forgotten onto the receiver restarts: a warm start drops
+ * the ephemeris, a cold start everything. the factory reset (PCAS10,3) would
+ * also drop the port settings, so it is never used. GPS_DELETE_ALL drops the
+ * ephemerides, time and positions the HAL keeps for the receiver too.
+ */
 static void
 zkw_gps_delete_aiding_data(GpsAidingData flags)
 {
-        return;
+        GpsState*  s = _gps_state;
+        int        restart;
+
+        if (flags & (GPS_DELETE_ALMANAC | GPS_DELETE_POSITION | GPS_DELETE_TIME))
+                restart = 2;
+        else if (flags & GPS_DELETE_EPHEMERIS)
+                restart = 1;
+        else
+                restart = 0;
+        D("%s: flags 0x%04x, restart %d", __FUNCTION__, flags, restart);
+
+#if SUPL_ENABLED
+        // the receiver loses what supl gave it, the cache decides what to fetch again
+        if (restart > 0)
+                last_supl_time = 0;
+        if (flags == GPS_DELETE_ALL) {
+                subframe_clear();
+                aidcache_clear();
+        }
+#endif
+        if (flags == GPS_DELETE_ALL) {
+                pthread_mutex_lock( &aid_lock );
+                memset( &aid_time, 0, sizeof(aid_time) );
+                memset( &aid_injected_pos, 0, sizeof(aid_injected_pos) );
+                pthread_mutex_unlock( &aid_lock );
+                memset( &aid_supl_pos, 0, sizeof(aid_supl_pos) );
+                lastfix_clear();
+        }
+        power_force_start_type( START_HOT - restart );
+        if (s->init && power_state() == POWER_ACTIVE) {
+                gps_state_restart( s, restart );
+                power_start( get_monotonic_ms() );
+        } else if (restart > restart_pending) {
+                restart_pending = restart;
+        }
 }
 
 
@@ -1792,6 +3005,68 @@ zkw_gps_set_position_mode(GpsPositionMode mode, GpsPositionRecurrence recurrence
         return 0;
 }
 
+static const GpsGeofencingInterface zkwGpsGeofencingInterface = {
+        .size = sizeof(GpsGeofencingInterface),
+        .init = geofence_init,
+        .add_geofence_area = geofence_add_area,
+        .pause_geofence = geofence_pause,
+        .resume_geofence = geofence_resume,
+        .remove_geofence_area = geofence_remove_area,
+};
+
+static int
+zkw_measurement_init(GpsMeasurementCallbacks* callbacks)
+{
+        GpsState*  s = _gps_state;
+        int ret = measurement_init(callbacks);
+
+        if (ret == GPS_MEASUREMENT_OPERATION_SUCCESS)
+                gps_enable_msg(s->fd, ID_RXM_MEASX, 1);
+        return ret;
+}
+
+static void
+zkw_measurement_close()
+{
+        GpsState*  s = _gps_state;
+
+        gps_enable_msg(s->fd, ID_RXM_MEASX, 0);
+        measurement_close();
+}
+
+static const GpsMeasurementInterface zkwGpsMeasurementInterface = {
+        .size = sizeof(GpsMeasurementInterface),
+        .init = zkw_measurement_init,
+        .close = zkw_measurement_close,
+};
+
+static int
+zkw_navmsg_init(GpsNavigationMessageCallbacks* callbacks)
+{
+        GpsState*  s = _gps_state;
+        int ret = navmsg_init(callbacks);
+
+        if (ret == GPS_NAVIGATION_MESSAGE_OPERATION_SUCCESS)
+                gps_enable_msg(s->fd, ID_RXM_SFRBX, 1);
+        return ret;
+}
+
+static void
+zkw_navmsg_close()
+{
+        navmsg_close();
+#if !SUPL_ENABLED
+        // with supl the subframes keep feeding the ephemeris decoder
+        gps_enable_msg(_gps_state->fd, ID_RXM_SFRBX, 0);
+#endif
+}
+
+static const GpsNavigationMessageInterface zkwGpsNavigationMessageInterface = {
+        .size = sizeof(GpsNavigationMessageInterface),
+        .init = zkw_navmsg_init,
+        .close = zkw_navmsg_close,
+};
+
 static const void*
 zkw_gps_get_extension(const char* name)
 {
@@ -1805,6 +3080,15 @@ zkw_gps_get_extension(const char* name)
                 return &zkwAGpsRilInterface;
         }
 #endif
+        if ( strcmp(name, GPS_GEOFENCING_INTERFACE) == 0 ) {
+                return &zkwGpsGeofencingInterface;
+        }
+        if ( strcmp(name, GPS_MEASUREMENT_INTERFACE) == 0 ) {
+                return &zkwGpsMeasurementInterface;
+        }
+        if ( strcmp(name, GPS_NAVIGATION_MESSAGE_INTERFACE) == 0 ) {
+                return &zkwGpsNavigationMessageInterface;
+        }
         return NULL;
 }
 
@@ -0,0 +1,155 @@
+/*
+ * last known fix, kept across process and device restarts.
+ *
+ * the newest fix is always held in memory for the aid, the file mapping
+ * only gets one at most every interval seconds so flash sees a page write
+ * a minute at the most. the page is left to writeback, the slots and their
+ * crc are what make it survive a crash.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "crc32.h"
+#include "lastfix.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static pthread_mutex_t fix_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *map = NULL;
+static long long interval_ms = LASTFIX_INTERVAL * 1000LL;
+static long long written_at;
+static LastFix latest;                          // magic 0 until there is one
+
+static int
+slot_valid(const LastFix *f) {
+        return f->magic == LASTFIX_MAGIC && f->crc == crc32_buf(f, offsetof(LastFix, crc));
+}
+
+static void
+slot_write(long long now) {
+        LastFix *slot;
+
+        latest.seq += 1;
+        latest.crc = crc32_buf(&latest, offsetof(LastFix, crc));
+        slot = (LastFix *)(map + (latest.seq & 1) * LASTFIX_SLOT_SIZE);
+        memcpy(slot, &latest, sizeof(latest));
+        msync(map + (latest.seq & 1) * LASTFIX_SLOT_SIZE, LASTFIX_SLOT_SIZE, MS_ASYNC);
+        written_at = now;
+}
+
+/* interval in seconds */
+int
+lastfix_open(const char *path, int interval) {
+        const LastFix *a, *b;
+        int fd;
+        void *p;
+
+        if (map != NULL)
+                return 0;
+
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+                D("Can not open last fix %s, errno = %d", path, errno);
+                return -1;
+        }
+        if (ftruncate(fd, 2 * LASTFIX_SLOT_SIZE) < 0) {
+                D("Can not size last fix, errno = %d", errno);
+                close(fd);
+                return -1;
+        }
+        p = mmap(NULL, 2 * LASTFIX_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+                D("Can not map last fix, errno = %d", errno);
+                return -1;
+        }
+
+        pthread_mutex_lock(&fix_lock);
+        map = p;
+        interval_ms = (interval > 0 ? interval : LASTFIX_INTERVAL) * 1000LL;
+        a = (const LastFix *)map;
+        b = (const LastFix *)(map + LASTFIX_SLOT_SIZE);
+        if (slot_valid(a) && (!slot_valid(b) || (int32_t)(a->seq - b->seq) > 0))
+                latest = *a;
+        else if (slot_valid(b))
+                latest = *b;
+        pthread_mutex_unlock(&fix_lock);
+
+        D("last fix %s: %s", path, latest.magic ? "loaded" : "empty");
+        return 0;
+}
+
+void
+lastfix_close() {
+        pthread_mutex_lock(&fix_lock);
+        if (map != NULL) {
+                munmap(map, 2 * LASTFIX_SLOT_SIZE);
+                map = NULL;
+        }
+        pthread_mutex_unlock(&fix_lock);
+}
+
+/* every new fix, now is the monotonic clock in ms */
+void
+lastfix_update(const GpsLocation *fix, long long now) {
+        struct timespec ts;
+
+        if (!(fix->flags & GPS_LOCATION_HAS_LAT_LONG))
+                return;
+
+        // stamped by the system clock the age is later taken against
+        clock_gettime(CLOCK_REALTIME, &ts);
+        pthread_mutex_lock(&fix_lock);
+        latest.magic = LASTFIX_MAGIC;
+        latest.time = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        latest.latitude = fix->latitude;
+        latest.longitude = fix->longitude;
+        latest.altitude = (fix->flags & GPS_LOCATION_HAS_ALTITUDE) ? fix->altitude : 0;
+        // the reader puts the dop of GSA into accuracy
+        latest.accuracy = LASTFIX_MIN_ACCURACY;
+        if ((fix->flags & GPS_LOCATION_HAS_ACCURACY) && fix->accuracy * LASTFIX_UERE > LASTFIX_MIN_ACCURACY)
+                latest.accuracy = fix->accuracy * LASTFIX_UERE;
+        if (map != NULL && (written_at == 0 || now - written_at >= interval_ms))
+                slot_write(now);
+        pthread_mutex_unlock(&fix_lock);
+}
+
+/* returns 0 with the newest fix, -1 if none is known */
+int
+lastfix_get(LastFix *out) {
+        int ret = -1;
+
+        pthread_mutex_lock(&fix_lock);
+        if (latest.magic == LASTFIX_MAGIC) {
+                *out = latest;
+                ret = 0;
+        }
+        pthread_mutex_unlock(&fix_lock);
+        return ret;
+}
+
+void
+lastfix_clear() {
+        pthread_mutex_lock(&fix_lock);
+        memset(&latest, 0, sizeof(latest));
+        if (map != NULL) {
+                memset(map, 0, 2 * LASTFIX_SLOT_SIZE);
+                msync(map, 2 * LASTFIX_SLOT_SIZE, MS_ASYNC);
+        }
+        written_at = 0;
+        pthread_mutex_unlock(&fix_lock);
+}
@@ -0,0 +1,32 @@
+#ifndef LASTFIX_H
+#define LASTFIX_H
+#include <stdint.h>
+#include <hardware/gps.h>
+
+#define LASTFIX_MAGIC           0x5846534c      // "LSFX"
+#define LASTFIX_SLOT_SIZE       4096            // one page per slot
+#define LASTFIX_INTERVAL        60              // s between writes at most
+#define LASTFIX_UERE            3.0             // m per unit of dop
+#define LASTFIX_MIN_ACCURACY    10.0            // m
+
+/* two slots on their own pages, written in turn. the valid slot with the
+ * higher seq wins, so a write torn by a power cut loses at most the
+ * newest fix.
+ */
+typedef struct {
+        uint32_t                magic;
+        uint32_t                seq;
+        int64_t                 time;           // system utc ms the fix came in
+        double                  latitude;
+        double                  longitude;
+        double                  altitude;
+        float                   accuracy;       // m
+        uint32_t                crc;            // of everything before it
+} LastFix;
+
+int lastfix_open(const char *path, int interval);
+void lastfix_close();
+void lastfix_update(const GpsLocation *fix, long long now);
+int lastfix_get(LastFix *out);
+void lastfix_clear();
+#endif
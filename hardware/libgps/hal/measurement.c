@@ -0,0 +1,156 @@
+/*
+ * raw gnss measurements from CASIC RXM-MEASX.
+ *
+ * the frame is decoded straight from the reader's buffer into a GpsData
+ * that lives for the whole process, so the stream costs no allocation
+ * per epoch.
+ */
+#include <math.h>
+#include <string.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "casic.h"
+#include "measurement.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define SPEED_OF_LIGHT          299792458.0
+#define GPS_L1_FREQ             1575.42e6
+#define GLN_L1_FREQ             1602.0e6
+#define GLN_L1_STEP             0.5625e6
+#define NS_PER_WEEK             604800000000000LL
+
+#define PRN_PLUS_GLN 64
+
+static GpsMeasurementCallbacks meas_callbacks;
+static GpsData meas_data;
+static int meas_active = 0;
+
+int
+measurement_init(GpsMeasurementCallbacks *callbacks) {
+        if (meas_active)
+                return GPS_MEASUREMENT_ERROR_ALREADY_INIT;
+        if (callbacks == NULL || callbacks->measurement_callback == NULL)
+                return GPS_MEASUREMENT_ERROR_GENERIC;
+
+        meas_callbacks = *callbacks;
+        meas_active = 1;
+        D("measurement initialized");
+        return GPS_MEASUREMENT_OPERATION_SUCCESS;
+}
+
+void
+measurement_close() {
+        meas_active = 0;
+        D("measurement closed");
+}
+
+int
+measurement_active() {
+        return meas_active;
+}
+
+static void
+measurement_decode_one(const unsigned char *m, double tow, GpsMeasurement *out) {
+        int gnss     = m[20];
+        int svid     = m[21];
+        int freq_id  = m[23];
+        int locktime = casic_u2(m + 24);
+        int trk      = m[30];
+        double pr    = casic_r8(m);
+        double cp    = casic_r8(m + 8);
+        double dop   = casic_r4(m + 16);
+        double freq, lambda;
+
+        if (gnss == CASIC_GNSS_GLN) {
+                freq = GLN_L1_FREQ + (freq_id - 7) * GLN_L1_STEP;
+                svid += PRN_PLUS_GLN;
+        }
+        else {
+                freq = GPS_L1_FREQ;
+        }
+        lambda = SPEED_OF_LIGHT / freq;
+
+        memset(out, 0, sizeof(*out));
+        out->size = sizeof(GpsMeasurement);
+        out->prn = svid;
+        out->c_n0_dbhz = m[26];
+        out->carrier_frequency_hz = freq;
+        out->flags = GPS_MEASUREMENT_HAS_CARRIER_FREQUENCY
+                     | GPS_MEASUREMENT_HAS_DOPPLER_SHIFT
+                     | GPS_MEASUREMENT_HAS_DOPPLER_SHIFT_UNCERTAINTY;
+        out->doppler_shift_hz = dop;
+        out->doppler_shift_uncertainty_hz = 0.002 * (1 << (m[29] & 0x0F));
+        out->pseudorange_rate_mps = -dop * lambda;
+        out->pseudorange_rate_uncertainty_mps = out->doppler_shift_uncertainty_hz * lambda;
+        out->loss_of_lock = locktime ? GPS_LOSS_OF_LOCK_OK : GPS_LOSS_OF_LOCK_CYCLE_SLIP;
+
+        if (trk & MEASX_TRK_PR_VALID) {
+                out->flags |= GPS_MEASUREMENT_HAS_PSEUDORANGE
+                              | GPS_MEASUREMENT_HAS_PSEUDORANGE_UNCERTAINTY;
+                out->pseudorange_m = pr;
+                out->pseudorange_uncertainty_m = 0.01 * (1 << (m[27] & 0x0F));
+                out->state = GPS_MEASUREMENT_STATE_CODE_LOCK
+                             | GPS_MEASUREMENT_STATE_BIT_SYNC
+                             | GPS_MEASUREMENT_STATE_SUBFRAME_SYNC
+                             | GPS_MEASUREMENT_STATE_TOW_DECODED;
+                out->received_gps_tow_ns = (int64_t)((tow - pr / SPEED_OF_LIGHT) * 1e9);
+        }
+
+        if (trk & MEASX_TRK_CP_VALID) {
+                out->flags |= GPS_MEASUREMENT_HAS_CARRIER_PHASE
+                              | GPS_MEASUREMENT_HAS_CARRIER_PHASE_UNCERTAINTY;
+                out->carrier_phase = cp - floor(cp);
+                out->carrier_phase_uncertainty = 0.004 * m[28];
+                out->accumulated_delta_range_state = GPS_ADR_STATE_VALID;
+                if (!locktime)
+                        out->accumulated_delta_range_state |= GPS_ADR_STATE_RESET;
+                out->accumulated_delta_range_m = cp * lambda;
+                out->accumulated_delta_range_uncertainty_m = out->carrier_phase_uncertainty * lambda;
+        }
+}
+
+void
+measurement_decode_measx(const unsigned char *payload, int len) {
+        double tow;
+        int week, num;
+        int i, n;
+
+        if (!meas_active || len < MEASX_HEAD_SIZE)
+                return;
+
+        tow  = casic_r8(payload);
+        week = casic_u2(payload + 8);
+        num  = payload[11];
+        if (len < MEASX_HEAD_SIZE + num * MEASX_MEAS_SIZE) {
+                D("short RXM-MEASX: %d bytes for %d measurements", len, num);
+                return;
+        }
+
+        meas_data.size = sizeof(GpsData);
+        meas_data.clock.size = sizeof(GpsClock);
+        meas_data.clock.flags = GPS_CLOCK_HAS_LEAP_SECOND;
+        meas_data.clock.type = GPS_CLOCK_TYPE_GPS_TIME;
+        meas_data.clock.leap_second = (int8_t)payload[10];
+        meas_data.clock.time_ns = week * NS_PER_WEEK + (int64_t)(tow * 1e9);
+
+        n = 0;
+        for (i = 0; i < num && n < GPS_MAX_MEASUREMENT; i++) {
+                const unsigned char *m = payload + MEASX_HEAD_SIZE + i * MEASX_MEAS_SIZE;
+                // prn is an int8, bds does not fit the +200 numbering
+                if (m[20] != CASIC_GNSS_GPS && m[20] != CASIC_GNSS_GLN)
+                        continue;
+                measurement_decode_one(m, tow, &meas_data.measurements[n]);
+                n += 1;
+        }
+        meas_data.measurement_count = n;
+
+        meas_callbacks.measurement_callback(&meas_data);
+}
@@ -0,0 +1,9 @@
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+#include <hardware/gps.h>
+
+int measurement_init(GpsMeasurementCallbacks *callbacks);
+void measurement_close();
+int measurement_active();
+void measurement_decode_measx(const unsigned char *payload, int len);
+#endif
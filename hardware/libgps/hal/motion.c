@@ -0,0 +1,225 @@
+/*
+ * stationary detection driving the receiver duty cycle.
+ *
+ * the last MOTION_WINDOW fixes are weighted by 1/hdop^2. a device is still
+ * when they are slow and their weighted rms spread stays inside what the
+ * dop explains; the weighted centroid then becomes the anchor. it is moving
+ * again on speed or once a fix leaves the anchor by more than the dop
+ * allows. still long enough steps full -> reduced -> idle, idle wakes the
+ * receiver every wake period and any motion goes straight back to full, so
+ * a parked asset is picked up again within one wake period plus a hot start.
+ *
+ * pure logic on the reader thread, the caller sends the receiver commands.
+ */
+#include <math.h>
+#include <string.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "motion.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define EARTH_RADIUS            6378137.0
+
+struct motion_sample {
+        double                  lat;
+        double                  lon;
+        double                  w;
+        double                  speed;
+};
+
+static struct {
+        int                     state;
+        struct motion_sample    win[MOTION_WINDOW];
+        int                     n, pos;
+        double                  dop;            // weighted mean dop of the window
+        int                     anchored;
+        double                  anchor_lat;
+        double                  anchor_lon;
+        long long               still_since;    // 0 while moving
+        long long               wake_at;
+        long long               wake_until;
+        int                     wake_fixes;
+        int                     wake_period;
+} m;
+
+static const char *state_name[] = { "full", "reduced", "idle", "wake" };
+
+static double
+dist_m(double lat0, double lon0, double lat1, double lon1) {
+        double dn = (lat1 - lat0) * M_PI / 180.0 * EARTH_RADIUS;
+        double de = (lon1 - lon0) * M_PI / 180.0 * EARTH_RADIUS * cos(lat0 * M_PI / 180.0);
+        return sqrt(dn * dn + de * de);
+}
+
+static double
+fix_dop(double hdop) {
+        // hdop of GGA, the spread checked here is horizontal only
+        if (hdop >= 1.0 && hdop < 99)
+                return hdop;
+        return 1.0;
+}
+
+static double
+move_radius(double dop) {
+        double r = 4 * MOTION_UERE * dop;
+        return r > MOTION_MIN_RADIUS ? r : MOTION_MIN_RADIUS;
+}
+
+static void
+window_clear() {
+        m.n = 0;
+        m.pos = 0;
+        m.anchored = 0;
+        m.still_since = 0;
+}
+
+/* weighted centroid of the window, returns 1 if the window looks still */
+static int
+window_still(double *clat, double *clon) {
+        double sw = 0, lat = 0, lon = 0, sp = 0, dop = 0, rms = 0;
+        int i;
+
+        if (m.n < MOTION_WINDOW)
+                return 0;
+        for (i = 0; i < m.n; i++) {
+                sw  += m.win[i].w;
+                lat += m.win[i].w * m.win[i].lat;
+                lon += m.win[i].w * m.win[i].lon;
+                sp  += m.win[i].w * m.win[i].speed;
+                dop += sqrt(m.win[i].w);        // w * dop
+        }
+        lat /= sw;
+        lon /= sw;
+        sp /= sw;
+        m.dop = dop / sw;
+        for (i = 0; i < m.n; i++) {
+                double d = dist_m(lat, lon, m.win[i].lat, m.win[i].lon);
+                rms += m.win[i].w * d * d;
+        }
+        rms = sqrt(rms / sw);
+
+        *clat = lat;
+        *clon = lon;
+        return sp < MOTION_STILL_SPEED &&
+               rms < (MOTION_UERE * m.dop > MOTION_MIN_SPREAD ? MOTION_UERE * m.dop : MOTION_MIN_SPREAD);
+}
+
+static int
+set_state(int state, long long now) {
+        D("duty %s -> %s", state_name[m.state], state_name[state]);
+        m.state = state;
+        switch (state) {
+        case DUTY_FULL:
+                window_clear();
+                break;
+        case DUTY_IDLE:
+                m.wake_at = now + m.wake_period;
+                break;
+        case DUTY_WAKE:
+                m.wake_until = now + MOTION_WAKE_WINDOW;
+                m.wake_fixes = 0;
+                break;
+        }
+        return state;
+}
+
+void
+motion_reset(int wake_period) {
+        memset(&m, 0, sizeof(m));
+        m.state = DUTY_FULL;
+        m.wake_period = wake_period > 0 ? wake_period : MOTION_WAKE_PERIOD;
+}
+
+int
+motion_state() {
+        return m.state;
+}
+
+/* feed each new fix, returns the new duty state or -1 if unchanged */
+int
+motion_update(const GpsLocation *fix, double hdop, long long now) {
+        double dop, clat, clon;
+        int moving, still;
+
+        if (!(fix->flags & GPS_LOCATION_HAS_LAT_LONG) || m.state == DUTY_IDLE)
+                return -1;
+
+        dop = fix_dop(hdop);
+        moving = ((fix->flags & GPS_LOCATION_HAS_SPEED) && fix->speed > MOTION_MOVE_SPEED) ||
+                 (m.anchored && dist_m(m.anchor_lat, m.anchor_lon, fix->latitude, fix->longitude) > move_radius(dop));
+
+        if (m.state == DUTY_WAKE) {
+                if (moving)
+                        return set_state(DUTY_FULL, now);
+                if (++m.wake_fixes >= MOTION_WAKE_FIXES)
+                        return set_state(DUTY_IDLE, now);
+                return -1;
+        }
+
+        if (moving) {
+                if (m.state != DUTY_FULL)
+                        return set_state(DUTY_FULL, now);
+                window_clear();
+        }
+
+        m.win[m.pos].lat = fix->latitude;
+        m.win[m.pos].lon = fix->longitude;
+        m.win[m.pos].w = 1.0 / (dop * dop);
+        m.win[m.pos].speed = (fix->flags & GPS_LOCATION_HAS_SPEED) ? fix->speed : 0;
+        m.pos = (m.pos + 1) % MOTION_WINDOW;
+        if (m.n < MOTION_WINDOW)
+                m.n += 1;
+
+        still = window_still(&clat, &clon);
+        if (!still) {
+                // reduced keeps its anchor, only motion against it counts there
+                if (m.state == DUTY_FULL)
+                        m.still_since = 0;
+                return -1;
+        }
+        if (m.still_since == 0) {
+                m.still_since = now;
+                m.anchored = 1;
+                m.anchor_lat = clat;
+                m.anchor_lon = clon;
+        }
+
+        if (m.state == DUTY_FULL && now - m.still_since >= MOTION_REDUCED_AFTER)
+                return set_state(DUTY_REDUCED, now);
+        if (m.state == DUTY_REDUCED && now - m.still_since >= MOTION_IDLE_AFTER)
+                return set_state(DUTY_IDLE, now);
+        return -1;
+}
+
+/* call when motion_timeout() expires */
+int
+motion_tick(long long now) {
+        if (m.state == DUTY_IDLE && now >= m.wake_at)
+                return set_state(DUTY_WAKE, now);
+        // no fix in the window, try again next period
+        if (m.state == DUTY_WAKE && now >= m.wake_until)
+                return set_state(DUTY_IDLE, now);
+        return -1;
+}
+
+/* ms until motion_tick() is due, -1 for none */
+int
+motion_timeout(long long now) {
+        long long t;
+
+        if (m.state == DUTY_IDLE)
+                t = m.wake_at - now;
+        else if (m.state == DUTY_WAKE)
+                t = m.wake_until - now;
+        else
+                return -1;
+        return t > 0 ? (int)t : 0;
+}
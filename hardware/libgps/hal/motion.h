@@ -0,0 +1,31 @@
+#ifndef MOTION_H
+#define MOTION_H
+#include <hardware/gps.h>
+
+/* receiver duty states */
+enum {
+        DUTY_FULL = 0,          // every fix
+        DUTY_REDUCED,           // sentences every MOTION_REDUCED_EVERY fixes
+        DUTY_IDLE,              // receiver idle, woken every wake period
+        DUTY_WAKE,              // awake from idle, checking for motion
+};
+
+#define MOTION_WINDOW           10              // fixes in the stillness window
+#define MOTION_STILL_SPEED      0.5             // m/s
+#define MOTION_MOVE_SPEED       1.5             // m/s
+#define MOTION_UERE             3.0             // m per unit of hdop
+#define MOTION_MIN_SPREAD       5.0             // m, rms below this is still whatever the dop
+#define MOTION_MIN_RADIUS       15.0            // m, smallest displacement taken as motion
+#define MOTION_REDUCED_AFTER    60000           // ms still before reducing the rate
+#define MOTION_IDLE_AFTER       300000          // ms still before idling the receiver
+#define MOTION_WAKE_PERIOD      600000          // ms between wake ups while idle
+#define MOTION_WAKE_WINDOW      60000           // ms awake at most per wake up
+#define MOTION_WAKE_FIXES       3               // still fixes that send it back to idle
+#define MOTION_REDUCED_EVERY    5
+
+void motion_reset(int wake_period);
+int motion_state();
+int motion_update(const GpsLocation *fix, double hdop, long long now);
+int motion_tick(long long now);
+int motion_timeout(long long now);
+#endif
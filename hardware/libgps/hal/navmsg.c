@@ -0,0 +1,106 @@
+/*
+ * navigation message (subframe) output from CASIC RXM-SFRBX.
+ *
+ * GPS L1 C/A subframes are forwarded to the framework, and with SUPL built
+ * in every subframe is also handed to the ephemeris decoder in subframe.c.
+ */
+#include <string.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "casic.h"
+#include "navmsg.h"
+#if SUPL_ENABLED
+#include "subframe.h"
+#endif
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define GPS_SUBFRAME_BYTES      (SFRBX_MAX_WORDS * 4)
+
+static GpsNavigationMessageCallbacks navmsg_callbacks;
+static GpsNavigationMessage navmsg_msg;
+static uint8_t navmsg_data[GPS_SUBFRAME_BYTES];
+static int navmsg_enabled = 0;
+
+int
+navmsg_init(GpsNavigationMessageCallbacks *callbacks) {
+        if (navmsg_enabled)
+                return GPS_NAVIGATION_MESSAGE_ERROR_ALREADY_INIT;
+        if (callbacks == NULL || callbacks->navigation_message_callback == NULL)
+                return GPS_NAVIGATION_MESSAGE_ERROR_GENERIC;
+
+        navmsg_callbacks = *callbacks;
+        navmsg_enabled = 1;
+        D("navigation message initialized");
+        return GPS_NAVIGATION_MESSAGE_OPERATION_SUCCESS;
+}
+
+void
+navmsg_close() {
+        navmsg_enabled = 0;
+        D("navigation message closed");
+}
+
+int
+navmsg_active() {
+        return navmsg_enabled;
+}
+
+/* words go out msb first, 4 bytes each, the 30 bits right aligned */
+static void
+navmsg_report_gps(int prn, const unsigned int *words) {
+        int i, id, tow;
+
+        for (i = 0; i < SFRBX_MAX_WORDS; i++) {
+                navmsg_data[i * 4]     = (words[i] >> 24) & 0xFF;
+                navmsg_data[i * 4 + 1] = (words[i] >> 16) & 0xFF;
+                navmsg_data[i * 4 + 2] = (words[i] >> 8) & 0xFF;
+                navmsg_data[i * 4 + 3] = words[i] & 0xFF;
+        }
+        tow = (words[1] >> 13) & 0x1FFFF;       // how: tow count of the next subframe
+        id  = (words[1] >> 8) & 0x07;
+
+        navmsg_msg.size = sizeof(GpsNavigationMessage);
+        navmsg_msg.prn = prn;
+        navmsg_msg.type = GPS_NAVIGATION_MESSAGE_TYPE_L1CA;
+        navmsg_msg.status = NAV_MESSAGE_STATUS_PARITY_PASSED;
+        navmsg_msg.message_id = id;
+        navmsg_msg.submessage_id = (id == 4 || id == 5) ? ((tow - 1) / 5) % 25 + 1 : 0;
+        navmsg_msg.data_length = GPS_SUBFRAME_BYTES;
+        navmsg_msg.data = navmsg_data;
+
+        navmsg_callbacks.navigation_message_callback(&navmsg_msg);
+}
+
+void
+navmsg_decode_sfrbx(const unsigned char *payload, int len) {
+        unsigned int words[SFRBX_MAX_WORDS];
+        int gnss, svid, nwords;
+        int i;
+
+        if (len < SFRBX_HEAD_SIZE)
+                return;
+
+        gnss   = payload[0];
+        svid   = payload[1];
+        nwords = payload[4];
+        if (nwords > SFRBX_MAX_WORDS || len < SFRBX_HEAD_SIZE + nwords * 4)
+                return;
+
+        for (i = 0; i < nwords; i++)
+                words[i] = casic_u4(payload + SFRBX_HEAD_SIZE + i * 4);
+
+#if SUPL_ENABLED
+        subframe_decode(gnss, svid, words, nwords);
+#endif
+
+        if (navmsg_enabled && gnss == CASIC_GNSS_GPS && nwords == SFRBX_MAX_WORDS)
+                navmsg_report_gps(svid, words);
+}
@@ -0,0 +1,9 @@
+#ifndef NAVMSG_H
+#define NAVMSG_H
+#include <hardware/gps.h>
+
+int navmsg_init(GpsNavigationMessageCallbacks *callbacks);
+void navmsg_close();
+int navmsg_active();
+void navmsg_decode_sfrbx(const unsigned char *payload, int len);
+#endif
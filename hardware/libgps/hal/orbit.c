@@ -0,0 +1,99 @@
+/*
+ * where the satellites of a set of ephemerides stand in the sky.
+ *
+ * the broadcast orbit (IS-GPS-200 table 20-IV) from the RRLP scaled fields,
+ * without clock terms: a few hundred metres along the orbit do not move an
+ * elevation that only orders aid. the observer frame is set up once and
+ * every ephemeris goes through the same loop.
+ */
+#include <math.h>
+
+#include "orbit.h"
+
+#define GM                      3.986005e14     // m^3/s^2
+#define OMEGA_E                 7.2921151467e-5 // rad/s
+#define WGS84_A                 6378137.0
+#define WGS84_E2                6.69437999014e-3
+#define PI                      3.1415926535898 // as the ICD has it
+#define HALF_WEEK               302400
+#define KEPLER_ITER             10
+
+/* satellite ecef at time of week tow, 0 if the ephemeris is not usable */
+static int
+orbit_ecef(const struct supl_ephemeris_s *e, double tow, double *p) {
+        double A, n, tk, M, E, Ek, v, phi, s2, c2, u, r, i, x, y, O;
+        double ecc = e->e * pow(2.0, -33);
+        double sqrta = e->A_sqrt * pow(2.0, -19);
+        double toe = e->toe * 16.0;
+        int k;
+
+        if (sqrta < 1000 || ecc >= 0.1)
+                return 0;
+        A = sqrta * sqrta;
+        tk = tow - toe;
+        if (tk > HALF_WEEK)
+                tk -= 2 * HALF_WEEK;
+        else if (tk < -HALF_WEEK)
+                tk += 2 * HALF_WEEK;
+
+        n = sqrt(GM / (A * A * A)) + (int16_t)e->delta_n * pow(2.0, -43) * PI;
+        M = e->M0 * pow(2.0, -31) * PI + n * tk;
+        E = M;
+        for (k = 0; k < KEPLER_ITER; k++) {
+                Ek = E;
+                E = M + ecc * sin(Ek);
+                if (fabs(E - Ek) < 1e-12)
+                        break;
+        }
+        v = atan2(sqrt(1 - ecc * ecc) * sin(E), cos(E) - ecc);
+        phi = v + e->w * pow(2.0, -31) * PI;
+        s2 = sin(2 * phi);
+        c2 = cos(2 * phi);
+        u = phi + e->Cus * pow(2.0, -29) * s2 + e->Cuc * pow(2.0, -29) * c2;
+        r = A * (1 - ecc * cos(E)) + e->Crs * pow(2.0, -5) * s2 + e->Crc * pow(2.0, -5) * c2;
+        i = e->i0 * pow(2.0, -31) * PI + e->i_dot * pow(2.0, -43) * PI * tk +
+            e->Cis * pow(2.0, -29) * s2 + e->Cic * pow(2.0, -29) * c2;
+        x = r * cos(u);
+        y = r * sin(u);
+        O = e->OMEGA_0 * pow(2.0, -31) * PI + (e->OMEGA_dot * pow(2.0, -43) * PI - OMEGA_E) * tk - OMEGA_E * toe;
+
+        p[0] = x * cos(O) - y * cos(i) * sin(O);
+        p[1] = x * sin(O) + y * cos(i) * cos(O);
+        p[2] = y * sin(i);
+        return 1;
+}
+
+/* elevation and azimuth in degrees of n ephemerides at gps time of week tow
+ * (s), seen from lat, lon (deg) and alt (m). ORBIT_NONE for one that does not
+ * propagate.
+ */
+void
+orbit_look(const struct supl_ephemeris_s *eph, int n, double tow,
+           double lat, double lon, double alt, double *el, double *az) {
+        double sp = sin(lat * PI / 180), cp = cos(lat * PI / 180);
+        double sl = sin(lon * PI / 180), cl = cos(lon * PI / 180);
+        double N = WGS84_A / sqrt(1 - WGS84_E2 * sp * sp);
+        double o[3], p[3], d[3], east, north, up;
+        int k;
+
+        o[0] = (N + alt) * cp * cl;
+        o[1] = (N + alt) * cp * sl;
+        o[2] = (N * (1 - WGS84_E2) + alt) * sp;
+
+        for (k = 0; k < n; k++) {
+                el[k] = ORBIT_NONE;
+                az[k] = 0;
+                if (!orbit_ecef(&eph[k], tow, p))
+                        continue;
+                d[0] = p[0] - o[0];
+                d[1] = p[1] - o[1];
+                d[2] = p[2] - o[2];
+                east = -sl * d[0] + cl * d[1];
+                north = -sp * cl * d[0] - sp * sl * d[1] + cp * d[2];
+                up = cp * cl * d[0] + cp * sl * d[1] + sp * d[2];
+                el[k] = atan2(up, sqrt(east * east + north * north)) * 180 / PI;
+                az[k] = atan2(east, north) * 180 / PI;
+                if (az[k] < 0)
+                        az[k] += 360;
+        }
+}
@@ -0,0 +1,9 @@
+#ifndef ORBIT_H
+#define ORBIT_H
+#include "supl.h"
+
+#define ORBIT_NONE              -90.0           // elevation of an ephemeris that does not propagate
+
+void orbit_look(const struct supl_ephemeris_s *eph, int n, double tow,
+                double lat, double lon, double alt, double *el, double *az);
+#endif
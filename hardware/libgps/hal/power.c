@@ -0,0 +1,199 @@
+/*
+ * receiver power states and time to first fix per start type.
+ *
+ * a stop leaves the receiver powered in standby (idle, see gps_state_stop)
+ * so a start within the hold time is a hot start. only when the hold time
+ * runs out is the main supply cut, leaving the backup domain with rtc and
+ * ephemeris for a warm start. off is the state before the first start and
+ * after cleanup; a start from there counts as cold.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "power.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static const char *state_name[] = { "off", "backup", "standby", "active" };
+static const char *start_name[] = { "cold", "warm", "hot" };
+
+static pthread_mutex_t power_lock = PTHREAD_MUTEX_INITIALIZER;
+static int state = POWER_OFF;
+static long long hold_ms = POWER_HOLD * 1000LL;
+static long long standby_until;
+static long long start_ms;
+static int start_type;
+static int forced_type = -1;
+static int waiting_fix;
+static TtffStats ttff[START_TYPES];
+
+static void
+power_line( int on )
+{
+        int fd = open( "/proc/gps", O_RDWR );
+        if ( fd <= 0 ) {
+                D( "/proc/gps open faild, errno %d\r\n", errno );
+                return;
+        }
+        write( fd, on ? "1" : "0", 1 );
+        close( fd );
+}
+
+static void
+set_state(int to) {
+        D("power %s -> %s", state_name[state], state_name[to]);
+        state = to;
+}
+
+/* hold in seconds, 0 cuts the supply on every stop */
+void
+power_init(int hold) {
+        pthread_mutex_lock(&power_lock);
+        hold_ms = hold >= 0 ? hold * 1000LL : POWER_HOLD * 1000LL;
+        pthread_mutex_unlock(&power_lock);
+}
+
+int
+power_state() {
+        return state;
+}
+
+/* returns the start type */
+int
+power_start(long long now) {
+        int type;
+
+        pthread_mutex_lock(&power_lock);
+        if (state == POWER_STANDBY || state == POWER_ACTIVE)
+                type = START_HOT;
+        else if (state == POWER_BACKUP)
+                type = START_WARM;
+        else
+                type = START_COLD;
+        // a restart asked for can make the start colder, never warmer
+        if (forced_type >= 0 && forced_type < type)
+                type = forced_type;
+        forced_type = -1;
+
+        if (state == POWER_OFF || state == POWER_BACKUP)
+                power_line(1);
+        set_state(POWER_ACTIVE);
+        start_ms = now;
+        start_type = type;
+        waiting_fix = 1;
+        pthread_mutex_unlock(&power_lock);
+
+        D("%s start", start_name[type]);
+        return type;
+}
+
+void
+power_stop(long long now) {
+        pthread_mutex_lock(&power_lock);
+        if (state == POWER_ACTIVE) {
+                if (waiting_fix)
+                        D("%s start stopped before the first fix", start_name[start_type]);
+                waiting_fix = 0;
+                if (hold_ms > 0) {
+                        standby_until = now + hold_ms;
+                        set_state(POWER_STANDBY);
+                } else {
+                        power_line(0);
+                        set_state(POWER_BACKUP);
+                }
+        }
+        pthread_mutex_unlock(&power_lock);
+}
+
+void
+power_off() {
+        pthread_mutex_lock(&power_lock);
+        if (state != POWER_OFF) {
+                power_line(0);
+                set_state(POWER_OFF);
+        }
+        waiting_fix = 0;
+        pthread_mutex_unlock(&power_lock);
+}
+
+/* ms until power_tick() is due, -1 for none */
+int
+power_timeout(long long now) {
+        long long t;
+
+        pthread_mutex_lock(&power_lock);
+        if (state == POWER_STANDBY)
+                t = standby_until > now ? standby_until - now : 0;
+        else
+                t = -1;
+        pthread_mutex_unlock(&power_lock);
+        return t > 0x7FFFFFFF ? 0x7FFFFFFF : (int)t;
+}
+
+void
+power_tick(long long now) {
+        if (state != POWER_STANDBY)
+                return;
+        pthread_mutex_lock(&power_lock);
+        if (state == POWER_STANDBY && now >= standby_until) {
+                power_line(0);
+                set_state(POWER_BACKUP);
+        }
+        pthread_mutex_unlock(&power_lock);
+}
+
+/* every new fix, the first one after a start is its ttff */
+void
+power_fix(long long now) {
+        TtffStats *s;
+        long long t;
+
+        if (!waiting_fix)
+                return;
+        pthread_mutex_lock(&power_lock);
+        if (waiting_fix) {
+                waiting_fix = 0;
+                t = now - start_ms;
+                s = &ttff[start_type];
+                if (s->count == 0 || t < s->min)
+                        s->min = t;
+                if (t > s->max)
+                        s->max = t;
+                s->sum += t;
+                s->last = t;
+                s->count += 1;
+                D("ttff %s %lld ms, %d starts, mean %lld min %lld max %lld",
+                  start_name[start_type], t, s->count, s->sum / s->count, s->min, s->max);
+        }
+        pthread_mutex_unlock(&power_lock);
+}
+
+/* the next start is of this type whatever the state, after aiding was deleted */
+void
+power_force_start_type(int type) {
+        pthread_mutex_lock(&power_lock);
+        if (forced_type < 0 || type < forced_type)
+                forced_type = type;
+        pthread_mutex_unlock(&power_lock);
+}
+
+void
+power_ttff_stats(int type, TtffStats *stats) {
+        pthread_mutex_lock(&power_lock);
+        if (type >= 0 && type < START_TYPES)
+                *stats = ttff[type];
+        else
+                memset(stats, 0, sizeof(*stats));
+        pthread_mutex_unlock(&power_lock);
+}
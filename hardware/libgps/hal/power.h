@@ -0,0 +1,40 @@
+#ifndef POWER_H
+#define POWER_H
+
+/* receiver power states */
+enum {
+        POWER_OFF = 0,          // never powered, or cleaned up
+        POWER_BACKUP,           // main supply cut, backup domain keeps rtc and ephemeris
+        POWER_STANDBY,          // powered and idle, everything retained
+        POWER_ACTIVE,
+};
+
+/* start types, by what the receiver kept */
+enum {
+        START_COLD = 0,
+        START_WARM,
+        START_HOT,
+        START_TYPES,
+};
+
+#define POWER_HOLD              300             // s in standby before cutting power
+
+typedef struct {
+        int                     count;
+        long long               sum;            // ms
+        long long               min;
+        long long               max;
+        long long               last;
+} TtffStats;
+
+void power_init(int hold);
+int power_state();
+int power_start(long long now);
+void power_stop(long long now);
+void power_off();
+int power_timeout(long long now);
+void power_tick(long long now);
+void power_fix(long long now);
+void power_force_start_type(int type);
+void power_ttff_stats(int type, TtffStats *stats);
+#endif
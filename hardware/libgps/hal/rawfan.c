@@ -0,0 +1,271 @@
+/*
+ * raw receiver stream fan-out.
+ *
+ * the reader thread appends every chunk it reads from the tty to one shared
+ * ring, once, after the chunk was parsed. each subscriber is only a cursor
+ * into that ring, its backlog bounded by RAWFAN_CLIENT_BACKLOG, and is sent
+ * straight from the ring with a gathering non-blocking send. a subscriber
+ * that falls further behind skips ahead to the live stream and the skipped
+ * bytes are counted as dropped; nothing here ever blocks the reader thread.
+ *
+ * everything runs on the reader thread, from its epoll loop.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "rawfan.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define RING_MASK       (RAWFAN_RING_SIZE - 1)
+
+struct rawfan_client {
+        int                     fd;
+        int                     armed;          // EPOLLOUT registered
+        unsigned long long      pos;            // next byte to send
+        unsigned long long      dropped;
+};
+
+static unsigned char ring[RAWFAN_RING_SIZE];
+static unsigned long long head = 0;             // total bytes ever pushed
+static struct rawfan_client clients[RAWFAN_MAX_CLIENTS];
+static int nclients = 0;
+static int listen_fd = -1;
+static int efd = -1;
+static char sock_path[108];
+
+static void
+client_watch(struct rawfan_client *c, int out) {
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+        ev.data.fd = c->fd;
+        epoll_ctl(efd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->armed = out;
+}
+
+static void
+client_close(struct rawfan_client *c) {
+        D("raw client %d gone, %llu bytes dropped", c->fd, c->dropped);
+        epoll_ctl(efd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        *c = clients[--nclients];
+}
+
+/* returns -1 if the client was closed */
+static int
+client_flush(struct rawfan_client *c) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        unsigned long long lag;
+        int off, n;
+
+        lag = head - c->pos;
+        if (lag > RAWFAN_CLIENT_BACKLOG) {
+                c->dropped += lag;
+                c->pos = head;
+                return 0;
+        }
+
+        while (c->pos < head) {
+                off = c->pos & RING_MASK;
+                n = head - c->pos;
+                iov[0].iov_base = ring + off;
+                iov[0].iov_len  = n < RAWFAN_RING_SIZE - off ? n : RAWFAN_RING_SIZE - off;
+                iov[1].iov_base = ring;
+                iov[1].iov_len  = n - iov[0].iov_len;
+
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+                n = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                if (!c->armed)
+                                        client_watch(c, 1);
+                                return 0;
+                        }
+                        client_close(c);
+                        return -1;
+                }
+                c->pos += n;
+        }
+
+        if (c->armed)
+                client_watch(c, 0);
+        return 0;
+}
+
+static void
+rawfan_accept() {
+        struct epoll_event ev;
+        struct rawfan_client *c;
+        int fd;
+
+        for (;;) {
+                fd = accept(listen_fd, NULL, NULL);
+                if (fd < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return;
+                }
+                if (nclients >= RAWFAN_MAX_CLIENTS) {
+                        D("too many raw clients, refusing %d", fd);
+                        close(fd);
+                        continue;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                        close(fd);
+                        continue;
+                }
+
+                // subscribers join the live stream
+                c = &clients[nclients++];
+                c->fd = fd;
+                c->armed = 0;
+                c->pos = head;
+                c->dropped = 0;
+                D("raw client %d attached, %d total", fd, nclients);
+        }
+}
+
+int
+rawfan_open(const char *path, int epoll_fd) {
+        struct sockaddr_un addr;
+        struct epoll_event ev;
+
+        if (listen_fd >= 0)
+                return 0;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+                D("Can not create raw stream socket, errno = %d", errno);
+                return -1;
+        }
+        unlink(addr.sun_path);
+        if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) {
+                D("Can not listen on %s, errno = %d", addr.sun_path, errno);
+                close(listen_fd);
+                listen_fd = -1;
+                return -1;
+        }
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+        ev.events = EPOLLIN;
+        ev.data.fd = listen_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+                close(listen_fd);
+                listen_fd = -1;
+                unlink(addr.sun_path);
+                return -1;
+        }
+
+        efd = epoll_fd;
+        strcpy(sock_path, addr.sun_path);
+        D("raw stream on %s", sock_path);
+        return 0;
+}
+
+void
+rawfan_close() {
+        if (listen_fd < 0)
+                return;
+
+        while (nclients > 0)
+                client_close(&clients[0]);
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(sock_path);
+}
+
+/* epoll events for our fds, returns 0 if fd is not ours */
+int
+rawfan_handle(int fd, unsigned int events) {
+        struct rawfan_client *c = NULL;
+        char discard[64];
+        int i, n;
+
+        if (listen_fd < 0)
+                return 0;
+        if (fd == listen_fd) {
+                rawfan_accept();
+                return 1;
+        }
+
+        for (i = 0; i < nclients; i++) {
+                if (clients[i].fd == fd) {
+                        c = &clients[i];
+                        break;
+                }
+        }
+        if (c == NULL)
+                return 0;
+
+        if (events & (EPOLLERR | EPOLLHUP)) {
+                client_close(c);
+                return 1;
+        }
+        if (events & EPOLLIN) {
+                // subscribers only listen, anything they send is dropped
+                do {
+                        n = read(fd, discard, sizeof(discard));
+                } while (n < 0 && errno == EINTR);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        client_close(c);
+                        return 1;
+                }
+        }
+        if (events & EPOLLOUT)
+                client_flush(c);
+        return 1;
+}
+
+void
+rawfan_push(const unsigned char *data, int n) {
+        int i, off, len;
+
+        if (nclients == 0 || n <= 0)
+                return;
+
+        if (n > RAWFAN_RING_SIZE) {
+                head += n - RAWFAN_RING_SIZE;
+                data += n - RAWFAN_RING_SIZE;
+                n = RAWFAN_RING_SIZE;
+        }
+        off = head & RING_MASK;
+        len = n < RAWFAN_RING_SIZE - off ? n : RAWFAN_RING_SIZE - off;
+        memcpy(ring + off, data, len);
+        memcpy(ring, data + len, n - len);
+        head += n;
+
+        // client_flush may close and compact, walk backwards
+        for (i = nclients - 1; i >= 0; i--) {
+                if (!clients[i].armed)
+                        client_flush(&clients[i]);
+        }
+}
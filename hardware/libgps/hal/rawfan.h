@@ -0,0 +1,12 @@
+#ifndef RAWFAN_H
+#define RAWFAN_H
+
+#define RAWFAN_RING_SIZE        (64 * 1024)     // shared ring, power of two
+#define RAWFAN_CLIENT_BACKLOG   (32 * 1024)     // bytes a client may lag before dropping
+#define RAWFAN_MAX_CLIENTS      8
+
+int rawfan_open(const char *path, int epoll_fd);
+void rawfan_close();
+int rawfan_handle(int fd, unsigned int events);
+void rawfan_push(const unsigned char *data, int n);
+#endif
@@ -0,0 +1,165 @@
+/*
+ * the receiver's ephemerides as the HAL knows them, so only what it lacks
+ * goes over the uart.
+ *
+ * a MSG-GPSEPH poll without payload has the receiver send back every GPS
+ * ephemeris it holds, invalid ones flagged; each injection is taken as held
+ * too, until the aid queue reports it lost. nothing from before a start is trusted: the receiver may have lost
+ * its backup domain, so the model is emptied there and filled again by the
+ * next poll.
+ */
+#include <pthread.h>
+#include <string.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "aidq.h"
+#include "rxaid.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define EPH_MSG_SIZE            (sizeof(GPS_FIX_EPHEMERIS_STR) + CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE)
+#define TOE_SPAN                (1024L * (604800 / 16))        // 16 s units in 1024 weeks
+#define ALL_SVIDS               ((unsigned int)((1ULL << MAX_EPHEMERIS) - 1))
+
+static pthread_mutex_t rx_lock = PTHREAD_MUTEX_INITIALIZER;
+static RxEph rx_eph[MAX_EPHEMERIS];
+static unsigned int answered;                   // svids the last poll got back
+static int skipped;
+
+/* toe as 16 s units since the week rollover, the week taken mod 1024 */
+static long
+toe_time(int wne, int toe) {
+        return (long)(wne & 1023) * (604800 / 16) + toe;
+}
+
+/* 1 if a is not older than b, across the week rollover */
+static int
+toe_not_older(const RxEph *a, const GPS_FIX_EPHEMERIS_STR *b) {
+        long d = toe_time(a->wne, a->toe) - toe_time(b->kepler.wne, b->kepler.toe);
+
+        return (d >= 0 && d < TOE_SPAN / 2) || d < -TOE_SPAN / 2;
+}
+
+void
+rxaid_reset() {
+        pthread_mutex_lock(&rx_lock);
+        memset(rx_eph, 0, sizeof(rx_eph));
+        pthread_mutex_unlock(&rx_lock);
+}
+
+/* through the aid queue, a poll written into a frame cut short would be lost */
+int
+rxaid_poll(int fd, long long now) {
+        unsigned char frame[CASIC_HEAD_SIZE + CASIC_CKSUM_SIZE];
+        int none = 0;
+
+        pthread_mutex_lock(&rx_lock);
+        answered = 0;
+        pthread_mutex_unlock(&rx_lock);
+        return aidq_cmd(fd, frame, cas_make_msg(ID_RXM_GPS_EPH, &none, 0, frame), now);
+}
+
+/* ms the answer to a poll takes on the line at bps, with some slack */
+int
+rxaid_poll_ms(int bps) {
+        return MAX_EPHEMERIS * EPH_MSG_SIZE * 10 * 1000 / bps + RXAID_POLL_SLACK;
+}
+
+/* a MSG-GPSEPH from the receiver, returns 1 once every svid has answered the poll */
+int
+rxaid_update(const unsigned char *payload, int len) {
+        GPS_FIX_EPHEMERIS_STR eph;
+        RxEph *r;
+        int done;
+
+        if (len < (int)sizeof(eph))
+                return 0;
+        memcpy(&eph, payload, sizeof(eph));
+        if (eph.svid < 1 || eph.svid > MAX_EPHEMERIS)
+                return 0;
+
+        pthread_mutex_lock(&rx_lock);
+        r = &rx_eph[eph.svid - 1];
+        r->held = eph.valid == NAVIGATION_MESSAGE_AVAILABLE;
+        r->iodc = eph.iodc;
+        r->toe = eph.kepler.toe;
+        r->wne = eph.kepler.wne;
+        done = answered != ALL_SVIDS;
+        answered |= 1U << (eph.svid - 1);
+        done = done && answered == ALL_SVIDS;
+        pthread_mutex_unlock(&rx_lock);
+        return done;
+}
+
+/* 1 if the receiver lacks eph or holds an older issue, counts the rest */
+int
+rxaid_wanted(const GPS_FIX_EPHEMERIS_STR *eph) {
+        const RxEph *r;
+        int wanted = 1;
+
+        if (eph->svid < 1 || eph->svid > MAX_EPHEMERIS)
+                return 1;
+
+        pthread_mutex_lock(&rx_lock);
+        r = &rx_eph[eph->svid - 1];
+        if (r->held && ((r->iodc & 0xFF) == (eph->iodc & 0xFF) || toe_not_older(r, eph))) {
+                wanted = 0;
+                skipped += 1;
+        }
+        pthread_mutex_unlock(&rx_lock);
+        return wanted;
+}
+
+void
+rxaid_sent(const GPS_FIX_EPHEMERIS_STR *eph) {
+        RxEph *r;
+
+        if (eph->svid < 1 || eph->svid > MAX_EPHEMERIS)
+                return;
+
+        pthread_mutex_lock(&rx_lock);
+        r = &rx_eph[eph->svid - 1];
+        r->held = 1;
+        r->iodc = eph->iodc;
+        r->toe = eph->kepler.toe;
+        r->wne = eph->kepler.wne;
+        pthread_mutex_unlock(&rx_lock);
+}
+
+/* a MSG-GPSEPH frame the receiver did not take, what it holds is unknown again */
+void
+rxaid_lost(const unsigned char *frame, int len) {
+        GPS_FIX_EPHEMERIS_STR eph;
+        RxEph *r;
+
+        if (len < CASIC_HEAD_SIZE + (int)sizeof(eph) || casic_u2(frame + 4) != ID_RXM_GPS_EPH)
+                return;
+        memcpy(&eph, frame + CASIC_HEAD_SIZE, sizeof(eph));
+        if (eph.svid < 1 || eph.svid > MAX_EPHEMERIS)
+                return;
+
+        pthread_mutex_lock(&rx_lock);
+        r = &rx_eph[eph.svid - 1];
+        // a poll answer since may have told otherwise
+        if (r->held && r->iodc == eph.iodc && r->toe == eph.kepler.toe)
+                r->held = 0;
+        pthread_mutex_unlock(&rx_lock);
+}
+
+/* ephemerides left out and the uart bytes that saved */
+void
+rxaid_stats(int *n, int *bytes, int reset) {
+        pthread_mutex_lock(&rx_lock);
+        *n = skipped;
+        *bytes = skipped * EPH_MSG_SIZE;
+        if (reset)
+                skipped = 0;
+        pthread_mutex_unlock(&rx_lock);
+}
@@ -0,0 +1,23 @@
+#ifndef RXAID_H
+#define RXAID_H
+#include "casaid.h"
+
+#define RXAID_POLL_SLACK        300             // ms on top of the line time of a poll answer
+
+/* what the receiver is known to hold, by poll reply or by injection */
+typedef struct {
+        int                     held;
+        unsigned short          iodc;
+        unsigned short          toe;            // 16 s
+        unsigned short          wne;            // mod 1024
+} RxEph;
+
+void rxaid_reset();
+int rxaid_poll(int fd, long long now);
+int rxaid_poll_ms(int bps);
+int rxaid_update(const unsigned char *payload, int len);
+int rxaid_wanted(const GPS_FIX_EPHEMERIS_STR *eph);
+void rxaid_sent(const GPS_FIX_EPHEMERIS_STR *eph);
+void rxaid_lost(const unsigned char *frame, int len);
+void rxaid_stats(int *skipped, int *bytes, int reset);
+#endif
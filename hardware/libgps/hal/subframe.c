@@ -0,0 +1,263 @@
+/*
+ * broadcast ephemeris from the receiver's subframe output.
+ *
+ * GPS LNAV and BDS D1 subframes 1-3 are collected per satellite and, once a
+ * consistent set is complete, decoded into the same raw integer layout the
+ * RRLP navigation model uses, so the aid path can hand them back to the
+ * receiver after a power cycle without asking the network.
+ *
+ * words are expected parity checked, information bits in the upper bits of
+ * each 30 bit word. BDS GEO satellites (D2) spread their ephemeris over ten
+ * pages and are not decoded here.
+ */
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "casic.h"
+#include "subframe.h"
+
+#define GPS_SF_BYTES    30      // 10 words * 24 bits
+#define BDS_SF_BYTES    28      // 26 + 9 words * 22 bits
+#define BDS_GEO_MAX     5
+
+struct gps_sf_s {
+        int                     have;           // bit n: subframe n+1
+        unsigned char           sf[3][GPS_SF_BYTES];
+        int                     week;
+        time_t                  stamp;
+        struct supl_ephemeris_s eph;
+};
+
+struct bds_sf_s {
+        int                     have;
+        unsigned char           sf[3][BDS_SF_BYTES];
+        time_t                  stamp;
+        struct supl_bds_ephemeris_s eph;
+};
+
+static pthread_mutex_t sf_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct gps_sf_s gps_sf[SUBFRAME_GPS_MAX + 1];
+static struct bds_sf_s bds_sf[SUBFRAME_BDS_MAX + 1];
+
+static unsigned int
+getbitu(const unsigned char *buff, int pos, int len) {
+        unsigned int bits = 0;
+        int i;
+        for (i = pos; i < pos + len; i++)
+                bits = (bits << 1) | ((buff[i / 8] >> (7 - i % 8)) & 1u);
+        return bits;
+}
+
+static int
+getbits(const unsigned char *buff, int pos, int len) {
+        unsigned int bits = getbitu(buff, pos, len);
+        if (len <= 0 || len >= 32 || !(bits & (1u << (len - 1))))
+                return (int)bits;
+        return (int)(bits | (~0u << len));
+}
+
+static void
+setbitu(unsigned char *buff, int pos, int len, unsigned int data) {
+        unsigned int mask = 1u << (len - 1);
+        int i;
+        for (i = pos; i < pos + len; i++, mask >>= 1) {
+                if (data & mask)
+                        buff[i / 8] |= 1u << (7 - i % 8);
+                else
+                        buff[i / 8] &= ~(1u << (7 - i % 8));
+        }
+}
+
+static void
+gps_decode_eph(struct gps_sf_s *g, int prn) {
+        const unsigned char *sf1 = g->sf[0], *sf2 = g->sf[1], *sf3 = g->sf[2];
+        struct supl_ephemeris_s *e = &g->eph;
+        unsigned int iodc = (getbitu(sf1, 70, 2) << 8) | getbitu(sf1, 168, 8);
+
+        // one issue of data across the three subframes
+        if (getbitu(sf2, 48, 8) != (iodc & 0xFF) || getbitu(sf3, 216, 8) != (iodc & 0xFF))
+                return;
+
+        memset(e, 0, sizeof(*e));
+        e->prn          = prn;
+        e->bits         = getbitu(sf1, 58, 2);
+        e->ura          = getbitu(sf1, 60, 4);
+        e->health       = getbitu(sf1, 64, 6);
+        e->IODC         = iodc;
+        e->tgd          = getbits(sf1, 160, 8);
+        e->toc          = getbitu(sf1, 176, 16);
+        e->AF2          = getbits(sf1, 192, 8);
+        e->AF1          = getbits(sf1, 200, 16);
+        e->AF0          = getbits(sf1, 216, 22);
+
+        e->Crs          = getbits(sf2, 56, 16);
+        e->delta_n      = getbits(sf2, 72, 16);
+        e->M0           = getbits(sf2, 88, 32);
+        e->Cuc          = getbits(sf2, 120, 16);
+        e->e            = getbitu(sf2, 136, 32);
+        e->Cus          = getbits(sf2, 168, 16);
+        e->A_sqrt       = getbitu(sf2, 184, 32);
+        e->toe          = getbitu(sf2, 216, 16);
+        e->fit          = getbitu(sf2, 232, 1);
+        e->AODA         = getbitu(sf2, 233, 5);
+
+        e->Cic          = getbits(sf3, 48, 16);
+        e->OMEGA_0      = getbits(sf3, 64, 32);
+        e->Cis          = getbits(sf3, 96, 16);
+        e->i0           = getbits(sf3, 112, 32);
+        e->Crc          = getbits(sf3, 144, 16);
+        e->w            = getbits(sf3, 160, 32);
+        e->OMEGA_dot    = getbits(sf3, 192, 24);
+        e->i_dot        = getbits(sf3, 224, 14);
+        e->nav_model    = 1;
+
+        g->week  = getbitu(sf1, 48, 10);
+        g->stamp = time(NULL);
+}
+
+static void
+gps_subframe(int prn, const unsigned int *words) {
+        struct gps_sf_s *g = &gps_sf[prn];
+        unsigned char buff[GPS_SF_BYTES];
+        int i, id;
+
+        for (i = 0; i < 10; i++)
+                setbitu(buff, i * 24, 24, (words[i] >> 6) & 0xFFFFFF);
+
+        id = getbitu(buff, 43, 3);
+        if (id < 1 || id > 3)
+                return;
+
+        memcpy(g->sf[id - 1], buff, GPS_SF_BYTES);
+        g->have |= 1 << (id - 1);
+        if (g->have == 0x07) {
+                gps_decode_eph(g, prn);
+                g->have = 0;
+        }
+}
+
+static void
+bds_decode_eph(struct bds_sf_s *b, int prn) {
+        const unsigned char *sf1 = b->sf[0], *sf2 = b->sf[1], *sf3 = b->sf[2];
+        struct supl_bds_ephemeris_s *e = &b->eph;
+        unsigned int sow = getbitu(sf1, 18, 20);
+
+        // subframes 1-3 of the same frame
+        if (getbitu(sf2, 18, 20) != sow + 6 || getbitu(sf3, 18, 20) != sow + 12)
+                return;
+
+        memset(e, 0, sizeof(*e));
+        e->prn          = prn;
+        e->health       = getbitu(sf1, 38, 1);
+        e->aodc         = getbitu(sf1, 39, 5);
+        e->urai         = getbitu(sf1, 44, 4);
+        e->week         = getbitu(sf1, 48, 13);
+        e->toc          = getbitu(sf1, 61, 17);
+        e->tgd1         = getbits(sf1, 78, 10);
+        e->AF2          = getbits(sf1, 162, 11);
+        e->AF0          = getbits(sf1, 173, 24);
+        e->AF1          = getbits(sf1, 197, 22);
+        e->aode         = getbitu(sf1, 219, 5);
+
+        e->delta_n      = getbits(sf2, 38, 16);
+        e->Cuc          = getbits(sf2, 54, 18);
+        e->M0           = getbits(sf2, 72, 32);
+        e->e            = getbitu(sf2, 104, 32);
+        e->Cus          = getbits(sf2, 136, 18);
+        e->Crc          = getbits(sf2, 154, 18);
+        e->Crs          = getbits(sf2, 172, 18);
+        e->A_sqrt       = getbitu(sf2, 190, 32);
+        e->toe          = (getbitu(sf2, 222, 2) << 15) | getbitu(sf3, 38, 15);
+
+        e->i0           = getbits(sf3, 53, 32);
+        e->Cic          = getbits(sf3, 85, 18);
+        e->OMEGA_dot    = getbits(sf3, 103, 24);
+        e->Cis          = getbits(sf3, 127, 18);
+        e->i_dot        = getbits(sf3, 145, 14);
+        e->OMEGA_0      = getbits(sf3, 159, 32);
+        e->w            = getbits(sf3, 191, 32);
+
+        b->stamp = time(NULL);
+}
+
+static void
+bds_subframe(int prn, const unsigned int *words) {
+        struct bds_sf_s *b = &bds_sf[prn];
+        unsigned char buff[BDS_SF_BYTES];
+        int i, id;
+
+        setbitu(buff, 0, 26, (words[0] >> 4) & 0x3FFFFFF);
+        for (i = 1; i < 10; i++)
+                setbitu(buff, 26 + (i - 1) * 22, 22, (words[i] >> 8) & 0x3FFFFF);
+
+        id = getbitu(buff, 15, 3);
+        if (id < 1 || id > 3)
+                return;
+
+        memcpy(b->sf[id - 1], buff, BDS_SF_BYTES);
+        b->have |= 1 << (id - 1);
+        if (b->have == 0x07) {
+                bds_decode_eph(b, prn);
+                b->have = 0;
+        }
+}
+
+void
+subframe_decode(int gnss, int svid, const unsigned int *words, int nwords) {
+        if (nwords < 10)
+                return;
+
+        pthread_mutex_lock(&sf_lock);
+        if (gnss == CASIC_GNSS_GPS && svid >= 1 && svid <= SUBFRAME_GPS_MAX)
+                gps_subframe(svid, words);
+        else if (gnss == CASIC_GNSS_BDS && svid > BDS_GEO_MAX && svid <= SUBFRAME_BDS_MAX)
+                bds_subframe(svid, words);
+        pthread_mutex_unlock(&sf_lock);
+}
+
+/* copy out the ephemerides decoded within SUBFRAME_EPH_VALID */
+int
+subframe_gps_eph(struct supl_ephemeris_s *eph, int *week, int max) {
+        time_t now = time(NULL);
+        int prn, n = 0;
+
+        pthread_mutex_lock(&sf_lock);
+        for (prn = 1; prn <= SUBFRAME_GPS_MAX && n < max; prn++) {
+                struct gps_sf_s *g = &gps_sf[prn];
+                if (g->stamp == 0 || now - g->stamp > SUBFRAME_EPH_VALID)
+                        continue;
+                eph[n] = g->eph;
+                week[n] = g->week;
+                n += 1;
+        }
+        pthread_mutex_unlock(&sf_lock);
+
+        return n;
+}
+
+int
+subframe_bds_eph(struct supl_bds_ephemeris_s *eph, int max) {
+        time_t now = time(NULL);
+        int prn, n = 0;
+
+        pthread_mutex_lock(&sf_lock);
+        for (prn = 1; prn <= SUBFRAME_BDS_MAX && n < max; prn++) {
+                struct bds_sf_s *b = &bds_sf[prn];
+                if (b->stamp == 0 || now - b->stamp > SUBFRAME_EPH_VALID)
+                        continue;
+                eph[n++] = b->eph;
+        }
+        pthread_mutex_unlock(&sf_lock);
+
+        return n;
+}
+
+/* forget everything decoded so far */
+void
+subframe_clear() {
+        pthread_mutex_lock(&sf_lock);
+        memset(gps_sf, 0, sizeof(gps_sf));
+        memset(bds_sf, 0, sizeof(bds_sf));
+        pthread_mutex_unlock(&sf_lock);
+}
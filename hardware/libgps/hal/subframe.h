@@ -0,0 +1,13 @@
+#ifndef SUBFRAME_H
+#define SUBFRAME_H
+#include "supl.h"
+
+#define SUBFRAME_GPS_MAX        32
+#define SUBFRAME_BDS_MAX        63
+#define SUBFRAME_EPH_VALID      (4 * 3600)      // seconds an ephemeris from the sky is reused
+
+void subframe_decode(int gnss, int svid, const unsigned int *words, int nwords);
+int subframe_gps_eph(struct supl_ephemeris_s *eph, int *week, int max);
+int subframe_bds_eph(struct supl_bds_ephemeris_s *eph, int max);
+void subframe_clear();
+#endif
@@ -13,9 +13,15 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <arpa/inet.h>
 #include <openssl/crypto.h>
 #include <openssl/x509.h>
 #include <openssl/pem.h>
@@ -45,12 +51,12 @@ static struct supl_debug_s {
 #define D(f, ...) ((void)0)
 #endif
 
-static int server_connect(char *server, char *port);
 static int pdu_make_ulp_start(supl_ctx_t *ctx, supl_ulp_t *pdu);
 static int pdu_make_ulp_pos_init(supl_ctx_t *ctx, supl_ulp_t *pdu);
 static int pdu_make_ulp_rrlp_ack(supl_ctx_t *ctx, supl_ulp_t *pdu, PDU_t *rrlp);
 static int supl_more_rrlp(PDU_t *rrlp);
 static int supl_response_harvest(supl_ctx_t *ctx, supl_ulp_t *pdu);
+static void session_end(supl_ctx_t *ctx);
 
 int EXPORT supl_ulp_decode(supl_ulp_t *pdu) {
         ULP_PDU_t *ulp;
@@ -230,80 +236,240 @@ int EXPORT supl_decode_rrlp(supl_ulp_t *ulp_pdu, PDU_t **ret_rrlp) {
         return E_SUPL_INTERNAL;
 }
 
-int EXPORT supl_server_connect(supl_ctx_t *ctx, char *server, char *port) {
-        int err;
-        const SSL_METHOD *meth;
+/*
+** TLS context and session cache
+**
+** one SSL_CTX for the process. the sessions (or tickets) the SLPs hand out
+** are kept per host and offered again on the next connect, which saves the
+** key exchange and a round trip. with supl_set_tls_cache() they survive a
+** restart of the HAL as well.
+*/
 
-        SSLeay_add_ssl_algorithms();
-        meth = TLSv1_client_method();
-        //meth = SSLv23_client_method();
-        SSL_load_error_strings();
-        ctx->ssl_ctx = SSL_CTX_new(meth);
-        if (!ctx->ssl_ctx) return E_SUPL_CONNECT;
+#define SUPL_TLS_HOSTS 4
+#define SUPL_TLS_MAGIC 0x534c5453 /* STLS */
+
+static struct supl_tls_s {
+        SSL_CTX *ctx;
+        char path[128];
+        struct supl_tls_host_s {
+                char host[64];
+                char port[8];
+                SSL_SESSION *sess;
+                time_t used;
+        } host[SUPL_TLS_HOSTS];
+        int full, resumed;
+        long long full_ms, resumed_ms;
+} tls;
+
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t tls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int write_all(int fd, const void *buf, size_t len) {
+        const char *p = buf;
+        ssize_t n;
+
+        while (len > 0) {
+                n = write(fd, p, len);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return -1;
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
 
-        ctx->ssl = SSL_new(ctx->ssl_ctx);
-        if (!ctx->ssl) return E_SUPL_CONNECT;
+static void tls_save(void) {
+        unsigned char *der, *p;
+        unsigned int len;
+        char tmp[sizeof(tls.path) + 4];
+        int i, fd, err = 0;
+        unsigned int magic = SUPL_TLS_MAGIC;
+
+        if (!tls.path[0]) return;
+
+        // the sessions carry the master secrets, keep the file private
+        snprintf(tmp, sizeof(tmp), "%s.tmp", tls.path);
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) return;
+
+        err |= write_all(fd, &magic, sizeof(magic));
+        for (i = 0; i < SUPL_TLS_HOSTS && !err; i++) {
+                if (!tls.host[i].sess) continue;
+                len = i2d_SSL_SESSION(tls.host[i].sess, 0);
+                if ((int)len <= 0 || !(der = malloc(len))) continue;
+                p = der;
+                i2d_SSL_SESSION(tls.host[i].sess, &p);
+                err |= write_all(fd, tls.host[i].host, sizeof(tls.host[i].host));
+                err |= write_all(fd, tls.host[i].port, sizeof(tls.host[i].port));
+                err |= write_all(fd, &len, sizeof(len));
+                err |= write_all(fd, der, len);
+                free(der);
+        }
+        // a short file must not replace the last good one
+        if (close(fd) < 0) err = -1;
+        if (err) {
+                unlink(tmp);
+                return;
+        }
+        rename(tmp, tls.path);
+}
 
-        if (server) {
-                ctx->fd = server_connect(server, port);
-                if (ctx->fd == -1) return E_SUPL_CONNECT;
+static void tls_load(void) {
+        struct supl_tls_host_s *h;
+        const unsigned char *p;
+        unsigned char *der;
+        unsigned int magic, len;
+        SSL_SESSION *sess;
+        int i, fd;
+
+        fd = open(tls.path, O_RDONLY);
+        if (fd < 0) return;
+        if (read(fd, &magic, sizeof(magic)) != sizeof(magic) || magic != SUPL_TLS_MAGIC) {
+                close(fd);
+                return;
+        }
+        for (i = 0; i < SUPL_TLS_HOSTS; ) {
+                h = &tls.host[i];
+                if (read(fd, h->host, sizeof(h->host)) != sizeof(h->host) ||
+                                read(fd, h->port, sizeof(h->port)) != sizeof(h->port) ||
+                                read(fd, &len, sizeof(len)) != sizeof(len) || len > 16384)
+                        break;
+                if (!(der = malloc(len))) break;
+                if (read(fd, der, len) != (int)len) {
+                        free(der);
+                        break;
+                }
+                p = der;
+                sess = d2i_SSL_SESSION(0, &p, len);
+                free(der);
+                h->host[sizeof(h->host) - 1] = 0;
+                h->port[sizeof(h->port) - 1] = 0;
+                if (!sess) continue;
+                if (SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) < time(0)) {
+                        SSL_SESSION_free(sess);
+                        continue;
+                }
+                h->sess = sess;
+                h->used = time(0);
+                D("tls session for %s:%s", h->host, h->port);
+                i++;
         }
+        for (; i < SUPL_TLS_HOSTS; i++) memset(&tls.host[i], 0, sizeof(tls.host[i]));
+        close(fd);
+}
 
-        SSL_set_fd(ctx->ssl, ctx->fd);
-        err = SSL_connect(ctx->ssl);
-        if (err == -1) return E_SUPL_CONNECT;
+/* a new session from the server, a TLS 1.3 ticket may come after the handshake */
+static int tls_new_session(SSL *ssl, SSL_SESSION *sess) {
+        struct supl_tls_host_s *h = SSL_get_app_data(ssl);
 
-#if 0
-        {
-                X509 *s_cert = SSL_get_peer_certificate(ctx->ssl);
-                FILE *fp = fopen("/tmp/s_cert.pem", "w");
-                if (fp)
-                        PEM_write_X509(fp, s_cert);
-                fclose(fp);
-                X509_free(s_cert);
-        }
-#endif
+        if (!h) return 0;
 
-        return 0;
+        pthread_mutex_lock(&tls_lock);
+        if (h->sess) SSL_SESSION_free(h->sess);
+        h->sess = sess;
+        h->used = time(0);
+        tls_save();
+        pthread_mutex_unlock(&tls_lock);
+
+        return 1;
 }
 
-void EXPORT supl_close(supl_ctx_t *ctx) {
-        SSL_shutdown(ctx->ssl);
-        SSL_free(ctx->ssl);
-        SSL_CTX_free(ctx->ssl_ctx);
-        close(ctx->fd);
+static void tls_init(void) {
+        SSL_library_init();
+        SSL_load_error_strings();
+
+        // the highest version both sides have, nothing older than TLS 1.0
+        tls.ctx = SSL_CTX_new(SSLv23_client_method());
+        if (!tls.ctx) return;
+        SSL_CTX_set_options(tls.ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+        SSL_CTX_set_session_cache_mode(tls.ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(tls.ctx, tls_new_session);
 }
 
+static SSL_CTX *tls_ctx(void) {
+        pthread_once(&tls_once, tls_init);
 
-static int server_connect(char *server, char *port) {
-        int fd = -1;
-        struct addrinfo *ailist, *aip;
-        struct addrinfo hint;
-        int err;
+        return tls.ctx;
+}
 
-        memset(&hint, 0, sizeof(struct addrinfo));
-        hint.ai_socktype = SOCK_STREAM;
-        if (port == NULL) {
-                port = SUPL_PORT;
+/* offer the session kept for the host, the slot follows the connection */
+static void tls_attach(SSL *ssl, const char *server, const char *port) {
+        struct supl_tls_host_s *h = 0;
+        struct in6_addr addr;
+        int i;
+
+        if (!server) return;
+        if (!port) port = SUPL_PORT;
+        // no server name indication for an address literal
+        if (inet_pton(AF_INET, server, &addr) != 1 && inet_pton(AF_INET6, server, &addr) != 1)
+                SSL_set_tlsext_host_name(ssl, (char *)server);
+
+        pthread_mutex_lock(&tls_lock);
+        for (i = 0; i < SUPL_TLS_HOSTS; i++) {
+                if (!strcmp(tls.host[i].host, server) && !strcmp(tls.host[i].port, port)) {
+                        h = &tls.host[i];
+                        break;
+                }
+                if (!h || tls.host[i].used < h->used) h = &tls.host[i];
         }
-        err = getaddrinfo(server, port, &hint, &ailist);
-        if (err != 0) {
-                return -1;
+        if (strcmp(h->host, server) || strcmp(h->port, port)) {
+                // least recently used
+                if (h->sess) SSL_SESSION_free(h->sess);
+                memset(h, 0, sizeof(*h));
+                snprintf(h->host, sizeof(h->host), "%s", server);
+                snprintf(h->port, sizeof(h->port), "%s", port);
         }
+        h->used = time(0);
+        if (h->sess) SSL_set_session(ssl, h->sess);
+        SSL_set_app_data(ssl, h);
+        pthread_mutex_unlock(&tls_lock);
+}
 
-        for (aip = ailist; aip; aip = aip->ai_next) {
-                if ((fd = socket(aip->ai_family, SOCK_STREAM, 0)) < 0) {
-                        err = errno;
-                }
-                if (connect(fd, aip->ai_addr, aip->ai_addrlen) != 0) {
-                        return -1;
-                }
-                break;
+/* a session the server chokes on is not offered again */
+static void tls_forget(SSL *ssl) {
+        struct supl_tls_host_s *h = SSL_get_app_data(ssl);
+
+        if (!h) return;
+        pthread_mutex_lock(&tls_lock);
+        if (h->sess) {
+                D("dropping tls session for %s", h->host);
+                SSL_SESSION_free(h->sess);
+                h->sess = 0;
+                tls_save();
         }
+        pthread_mutex_unlock(&tls_lock);
+}
+
+static void tls_account(SSL *ssl, long long ms) {
+        int resumed = SSL_session_reused(ssl);
+
+        pthread_mutex_lock(&tls_lock);
+        if (resumed) {
+                tls.resumed++;
+                tls.resumed_ms += ms;
+        } else {
+                tls.full++;
+                tls.full_ms += ms;
+        }
+        D("tls handshake %lld ms %s, full %d mean %lld ms, resumed %d mean %lld ms", ms, resumed ? "resumed" : "full",
+          tls.full, tls.full ? tls.full_ms / tls.full : 0, tls.resumed, tls.resumed ? tls.resumed_ms / tls.resumed : 0);
+        pthread_mutex_unlock(&tls_lock);
+}
 
-        return fd;
+/* keep the TLS sessions in a file across restarts */
+void EXPORT supl_set_tls_cache(const char *path) {
+        pthread_mutex_lock(&tls_lock);
+        snprintf(tls.path, sizeof(tls.path), "%s", path);
+        tls_load();
+        pthread_mutex_unlock(&tls_lock);
 }
 
+void EXPORT supl_close(supl_ctx_t *ctx) {
+        session_end(ctx);
+        ctx->state = SUPL_STATE_IDLE;
+}
+
+
 static void ulp_fill_tracking_area_code(TrackingAreaCode_t *tac, int tac_value) {
         tac->buf = calloc(2, 1);
         tac->size = 2;
@@ -448,6 +614,74 @@ static int supl_response_harvest(supl_ctx_t *ctx, supl_ulp_t *pdu) {
         return 0;
 }
 
+/*
+** the ephemerides held, the server leaves out those still current
+*/
+static XNavigationModel_t *pdu_make_nav_data(supl_ctx_t *ctx) {
+        XNavigationModel_t *nav;
+        int i;
+
+        nav = calloc(1, sizeof(XNavigationModel_t));
+        nav->gpsWeek = ctx->p.nav.week;
+        nav->gpsToe = ctx->p.nav.toe;
+        nav->nSAT = ctx->p.nav.n < 31 ? ctx->p.nav.n : 31;
+        nav->toeLimit = SUPL_TOE_LIMIT;
+        nav->satInfo = calloc(1, sizeof(SatelliteInfo_t));
+        for (i = 0; i < nav->nSAT; i++) {
+                SatelliteInfoElement_t *sat = calloc(1, sizeof(SatelliteInfoElement_t));
+
+                sat->satId = ctx->p.nav.sat[i].prn - 1;
+                sat->iODE = ctx->p.nav.sat[i].iode;
+                ASN_SEQUENCE_ADD(&nav->satInfo->list, sat);
+        }
+
+        return nav;
+}
+
+/*
+** GANSS assistance for what supl_request() asked for: the SET names the
+** constellation among its methods and RRLP as new enough to carry it
+*/
+static GanssReqGenericData_t *pdu_add_ganss(SUPLPOSINIT_t *init, RequestedAssistData_t *req_adata, int id, int signals) {
+        PosTechnology_t *tech = &init->sETCapabilities.posTechnology;
+        PosProtocol_t *proto = &init->sETCapabilities.posProtocol;
+        XGANSSPositionMethod_t *method;
+        GanssReqGenericData_t *gen;
+
+        if (!tech->ver2_PosTechnology_extension) {
+                tech->ver2_PosTechnology_extension = calloc(1, sizeof(Ver2_PosTechnology_extension_t));
+                tech->ver2_PosTechnology_extension->gANSSPositionMethods = calloc(1, sizeof(XGANSSPositionMethods_t));
+        }
+        method = calloc(1, sizeof(XGANSSPositionMethod_t));
+        method->ganssId = id;
+        method->gANSSPositioningMethodTypes.setBased = 1;
+        method->gANSSPositioningMethodTypes.autonomous = 1;
+        method->gANSSSignals.buf = calloc(1, 1);
+        method->gANSSSignals.buf[0] = signals;
+        method->gANSSSignals.size = 1;
+        ASN_SEQUENCE_ADD(&tech->ver2_PosTechnology_extension->gANSSPositionMethods->list, method);
+
+        if (!proto->ver2_PosProtocol_extension) {
+                proto->ver2_PosProtocol_extension = calloc(1, sizeof(Ver2_PosProtocol_extension_t));
+                proto->ver2_PosProtocol_extension->posProtocolVersionRRLP = calloc(1, sizeof(PosProtocolVersion3GPP_t));
+                proto->ver2_PosProtocol_extension->posProtocolVersionRRLP->majorVersionField = SUPL_RRLP_GANSS_VERSION;
+        }
+
+        if (!req_adata->ver2_RequestedAssistData_extension) {
+                req_adata->ver2_RequestedAssistData_extension = calloc(1, sizeof(Ver2_RequestedAssistData_extension_t));
+                req_adata->ver2_RequestedAssistData_extension->ganssRequestedCommonAssistanceDataList = calloc(1, sizeof(GanssRequestedCommonAssistanceDataList_t));
+                req_adata->ver2_RequestedAssistData_extension->ganssRequestedGenericAssistanceDataList = calloc(1, sizeof(GanssRequestedGenericAssistanceDataList_t));
+        }
+        gen = calloc(1, sizeof(GanssReqGenericData_t));
+        gen->ganssId = id;
+        gen->ganssUTCModel = 1;
+        // its presence asks for the model, with no satellites listed all of it comes
+        gen->ganssNavigationModelData = calloc(1, sizeof(GanssNavigationModelData_t));
+        ASN_SEQUENCE_ADD(&req_adata->ver2_RequestedAssistData_extension->ganssRequestedGenericAssistanceDataList->list, gen);
+
+        return gen;
+}
+
 static int pdu_make_ulp_pos_init(supl_ctx_t *ctx, supl_ulp_t *pdu) {
         int err;
         ULP_PDU_t *ulp;
@@ -487,13 +721,35 @@ static int pdu_make_ulp_pos_init(supl_ctx_t *ctx, supl_ulp_t *pdu) {
         req_adata->acquisitionAssistanceRequested = 1; // 1
         req_adata->navigationModelRequested = 1; // 1
         req_adata->referenceTimeRequested = 1;
-        req_adata->utcModelRequested = 1; //1
-        req_adata->ionosphericModelRequested = 1; // 1
+        req_adata->utcModelRequested = !(ctx->p.have & SUPL_RRLP_ASSIST_UTC); //1
+        req_adata->ionosphericModelRequested = !(ctx->p.have & SUPL_RRLP_ASSIST_IONO); // 1
+        if (ctx->p.nav.n > 0)
+                req_adata->navigationModelData = pdu_make_nav_data(ctx);
         req_adata->referenceLocationRequested = 1;
         req_adata->almanacRequested = 0; //ctx->p.request & SUPL_REQUEST_ALMANAC;
         req_adata->realTimeIntegrityRequested = 1; // 1
         ulp->message.choice.msSUPLPOSINIT.requestedAssistData = req_adata;
 
+        if (ctx->p.request & SUPL_REQUEST_BDS) {
+                pdu_add_ganss(&ulp->message.choice.msSUPLPOSINIT, req_adata, SUPL_GANSS_BDS, SUPL_SIGNAL_BDS_B1I);
+                // BDS broadcasts a Klobuchar model of its own, RRLP carries it as the additional one
+                req_adata->ver2_RequestedAssistData_extension->ganssRequestedCommonAssistanceDataList->ganssAdditionalIonosphericModelForDataID11 = 1;
+        }
+        if (ctx->p.request & SUPL_REQUEST_GLONASS) {
+                GanssReqGenericData_t *gen;
+
+                gen = pdu_add_ganss(&ulp->message.choice.msSUPLPOSINIT, req_adata, SUPL_GANSS_GLONASS, SUPL_SIGNAL_GLONASS_G1);
+                // the frequency channels, from the almanac failing the auxiliary information
+                gen->ganssAlmanac = 1;
+                gen->ganssAuxiliaryInformation = 1;
+                gen->ganssUTCModel = 0;
+                // GLONASS time against the GPS reference time
+                gen->ganssTimeModels = calloc(1, sizeof(BIT_STRING_t));
+                gen->ganssTimeModels->buf = calloc(1, 2);
+                gen->ganssTimeModels->buf[0] = SUPL_TIME_MODEL_GPS;
+                gen->ganssTimeModels->size = 2;
+        }
+
         if (ctx->p.set & PARAM_GSM_CELL_CURRENT) {
                 ulp->message.choice.msSUPLPOSINIT.locationId.cellInfo.present = CellInfo_PR_gsmCell;
                 ulp->message.choice.msSUPLPOSINIT.locationId.cellInfo.choice.gsmCell.refMCC = ctx->p.gsm.mcc;
@@ -626,11 +882,231 @@ static int pdu_make_ulp_rrlp_ack(supl_ctx_t *ctx, supl_ulp_t *pdu, PDU_t *rrlp)
 **
 */
 
+static void collect_bds_nav(supl_assist_t *assist, GANSSNavModel_t *nav) {
+        int n;
+
+        for (n = 0; n < nav->ganssSatelliteList.list.count; n++) {
+                GANSSSatelliteElement_t *e = nav->ganssSatelliteList.list.array[n];
+                NavModel_BDSKeplerianSet_r12_t *k;
+                BDSClockModel_r12_t *c;
+                struct supl_bds_ephemeris_s *eph;
+
+                if (e->ganssOrbitModel.present != GANSSOrbitModel_PR_bdsKeplerianSet_r12) continue;
+                if (e->ganssClockModel.present != GANSSClockModel_PR_bdsClockModel_r12) continue;
+                if (assist->bds.cnt_eph >= MAX_BDS_EPHEMERIS) break;
+                k = &e->ganssOrbitModel.choice.bdsKeplerianSet_r12;
+                c = &e->ganssClockModel.choice.bdsClockModel_r12;
+                eph = &assist->bds.eph[assist->bds.cnt_eph++];
+
+                memset(eph, 0, sizeof(*eph));
+                eph->prn = e->svID + 1;
+                /* SatH1, the first bit */
+                eph->health = e->svHealth.size > 0 && (e->svHealth.buf[0] & 0x80);
+                eph->aode = e->iod & 0x1f;
+                eph->aodc = e->iod & 0x1f;
+                eph->urai = k->bdsURAI_r12;
+                eph->toe = k->bdsToe_r12;
+                eph->A_sqrt = k->bdsAPowerHalf_r12;
+                eph->e = k->bdsE_r12;
+                eph->w = k->bdsW_r12;
+                eph->delta_n = k->bdsDeltaN_r12;
+                eph->M0 = k->bdsM0_r12;
+                eph->OMEGA_0 = k->bdsOmega0_r12;
+                eph->OMEGA_dot = k->bdsOmegaDot_r12;
+                eph->i0 = k->bdsI0_r12;
+                eph->i_dot = k->bdsIDot_r12;
+                eph->Cuc = k->bdsCuc_r12;
+                eph->Cus = k->bdsCus_r12;
+                eph->Crc = k->bdsCrc_r12;
+                eph->Crs = k->bdsCrs_r12;
+                eph->Cic = k->bdsCic_r12;
+                eph->Cis = k->bdsCis_r12;
+                eph->toc = c->bdsToc_r12;
+                eph->AF0 = c->bdsA0_r12;
+                eph->AF1 = c->bdsA1_r12;
+                eph->AF2 = c->bdsA2_r12;
+                eph->tgd1 = c->bdsTgd1_r12;
+        }
+        if (assist->bds.cnt_eph > 0) assist->set |= SUPL_RRLP_ASSIST_BDS_EPH;
+}
+
+static void collect_glo_nav(supl_assist_t *assist, GANSSNavModel_t *nav) {
+        int n;
+
+        for (n = 0; n < nav->ganssSatelliteList.list.count; n++) {
+                GANSSSatelliteElement_t *e = nav->ganssSatelliteList.list.array[n];
+                NavModel_GLONASSecef_t *o;
+                GLONASSclockModel_t *c;
+                struct supl_glo_ephemeris_s *eph;
+
+                if (e->ganssOrbitModel.present != GANSSOrbitModel_PR_glonassECEF) continue;
+                if (e->ganssClockModel.present != GANSSClockModel_PR_glonassClockModel) continue;
+                if (assist->glo.cnt_eph >= MAX_GLO_EPHEMERIS) break;
+                o = &e->ganssOrbitModel.choice.glonassECEF;
+                c = &e->ganssClockModel.choice.glonassClockModel;
+                eph = &assist->glo.eph[assist->glo.cnt_eph++];
+
+                memset(eph, 0, sizeof(*eph));
+                eph->slot = e->svID + 1;
+                eph->freq = SUPL_GLO_FREQ_NONE;
+                /* Bn then FT */
+                if (e->svHealth.size > 0) {
+                        eph->health = (e->svHealth.buf[0] >> 7) & 1;
+                        eph->ft = (e->svHealth.buf[0] >> 3) & 0xf;
+                }
+                /* tb in the low 7 bits */
+                eph->tb = e->iod & 0x7f;
+                eph->en = o->gloEn;
+                eph->p1 = o->gloP1.size > 0 ? o->gloP1.buf[0] >> 6 : 0;
+                eph->p2 = o->gloP2 ? 1 : 0;
+                eph->m = o->gloM;
+                eph->x = o->gloX;
+                eph->y = o->gloY;
+                eph->z = o->gloZ;
+                eph->vx = o->gloXdot;
+                eph->vy = o->gloYdot;
+                eph->vz = o->gloZdot;
+                eph->ax = o->gloXdotdot;
+                eph->ay = o->gloYdotdot;
+                eph->az = o->gloZdotdot;
+                eph->tau = c->gloTau;
+                eph->gamma = c->gloGamma;
+                eph->dtau = c->gloDeltaTau ? *c->gloDeltaTau : 0;
+        }
+        if (assist->glo.cnt_eph > 0) assist->set |= SUPL_RRLP_ASSIST_GLO_EPH;
+}
+
+static void collect_glo_alm(supl_assist_t *assist, GANSSAlmanacModel_t *alm) {
+        int n;
+
+        for (n = 0; n < alm->ganssAlmanacList.list.count; n++) {
+                GANSSAlmanacElement_t *e = alm->ganssAlmanacList.list.array[n];
+                Almanac_GlonassAlmanacSet_t *g;
+                struct supl_glo_almanac_s *a;
+
+                if (e->present != GANSSAlmanacElement_PR_keplerianGLONASS) continue;
+                if (assist->glo.cnt_alm >= MAX_GLO_EPHEMERIS) break;
+                g = &e->choice.keplerianGLONASS;
+                a = &assist->glo.alm[assist->glo.cnt_alm++];
+
+                a->na = g->gloAlmNA;
+                a->slot = g->gloAlmnA;
+                a->ha = g->gloAlmHA;
+                a->lambda = g->gloAlmLambdaA;
+                a->tlambda = g->gloAlmtlambdaA;
+                a->delta_i = g->gloAlmDeltaIa;
+                a->delta_t = g->gloAlmDeltaTA;
+                a->delta_tdot = g->gloAlmDeltaTdotA;
+                a->epsilon = g->gloAlmEpsilonA;
+                a->omega = g->gloAlmOmegaA;
+                a->tau = g->gloAlmTauA;
+                a->c = g->gloAlmCA;
+                a->m = g->gloAlmMA && g->gloAlmMA->size > 0 ? g->gloAlmMA->buf[0] >> 6 : 0;
+        }
+        if (assist->glo.cnt_alm > 0) assist->set |= SUPL_RRLP_ASSIST_GLO_ALM;
+}
+
+/* the frequency channel of each GLONASS ephemeris, which the model itself lacks */
+static void collect_glo_freq(supl_assist_t *assist, GANSSAuxiliaryInformation_t *aux) {
+        int n, i;
+
+        for (n = 0; n < assist->glo.cnt_eph; n++) {
+                struct supl_glo_ephemeris_s *eph = &assist->glo.eph[n];
+
+                if (eph->freq != SUPL_GLO_FREQ_NONE) continue;
+                if (aux && aux->present == GANSSAuxiliaryInformation_PR_ganssID3) {
+                        for (i = 0; i < aux->choice.ganssID3.list.count; i++) {
+                                GANSS_ID3_element_t *e = aux->choice.ganssID3.list.array[i];
+
+                                if (e->svID + 1 == eph->slot) eph->freq = e->channelNumber;
+                        }
+                }
+                for (i = 0; i < assist->glo.cnt_alm && eph->freq == SUPL_GLO_FREQ_NONE; i++) {
+                        if (assist->glo.alm[i].slot == eph->slot)
+                                eph->freq = assist->glo.alm[i].ha < 25 ? assist->glo.alm[i].ha : assist->glo.alm[i].ha - 32;
+                }
+        }
+}
+
+/*
+** GANSS part of an assistance segment, in the ICD units the RRLP
+** fields already have
+*/
+static int collect_ganss(supl_assist_t *assist, GANSS_ControlHeader_t *hdr) {
+        int n, i;
+
+        if (hdr->ganssCommonAssistData && hdr->ganssCommonAssistData->ganssAddIonosphericModel) {
+                IonosphericModel_t *m = &hdr->ganssCommonAssistData->ganssAddIonosphericModel->ionoModel;
+
+                assist->set |= SUPL_RRLP_ASSIST_BDS_IONO;
+                assist->bds.iono.a0 = m->alfa0;
+                assist->bds.iono.a1 = m->alfa1;
+                assist->bds.iono.a2 = m->alfa2;
+                assist->bds.iono.a3 = m->alfa3;
+                assist->bds.iono.b0 = m->beta0;
+                assist->bds.iono.b1 = m->beta1;
+                assist->bds.iono.b2 = m->beta2;
+                assist->bds.iono.b3 = m->beta3;
+        }
+
+        if (!hdr->ganssGenericAssistDataList) return 1;
+
+        for (n = 0; n < hdr->ganssGenericAssistDataList->list.count; n++) {
+                GANSSGenericAssistDataElement_t *g = hdr->ganssGenericAssistDataList->list.array[n];
+
+                /* no id is Galileo */
+                if (!g->ganssID) continue;
+
+                if (*g->ganssID == SUPL_GANSS_GLONASS) {
+                        if (g->ganssTimeModel) {
+                                for (i = 0; i < g->ganssTimeModel->list.count; i++) {
+                                        GANSSTimeModelElement_t *m = g->ganssTimeModel->list.array[i];
+
+                                        /* against GPS */
+                                        if (m->gnssTOID != 0) continue;
+                                        assist->set |= SUPL_RRLP_ASSIST_GLO_TIME;
+                                        assist->glo.time.ref = m->ganssTimeModelRefTime;
+                                        assist->glo.time.a0 = m->tA0;
+                                        assist->glo.time.a1 = m->tA1 ? *m->tA1 : 0;
+                                        assist->glo.time.a2 = m->tA2 ? *m->tA2 : 0;
+                                }
+                        }
+                        if (g->ganssNavigationModel) collect_glo_nav(assist, g->ganssNavigationModel);
+                        if (g->ganssAlmanacModel) collect_glo_alm(assist, g->ganssAlmanacModel);
+                        collect_glo_freq(assist, g->ganssAuxiliaryInfo);
+                        continue;
+                }
+                if (*g->ganssID != SUPL_GANSS_BDS) continue;
+
+                if (g->ganssNavigationModel) collect_bds_nav(assist, g->ganssNavigationModel);
+
+                if (g->ganssAddUTCModel && g->ganssAddUTCModel->present == GANSSAddUTCModel_PR_utcModel5_r12) {
+                        UTCmodelSet5_r12_t *u = &g->ganssAddUTCModel->choice.utcModel5_r12;
+
+                        assist->set |= SUPL_RRLP_ASSIST_BDS_UTC;
+                        assist->bds.utc.a0 = u->utcA0_r12;
+                        assist->bds.utc.a1 = u->utcA1_r12;
+                        assist->bds.utc.delta_tls = u->utcDeltaTls_r12;
+                        assist->bds.utc.wnlsf = u->utcWNlsf_r12;
+                        assist->bds.utc.dn = u->utcDN_r12;
+                        assist->bds.utc.delta_tlsf = u->utcDeltaTlsf_r12;
+                }
+        }
+
+        return 1;
+}
+
 int EXPORT supl_collect_rrlp(supl_assist_t *assist, PDU_t *rrlp, struct timeval *t) {
         ControlHeader_t *hdr;
+        Rel7_AssistanceData_Extension_t *rel7;
+        int ganss = 0;
 
         if (rrlp->component.present != RRLP_Component_PR_assistanceData) return 0;
-        if (!rrlp->component.choice.assistanceData.gps_AssistData) return 0;
+
+        rel7 = rrlp->component.choice.assistanceData.rel7_AssistanceData_Extension;
+        if (rel7 && rel7->ganss_AssistData) ganss = collect_ganss(assist, &rel7->ganss_AssistData->ganss_controlHeader);
+
+        if (!rrlp->component.choice.assistanceData.gps_AssistData) return ganss;
 
         hdr = &rrlp->component.choice.assistanceData.gps_AssistData->controlHeader;
 
@@ -749,8 +1225,8 @@ int EXPORT supl_collect_rrlp(supl_assist_t *assist, PDU_t *rrlp, struct timeval
                         if (ue) {
 #if 0
                                 assist->eph_x[i].L2P = ue->ephemL2Pflag;
-                                assist->eph_x[i].fit = ue->ephemFitFlag;
 #endif
+                                assist->eph[i].fit = ue->ephemFitFlag;
                                 assist->eph[i].delta_n = ue->ephemDeltaN;
                                 assist->eph[i].M0 = ue->ephemM0;
 #if 0
@@ -823,6 +1299,7 @@ int EXPORT supl_collect_rrlp(supl_assist_t *assist, PDU_t *rrlp, struct timeval
 
 int EXPORT supl_ctx_new(supl_ctx_t *ctx) {
         memset(ctx, 0, sizeof(supl_ctx_t));
+        ctx->fd = ctx->wake_fd = ctx->race_fd = -1;
 #ifdef SUPL_DEBUG
         memset(&debug, 0, sizeof(struct supl_debug_s));
 #endif
@@ -853,159 +1330,637 @@ static int supl_more_rrlp(PDU_t *rrlp) {
                 *rrlp->component.choice.assistanceData.moreAssDataToBeSent  == MoreAssDataToBeSent_moreMessagesOnTheWay);
 }
 
-int EXPORT supl_get_assist(supl_ctx_t *ctx, char *server, char *port, supl_assist_t *assist) {
-        supl_ulp_t ulp;
+/*
+** non-blocking session
+**
+** the same exchange as the old blocking supl_get_assist(), driven by the
+** caller's event loop: wait on ctx->fd for ctx->events, call
+** supl_session_handle() when it is ready or supl_session_timeout() ran out.
+** every state has a deadline, the whole session is capped as well.
+*/
 
-        //  memcpy(ctx->p.msisdn, "\xde\xad\xbe\xef\xf0\x0b\xaa\x42", 8);
-        //memcpy(ctx->p.msisdn, "\xFF\xFF\x91\x94\x48\x45\x83\x98", 8);
-        //memcpy(ctx->p.msisdn, "\xFF\xF8\x61\x35\x88\x75\x66\x36", 8);
+static int connect_timeout = SUPL_TIMEOUT_CONNECT;
 
+static long long session_now(void) {
+        struct timespec ts;
 
-        /*
-        ** connect to server
-        */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-        if (supl_server_connect(ctx, server, port) < 0) return E_SUPL_CONNECT;
+/*
+** name cache
+**
+** getaddrinfo() can block for seconds on a bad link, so it runs on a thread
+** of its own and the answers are kept. getaddrinfo() does not pass on the
+** record TTL, an answer counts as fresh for SUPL_DNS_TTL. after that it is
+** still used, up to SUPL_DNS_STALE, while a refresh runs in the background.
+*/
 
-        /*
-        ** send SUPL_START
-        */
+#define SUPL_DNS_HOSTS 4
+#define SUPL_DNS_TTL 300000 /* ms */
+#define SUPL_DNS_STALE 86400000
+
+static struct supl_dns_s {
+        char host[64];
+        char port[8];
+        struct sockaddr_storage addr[SUPL_ADDR_MAX];
+        socklen_t len[SUPL_ADDR_MAX];
+        int n;
+        int refreshing;
+        long long resolved, used;
+} dns[SUPL_DNS_HOSTS];
+
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct dns_job_s {
+        char host[64];
+        char port[8];
+        int wake;
+};
 
-        if (pdu_make_ulp_start(ctx, &ulp) < 0) {
-                return E_SUPL_ENCODE_START;
+static struct supl_dns_s *dns_find(const char *host, const char *port, int create) {
+        struct supl_dns_s *e = 0;
+        int i;
+
+        for (i = 0; i < SUPL_DNS_HOSTS; i++) {
+                if (!strcmp(dns[i].host, host) && !strcmp(dns[i].port, port)) return &dns[i];
+                if (!e || dns[i].used < e->used) e = &dns[i];
         }
+        if (!create) return 0;
 
-        D("Send ULP START");
-        //xer_fprint(stdout, &asn_DEF_ULP_PDU, ulp.pdu);
+        // least recently used
+        memset(e, 0, sizeof(*e));
+        snprintf(e->host, sizeof(e->host), "%s", host);
+        snprintf(e->port, sizeof(e->port), "%s", port);
+        return e;
+}
 
-        (void)supl_ulp_send(ctx, &ulp);
-        supl_ulp_free(&ulp);
+/* IPv6 and IPv4 taking turns, each family in the resolver's order (RFC 8305) */
+static int dns_order(struct addrinfo *ai, struct sockaddr_storage *addr, socklen_t *len) {
+        struct addrinfo *fam[2][SUPL_ADDR_MAX];
+        int nfam[2] = { 0, 0 };
+        int i, f, n = 0;
 
-        /*
-        ** should receive SUPL_RESPONSE back
-        */
+        for (; ai; ai = ai->ai_next) {
+                f = ai->ai_family == AF_INET6 ? 0 : ai->ai_family == AF_INET ? 1 : -1;
+                if (f < 0 || ai->ai_addrlen > sizeof(*addr) || nfam[f] == SUPL_ADDR_MAX) continue;
+                fam[f][nfam[f]++] = ai;
+        }
+        for (i = 0; n < SUPL_ADDR_MAX && (i < nfam[0] || i < nfam[1]); i++) {
+                for (f = 0; f < 2 && n < SUPL_ADDR_MAX; f++) {
+                        if (i >= nfam[f]) continue;
+                        memcpy(&addr[n], fam[f][i]->ai_addr, fam[f][i]->ai_addrlen);
+                        len[n++] = fam[f][i]->ai_addrlen;
+                }
+        }
+
+        return n;
+}
 
-        D("Recv ULP ACK");
-        if (supl_ulp_recv(ctx, &ulp) < 0) {
-                return E_SUPL_RECV_RESPONSE;
+static void *dns_thread(void *arg) {
+        struct dns_job_s *job = arg;
+        struct supl_dns_s *e;
+        struct addrinfo hint, *ai;
+        long long t0 = session_now();
+        int err, n = 0;
+
+        memset(&hint, 0, sizeof(struct addrinfo));
+        hint.ai_socktype = SOCK_STREAM;
+        err = getaddrinfo(job->host, job->port, &hint, &ai);
+
+        pthread_mutex_lock(&dns_lock);
+        e = dns_find(job->host, job->port, 1);
+        if (err == 0) {
+                n = e->n = dns_order(ai, e->addr, e->len);
+                e->resolved = session_now();
         }
-        D("ULP START ACK Received");
-        //xer_fprint(stdout, &asn_DEF_ULP_PDU, ulp.pdu);
+        e->refreshing = 0;
+        pthread_mutex_unlock(&dns_lock);
 
-        if (ulp.pdu->message.present != UlpMessage_PR_msSUPLRESPONSE) {
-                supl_ulp_free(&ulp);
-                return E_SUPL_SUPLRESPONSE;
+        if (err == 0) freeaddrinfo(ai);
+        D("%s: %d addresses in %lld ms", job->host, n, session_now() - t0);
+
+        // the session may be gone already
+        if (job->wake >= 0) {
+                send(job->wake, "", 1, MSG_NOSIGNAL);
+                close(job->wake);
         }
+        free(job);
+
+        return 0;
+}
 
-        // get and copy slpSessionID if present
-        supl_response_harvest(ctx, &ulp);
+/* wake, if not -1, is written to and closed when done */
+static int dns_resolve(const char *host, const char *port, int wake) {
+        struct dns_job_s *job;
+        pthread_attr_t attr;
+        pthread_t tid;
+        int err;
 
-        supl_ulp_free(&ulp);
+        job = calloc(1, sizeof(*job));
+        if (!job) return -1;
+        snprintf(job->host, sizeof(job->host), "%s", host);
+        snprintf(job->port, sizeof(job->port), "%s", port);
+        job->wake = wake;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        err = pthread_create(&tid, &attr, dns_thread, job);
+        pthread_attr_destroy(&attr);
+        if (err) {
+                free(job);
+                return -1;
+        }
 
-        /*
-        ** send SUPL_POS_INIT
-        */
+        return 0;
+}
 
-        if (pdu_make_ulp_pos_init(ctx, &ulp) < 0) {
-                return E_SUPL_ENCODE_POSINIT;
+/* the cached addresses of ctx->host into the session, their number */
+static int dns_lookup(supl_ctx_t *ctx, long long now) {
+        struct supl_dns_s *e;
+        int n = 0;
+
+        pthread_mutex_lock(&dns_lock);
+        e = dns_find(ctx->host, ctx->port, 0);
+        if (e && e->n > 0 && now - e->resolved < SUPL_DNS_STALE) {
+                n = e->n;
+                memcpy(ctx->addr, e->addr, n * sizeof(e->addr[0]));
+                memcpy(ctx->addr_len, e->len, n * sizeof(e->len[0]));
+                e->used = now;
+                if (now - e->resolved >= SUPL_DNS_TTL && !e->refreshing) {
+                        D("%s: stale, refreshing", ctx->host);
+                        e->refreshing = dns_resolve(ctx->host, ctx->port, -1) == 0;
+                }
         }
-        D("Send ULP POS-INIT");
-        //xer_fprint(stdout, &asn_DEF_ULP_PDU, ulp.pdu);
+        pthread_mutex_unlock(&dns_lock);
+        ctx->naddr = n;
 
-        (void)supl_ulp_send(ctx, &ulp);
+        return n;
+}
 
-        /*
-        ** should get SUPLPOS back - bounce back and forth until all messages have arrived
-        */
+static void session_state(supl_ctx_t *ctx, int state, long long now, int timeout) {
+        long long end = ctx->started_at + SUPL_TIMEOUT_SESSION;
 
-        memset(assist, 0, sizeof(supl_assist_t));
+        D("state %d -> %d after %lld ms", ctx->state, state, now - ctx->state_at);
+        ctx->state = state;
+        ctx->state_at = now;
+        ctx->deadline = now + timeout < end ? now + timeout : end;
+}
 
-        int counter = 0;
-        while (1) {
-                counter += 1;
-                D("Loop %d", counter);
+static void session_end(supl_ctx_t *ctx) {
+        if (ctx->ssl) {
+                SSL_shutdown(ctx->ssl);
+                SSL_free(ctx->ssl);
+                ctx->ssl = 0;
+        }
+        // shared, see tls_ctx()
+        ctx->ssl_ctx = 0;
+        if (ctx->fd >= 0) {
+                close(ctx->fd);
+                ctx->fd = -1;
+        }
+        if (ctx->wake_fd >= 0) {
+                close(ctx->wake_fd);
+                ctx->wake_fd = -1;
+        }
+        while (ctx->nrace > 0) close(ctx->race[--ctx->nrace]);
+        if (ctx->race_fd >= 0) {
+                close(ctx->race_fd);
+                ctx->race_fd = -1;
+        }
+        if (ctx->tx) {
+                if (ctx->tx->pdu) supl_ulp_free(ctx->tx);
+                free(ctx->tx);
+                ctx->tx = 0;
+        }
+        if (ctx->rx) {
+                if (ctx->rx->pdu) supl_ulp_free(ctx->rx);
+                free(ctx->rx);
+                ctx->rx = 0;
+        }
+        ctx->events = 0;
+}
 
-                struct timeval t;
-                PDU_t *rrlp;
+static int session_fail(supl_ctx_t *ctx, int err, long long now) {
+        D("failed in state %d with %d after %lld ms", ctx->state, err, now - ctx->started_at);
+        session_end(ctx);
+        ctx->state = SUPL_STATE_FAILED;
+        ctx->err = err;
+        return err;
+}
 
-                supl_ulp_free(&ulp);
+/*
+** the connects race: the next address gets its attempt after
+** SUPL_CONNECT_STAGGER or as soon as all attempts so far failed, the first
+** one through wins. the attempts sit in their own epoll set, ctx->race_fd,
+** which is what the caller waits on meanwhile.
+*/
 
-                /* record packet recv time */
-                gettimeofday(&t, 0);
+static void race_deadline(supl_ctx_t *ctx) {
+        ctx->deadline = ctx->connect_deadline;
+        if (ctx->next_addr < ctx->naddr && ctx->next_attempt < ctx->deadline) ctx->deadline = ctx->next_attempt;
+}
 
+static void race_drop(supl_ctx_t *ctx, int i) {
+        epoll_ctl(ctx->race_fd, EPOLL_CTL_DEL, ctx->race[i], 0);
+        close(ctx->race[i]);
+        ctx->race[i] = ctx->race[--ctx->nrace];
+}
 
-                D("Receive ULP ACK");
-                if (supl_ulp_recv(ctx, &ulp) < 0) {
-                        return E_SUPL_RECV_SUPLPOS;
+/* one more attempt, an error once nothing is left to wait for */
+static int race_next(supl_ctx_t *ctx, long long now) {
+        struct epoll_event ev;
+        struct sockaddr *sa;
+        int fd, a;
+
+        while (ctx->next_addr < ctx->naddr) {
+                a = ctx->next_addr++;
+                sa = (struct sockaddr *)&ctx->addr[a];
+                fd = socket(sa->sa_family, SOCK_STREAM, 0);
+                if (fd < 0) continue;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                if (connect(fd, sa, ctx->addr_len[a]) == 0 || errno == EINPROGRESS) {
+                        ev.events = EPOLLOUT;
+                        ev.data.fd = fd;
+                        if (epoll_ctl(ctx->race_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+                                D("connecting to address %d of %d", a + 1, ctx->naddr);
+                                ctx->race[ctx->nrace++] = fd;
+                                ctx->next_attempt = now + SUPL_CONNECT_STAGGER;
+                                return 0;
+                        }
                 }
-                D("Received ULP ACK");
-                //xer_fprint(stdout, &asn_DEF_ULP_PDU, ulp.pdu);
+                close(fd);
+        }
 
-                if (ulp.pdu->message.present == UlpMessage_PR_msSUPLEND) {
-                        break;
-                }
+        return ctx->nrace > 0 ? 0 : E_SUPL_CONNECT;
+}
+
+static int race_start(supl_ctx_t *ctx, long long now) {
+        int err;
+
+        ctx->race_fd = epoll_create(SUPL_ADDR_MAX);
+        if (ctx->race_fd < 0) return E_SUPL_CONNECT;
+        ctx->nrace = 0;
+        ctx->next_addr = 0;
+        ctx->events = SUPL_WANT_READ;
+        session_state(ctx, SUPL_STATE_CONNECT, now, connect_timeout);
+        ctx->connect_deadline = ctx->deadline;
+
+        err = race_next(ctx, now);
+        race_deadline(ctx);
 
-                if (ulp.pdu->message.present != UlpMessage_PR_msSUPLPOS) {
-                        supl_ulp_free(&ulp);
-                        return E_SUPL_SUPLPOS;
+        return err;
+}
+
+/* 1 once an attempt got through and is ctx->fd */
+static int race_check(supl_ctx_t *ctx, long long now) {
+        struct epoll_event ev[SUPL_ADDR_MAX];
+        socklen_t len;
+        int i, j, n, err;
+
+        n = epoll_wait(ctx->race_fd, ev, SUPL_ADDR_MAX, 0);
+        for (i = 0; i < n; i++) {
+                for (j = 0; j < ctx->nrace && ctx->race[j] != ev[i].data.fd; j++);
+                if (j == ctx->nrace) continue;
+
+                len = sizeof(err);
+                if (getsockopt(ctx->race[j], SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+                if (err) {
+                        D("connect: %s", strerror(err));
+                        race_drop(ctx, j);
+                        continue;
                 }
 
-                /* get the beef, the RRLP payload */
+                // the winner leaves the race, the others are dropped
+                ctx->fd = ctx->race[j];
+                ctx->race[j] = ctx->race[--ctx->nrace];
+                while (ctx->nrace > 0) close(ctx->race[--ctx->nrace]);
+                close(ctx->race_fd);
+                ctx->race_fd = -1;
+                D("connected in %lld ms", now - ctx->state_at);
+                return 1;
+        }
+
+        if (now >= ctx->connect_deadline) return E_SUPL_TIMEOUT;
+        if (ctx->nrace == 0 || now >= ctx->next_attempt) {
+                err = race_next(ctx, now);
+                if (err < 0) return err;
+        }
+        race_deadline(ctx);
+
+        return 0;
+}
+
+/* SSL_get_error() of a call that did not complete, 0 if it only has to wait */
+static int session_want(supl_ctx_t *ctx, int ret, int err) {
+        switch (SSL_get_error(ctx->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+                ctx->events = SUPL_WANT_READ;
+                return 0;
+        case SSL_ERROR_WANT_WRITE:
+                ctx->events = SUPL_WANT_WRITE;
+                return 0;
+        default:
+                return err;
+        }
+}
+
+/* 1 with a decoded message in ctx->rx, 0 to wait for more */
+static int session_recv(supl_ctx_t *ctx) {
+        supl_ulp_t *rx = ctx->rx;
+        size_t need;
+        int n;
 
-                D("Decode rrlp");
-                if (supl_decode_rrlp(&ulp, &rrlp) < 0) {
-                        D("Decode rrlp error");
-                        supl_ulp_free(&ulp);
-                        return E_SUPL_DECODE_RRLP;
+        for (;;) {
+                // the length is the first field of the ULP-PDU, 16 bits
+                need = ctx->rx_len < 2 ? 2 : (size_t)(rx->buffer[0] << 8 | rx->buffer[1]);
+                if (need < 2 || need > sizeof(rx->buffer)) return E_SUPL_DECODE;
+                if (ctx->rx_len >= need) break;
+
+                n = SSL_read(ctx->ssl, &rx->buffer[ctx->rx_len], need - ctx->rx_len);
+                if (n <= 0) return session_want(ctx, n, E_SUPL_READ);
+
+                /* record packet recv time, on the clock the reference time is aged by */
+                if (ctx->rx_len == 0) {
+                        struct timespec ts;
+                        clock_gettime(CLOCK_MONOTONIC, &ts);
+                        ctx->rx_time.tv_sec = ts.tv_sec;
+                        ctx->rx_time.tv_usec = ts.tv_nsec / 1000;
                 }
-                D("Decoded rrlp");
-                //xer_fprint(stdout, &asn_DEF_PDU, rrlp);
+                ctx->rx_len += n;
+        }
+
+        rx->size = need;
+        ctx->rx_len = 0;
+        if (supl_ulp_decode(rx)) return E_SUPL_DECODE;
 
 #ifdef SUPL_DEBUG
-                if (debug.verbose_rrlp) {
-                        fprintf(debug.log, "Embedded RRLP message\n");
-                        xer_fprint(debug.log, &asn_DEF_PDU, rrlp);
-                }
+        if (debug.verbose_supl) {
+                fprintf(debug.log, "Recv %d bytes\n", (int)rx->size);
+                xer_fprint(debug.log, &asn_DEF_ULP_PDU, rx->pdu);
+        }
+        debug.recv += rx->size;
+        debug.in_msg++;
 #endif
 
-                /* remember important stuff from it */
+        return 1;
+}
 
-                D("Collect rrlp");
-                supl_collect_rrlp(assist, rrlp, &t);
+/* the encoded message in ctx->tx goes out before anything is read */
+static int session_queue(supl_ctx_t *ctx) {
+#ifdef SUPL_DEBUG
+        if (debug.verbose_supl) {
+                fprintf(debug.log, "Send %d bytes\n", (int)ctx->tx->size);
+                xer_fprint(debug.log, &asn_DEF_ULP_PDU, ctx->tx->pdu);
+        }
+#endif
+        supl_ulp_free(ctx->tx);
+        ctx->tx->pdu = 0;
+        ctx->tx_pending = 1;
 
-                if (!supl_more_rrlp(rrlp)) {
-                        asn_DEF_ULP_PDU.free_struct(&asn_DEF_PDU, rrlp, 0);
-                        D("Break loop");
-                        break;
-                }
+        return 0;
+}
 
-                /* More data coming in, send SUPLPOS + RRLP ACK */
+/* hand the decoded segment on, once the ack asking for the next one is out */
+static void session_segment(supl_ctx_t *ctx) {
+        if (!ctx->segment_pending) return;
+        ctx->segment_pending = 0;
+        if (ctx->segment_cb) ctx->segment_cb(ctx->segment_arg, ctx->assist, ctx->segment_set, ctx->segment_last);
+}
 
-                D("Make rrlp ack");
-                if (pdu_make_ulp_rrlp_ack(ctx, &ulp, rrlp) < 0) {
-                        return E_SUPL_RRLP_ACK;
-                }
-                D("Send RRLP ACK");
-                //xer_fprint(stdout, &asn_DEF_PDU, ulp.pdu);
+static int session_message(supl_ctx_t *ctx, long long now) {
+        ULP_PDU_t *ulp = ctx->rx->pdu;
+        PDU_t *rrlp = 0;
+        int err;
 
+        if (ctx->state == SUPL_STATE_RESPONSE) {
+                if (ulp->message.present != UlpMessage_PR_msSUPLRESPONSE) return E_SUPL_SUPLRESPONSE;
 
+                // get and copy slpSessionID if present
+                supl_response_harvest(ctx, ctx->rx);
 
-                supl_ulp_send(ctx, &ulp);
-                asn_DEF_ULP_PDU.free_struct(&asn_DEF_PDU, rrlp, 0);
+                D("Send ULP POS-INIT");
+                if (pdu_make_ulp_pos_init(ctx, ctx->tx) < 0) return E_SUPL_ENCODE_POSINIT;
+                session_queue(ctx);
+                session_state(ctx, SUPL_STATE_POS, now, SUPL_TIMEOUT_MESSAGE);
+                return 0;
         }
 
-        supl_ulp_free(&ulp);
+        if (ulp->message.present == UlpMessage_PR_msSUPLEND) {
+                session_state(ctx, SUPL_STATE_DONE, now, 0);
+                return 0;
+        }
+        if (ulp->message.present != UlpMessage_PR_msSUPLPOS) return E_SUPL_SUPLPOS;
 
-        /*
-        ** send SUPL_END (but who really cares)
-        */
+        /* get the beef, the RRLP payload */
+
+        if (supl_decode_rrlp(ctx->rx, &rrlp) < 0 || !rrlp) return E_SUPL_DECODE_RRLP;
+
+#ifdef SUPL_DEBUG
+        if (debug.verbose_rrlp) {
+                fprintf(debug.log, "Embedded RRLP message\n");
+                xer_fprint(debug.log, &asn_DEF_PDU, rrlp);
+        }
+#endif
+
+        /* remember important stuff from it */
 
-        // put supl_close outside of get assist, free ssl when get assist is failed.
-        // supl_close(ctx);
+        ctx->segment_set = ctx->assist->set;
+        supl_collect_rrlp(ctx->assist, rrlp, &ctx->rx_time);
+        ctx->segment_set = ctx->assist->set & ~ctx->segment_set;
+        ctx->segment_pending = 1;
+
+        if (!supl_more_rrlp(rrlp)) {
+                asn_DEF_PDU.free_struct(&asn_DEF_PDU, rrlp, 0);
+                ctx->segment_last = 1;
+                session_state(ctx, SUPL_STATE_DONE, now, 0);
+                return 0;
+        }
+
+        /* More data coming in, send SUPLPOS + RRLP ACK */
+
+        err = pdu_make_ulp_rrlp_ack(ctx, ctx->tx, rrlp);
+        asn_DEF_PDU.free_struct(&asn_DEF_PDU, rrlp, 0);
+        if (err < 0) return E_SUPL_RRLP_ACK;
+        session_queue(ctx);
+        session_state(ctx, SUPL_STATE_POS, now, SUPL_TIMEOUT_MESSAGE);
 
         return 0;
 }
 
+/* returns the socket to wait on or an error */
+int EXPORT supl_session_start(supl_ctx_t *ctx, char *server, char *port, supl_assist_t *assist, long long now) {
+        int wake[2];
+        int err;
+
+        supl_session_cancel(ctx);
+
+        ctx->started_at = ctx->state_at = now;
+        ctx->state = SUPL_STATE_IDLE;
+        ctx->err = 0;
+        ctx->assist = assist;
+        ctx->tx_pending = 0;
+        ctx->rx_len = 0;
+        ctx->segment_pending = ctx->segment_last = 0;
+        memset(assist, 0, sizeof(supl_assist_t));
+
+        snprintf(ctx->host, sizeof(ctx->host), "%s", server);
+        snprintf(ctx->port, sizeof(ctx->port), "%s", port ? port : SUPL_PORT);
+
+        ctx->ssl_ctx = tls_ctx();
+        if (!ctx->ssl_ctx) return session_fail(ctx, E_SUPL_CONNECT, now);
+        ctx->ssl = SSL_new(ctx->ssl_ctx);
+        if (!ctx->ssl) return session_fail(ctx, E_SUPL_CONNECT, now);
+        tls_attach(ctx->ssl, server, port);
+
+        ctx->tx = calloc(1, sizeof(supl_ulp_t));
+        ctx->rx = calloc(1, sizeof(supl_ulp_t));
+        if (!ctx->tx || !ctx->rx) return session_fail(ctx, E_SUPL_INTERNAL, now);
+
+        if (dns_lookup(ctx, now) > 0) {
+                err = race_start(ctx, now);
+                if (err < 0) return session_fail(ctx, err, now);
+                return supl_session_fd(ctx);
+        }
+
+        // not cached, wait for the resolver
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, wake) < 0) return session_fail(ctx, E_SUPL_CONNECT, now);
+        if (dns_resolve(ctx->host, ctx->port, wake[1]) < 0) {
+                close(wake[0]);
+                close(wake[1]);
+                return session_fail(ctx, E_SUPL_CONNECT, now);
+        }
+        ctx->wake_fd = wake[0];
+        fcntl(ctx->wake_fd, F_SETFL, fcntl(ctx->wake_fd, F_GETFL) | O_NONBLOCK);
+        ctx->events = SUPL_WANT_READ;
+        session_state(ctx, SUPL_STATE_RESOLVE, now, SUPL_TIMEOUT_RESOLVE);
+
+        return supl_session_fd(ctx);
+}
+
+/* what to wait on for ctx->events, it changes with the state */
+int EXPORT supl_session_fd(supl_ctx_t *ctx) {
+        if (ctx->state == SUPL_STATE_RESOLVE) return ctx->wake_fd;
+        if (ctx->state == SUPL_STATE_CONNECT) return ctx->race_fd;
+
+        return ctx->fd;
+}
+
+void EXPORT supl_set_connect_timeout(int ms) {
+        if (ms > 0) connect_timeout = ms;
+}
+
+/* on readiness of supl_session_fd() or the deadline, returns an error once the session failed */
+int EXPORT supl_session_handle(supl_ctx_t *ctx, long long now) {
+        char c;
+        int err, ret;
+
+        if (ctx->state == SUPL_STATE_FAILED) return ctx->err;
+        if (ctx->state < SUPL_STATE_RESOLVE || ctx->state > SUPL_STATE_POS) return 0;
+
+        // the connect deadline is the race's, see race_check()
+        if (ctx->state != SUPL_STATE_CONNECT && now >= ctx->deadline) return session_fail(ctx, E_SUPL_TIMEOUT, now);
+
+        switch (ctx->state) {
+        case SUPL_STATE_RESOLVE:
+                if (recv(ctx->wake_fd, &c, 1, 0) < 0 && errno == EAGAIN) return 0;
+                close(ctx->wake_fd);
+                ctx->wake_fd = -1;
+                if (dns_lookup(ctx, now) == 0) return session_fail(ctx, E_SUPL_CONNECT, now);
+                err = race_start(ctx, now);
+                return err < 0 ? session_fail(ctx, err, now) : 0;
+
+        case SUPL_STATE_CONNECT:
+                ret = race_check(ctx, now);
+                if (ret <= 0) return ret < 0 ? session_fail(ctx, ret, now) : 0;
+                SSL_set_fd(ctx->ssl, ctx->fd);
+                session_state(ctx, SUPL_STATE_HANDSHAKE, now, SUPL_TIMEOUT_HANDSHAKE);
+                /* fall through */
+
+        case SUPL_STATE_HANDSHAKE:
+                ret = SSL_connect(ctx->ssl);
+                if (ret != 1) {
+                        err = session_want(ctx, ret, E_SUPL_CONNECT);
+                        if (err < 0) tls_forget(ctx->ssl);
+                        return err < 0 ? session_fail(ctx, err, now) : 0;
+                }
+                tls_account(ctx->ssl, now - ctx->state_at);
+
+                /*
+                ** send SUPL_START, should receive SUPL_RESPONSE back
+                */
+
+                D("Send ULP START");
+                if (pdu_make_ulp_start(ctx, ctx->tx) < 0) return session_fail(ctx, E_SUPL_ENCODE_START, now);
+                session_queue(ctx);
+                session_state(ctx, SUPL_STATE_RESPONSE, now, SUPL_TIMEOUT_MESSAGE);
+                break;
+        }
+
+        for (;;) {
+                if (ctx->tx_pending) {
+                        ret = SSL_write(ctx->ssl, ctx->tx->buffer, ctx->tx->size);
+                        if (ret <= 0) {
+                                err = session_want(ctx, ret, E_SUPL_WRITE);
+                                return err < 0 ? session_fail(ctx, err, now) : 0;
+                        }
+                        ctx->tx_pending = 0;
+#ifdef SUPL_DEBUG
+                        debug.sent += ctx->tx->size;
+                        debug.out_msg++;
+#endif
+                }
+                session_segment(ctx);
+
+                ret = session_recv(ctx);
+                if (ret < 0) return session_fail(ctx, ret, now);
+                if (ret == 0) return 0;
+
+                err = session_message(ctx, now);
+                supl_ulp_free(ctx->rx);
+                ctx->rx->pdu = 0;
+                if (err < 0) return session_fail(ctx, err, now);
+
+                if (ctx->state == SUPL_STATE_DONE) {
+                        session_segment(ctx);
+                        D("done in %lld ms", now - ctx->started_at);
+                        session_end(ctx);
+                        return 0;
+                }
+        }
+}
+
+/* ms until supl_session_handle() is due without readiness, -1 for none */
+int EXPORT supl_session_timeout(supl_ctx_t *ctx, long long now) {
+        if (ctx->state < SUPL_STATE_RESOLVE || ctx->state > SUPL_STATE_POS) return -1;
+
+        return ctx->deadline > now ? (int)(ctx->deadline - now) : 0;
+}
+
+void EXPORT supl_session_cancel(supl_ctx_t *ctx) {
+        if (ctx->state >= SUPL_STATE_RESOLVE && ctx->state <= SUPL_STATE_POS) D("cancelled in state %d", ctx->state);
+        session_end(ctx);
+        ctx->state = SUPL_STATE_IDLE;
+}
+
+int EXPORT supl_get_assist(supl_ctx_t *ctx, char *server, char *port, supl_assist_t *assist) {
+        struct pollfd pfd;
+        int err;
+
+        err = supl_session_start(ctx, server, port, assist, session_now());
+        if (err < 0) return err;
+
+        while (ctx->state != SUPL_STATE_DONE && ctx->state != SUPL_STATE_FAILED) {
+                pfd.fd = supl_session_fd(ctx);
+                pfd.events = (ctx->events & SUPL_WANT_READ ? POLLIN : 0) | (ctx->events & SUPL_WANT_WRITE ? POLLOUT : 0);
+                poll(&pfd, 1, supl_session_timeout(ctx, session_now()));
+                supl_session_handle(ctx, session_now());
+        }
+
+        return ctx->state == SUPL_STATE_DONE ? 0 : ctx->err;
+}
+
 void EXPORT supl_set_msisdn(supl_ctx_t *ctx, const char *msisdn) {
         memset(ctx->p.msisdn, 0xff, 8);
         uint64_t num;
@@ -1067,6 +2022,30 @@ void EXPORT supl_request(supl_ctx_t *ctx, int request) {
         ctx->p.request = request;
 }
 
+void EXPORT supl_set_have(supl_ctx_t *ctx, int have) {
+        ctx->p.have = have;
+}
+
+/* toe in hours of the gps week, the oldest one added goes out */
+void EXPORT supl_add_have_eph(supl_ctx_t *ctx, int prn, int iode, int week, int toe) {
+        int n = ctx->p.nav.n;
+
+        if (n >= MAX_EPHEMERIS) return;
+        if (n == 0 || week < ctx->p.nav.week || (week == ctx->p.nav.week && toe < ctx->p.nav.toe)) {
+                ctx->p.nav.week = week;
+                ctx->p.nav.toe = toe;
+        }
+        ctx->p.nav.sat[n].prn = prn;
+        ctx->p.nav.sat[n].iode = iode;
+        ctx->p.nav.n = n + 1;
+}
+
+/* assistance as it comes in, instead of all of it at SUPL END */
+void EXPORT supl_set_segment_cb(supl_ctx_t *ctx, supl_segment_cb cb, void *arg) {
+        ctx->segment_cb = cb;
+        ctx->segment_arg = arg;
+}
+
 void EXPORT supl_set_debug(FILE *log, int flags) {
 #ifdef SUPL_DEBUG
         debug.log = log;
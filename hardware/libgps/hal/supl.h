@@ -16,6 +16,7 @@
 #define EXPORT
 #endif
 
+#include <netdb.h>
 #include <openssl/ssl.h>
 #include <PDU.h>
 #include <ULP-PDU.h>
@@ -39,6 +40,7 @@
 #define E_SUPL_INTERNAL (-13)
 #define E_SUPL_DECODE (-14)
 #define E_SUPL_ENCODE_RRLP (-15)
+#define E_SUPL_TIMEOUT (-16)
 #define SUPL_DEBUG
 
 /* diagnostic & debug values */
@@ -48,6 +50,8 @@
 
 /* flags for additional assistance requests */
 #define SUPL_REQUEST_ALMANAC 1
+#define SUPL_REQUEST_BDS 2 /* GANSS assistance for BDS */
+#define SUPL_REQUEST_GLONASS 4 /* and for GLONASS */
 
 /* flags for collected assist data elements */
 #define SUPL_RRLP_ASSIST_REFTIME (1)
@@ -55,11 +59,53 @@
 #define SUPL_RRLP_ASSIST_IONO (4)
 #define SUPL_RRLP_ASSIST_EPHEMERIS (8)
 #define SUPL_RRLP_ASSIST_UTC (16)
+#define SUPL_RRLP_ASSIST_BDS_EPH (32)
+#define SUPL_RRLP_ASSIST_BDS_UTC (64)
+#define SUPL_RRLP_ASSIST_BDS_IONO (128)
+#define SUPL_RRLP_ASSIST_GLO_EPH (256)
+#define SUPL_RRLP_ASSIST_GLO_ALM (512)
+#define SUPL_RRLP_ASSIST_GLO_TIME (1024)
 
 #define SUPL_ACQUIS_DOPPLER (1)
 #define SUPL_ACQUIS_ANGLE (2)
 
 #define MAX_EPHEMERIS 32
+#define MAX_BDS_EPHEMERIS 63
+#define MAX_GLO_EPHEMERIS 24
+
+#define SUPL_ADDR_MAX 8 /* addresses of the SLP tried */
+#define SUPL_TOE_LIMIT 2 /* hours a held ephemeris may be older than a fresh one */
+
+/* GANSS ids, ULP GanssReqGenericData and RRLP GANSSGenericAssistDataElement */
+#define SUPL_GANSS_GLONASS 4
+#define SUPL_GANSS_BDS 5
+#define SUPL_SIGNAL_BDS_B1I 0x80 /* GANSSSignals, first bit */
+#define SUPL_SIGNAL_GLONASS_G1 0x80
+#define SUPL_TIME_MODEL_GPS 0x80 /* ganssTimeModels, first bit */
+#define SUPL_GLO_FREQ_NONE (-128) /* frequency channel not known */
+#define SUPL_RRLP_GANSS_VERSION 12 /* the RRLP release with the BDS models */
+
+/* non-blocking session states */
+#define SUPL_STATE_IDLE 0
+#define SUPL_STATE_RESOLVE 1 /* name not cached, resolver thread running */
+#define SUPL_STATE_CONNECT 2 /* tcp connects racing */
+#define SUPL_STATE_HANDSHAKE 3 /* tls handshake */
+#define SUPL_STATE_RESPONSE 4 /* SUPL START out, waiting for SUPL RESPONSE */
+#define SUPL_STATE_POS 5 /* SUPL POS INIT out, SUPL POS until the last RRLP or SUPL END */
+#define SUPL_STATE_DONE 6
+#define SUPL_STATE_FAILED 7
+
+/* what the session waits for on ctx->fd */
+#define SUPL_WANT_READ 1
+#define SUPL_WANT_WRITE 2
+
+/* deadlines in ms */
+#define SUPL_TIMEOUT_RESOLVE 5000
+#define SUPL_TIMEOUT_CONNECT 5000 /* all addresses, see supl_set_connect_timeout() */
+#define SUPL_CONNECT_STAGGER 250 /* before racing the next address */
+#define SUPL_TIMEOUT_HANDSHAKE 5000
+#define SUPL_TIMEOUT_MESSAGE 5000 /* for each message from the server */
+#define SUPL_TIMEOUT_SESSION 30000
 
 struct supl_acquis_s {
         u_int8_t prn;
@@ -94,7 +140,7 @@ struct supl_almanac_s {
 
 struct supl_ephemeris_s {
         u_int8_t prn;
-        u_int8_t fill1;
+        u_int8_t fit; /* fit interval flag, 1: longer than 4 hours */
         u_int16_t delta_n;
         int32_t M0;
         u_int32_t e;
@@ -127,6 +173,97 @@ struct supl_ephemeris_s {
         u_int8_t AODA;
 };
 
+/* BDS D1/D2 navigation message, raw integers in ICD units */
+struct supl_bds_ephemeris_s {
+        u_int8_t prn;
+        u_int8_t urai;
+        u_int8_t health;
+        u_int8_t aode;
+        u_int8_t aodc;
+        u_int8_t fill[1];
+        u_int16_t week;
+        u_int32_t toe;
+        u_int32_t A_sqrt;
+        u_int32_t e;
+        int32_t w;
+        int32_t delta_n;
+        int32_t M0;
+        int32_t OMEGA_0;
+        int32_t OMEGA_dot;
+        int32_t i0;
+        int32_t i_dot;
+        int32_t Cuc;
+        int32_t Cus;
+        int32_t Crc;
+        int32_t Crs;
+        int32_t Cic;
+        int32_t Cis;
+        u_int32_t toc;
+        int32_t AF0;
+        int32_t AF1;
+        int32_t AF2;
+        int32_t tgd1;
+};
+
+/* GLONASS navigation message, raw integers in ICD units */
+struct supl_glo_ephemeris_s {
+        u_int8_t slot; /* 1..24 */
+        int8_t freq; /* channel k, from the auxiliary information or the almanac */
+        u_int8_t tb; /* 15 minute interval of the Moscow day */
+        u_int8_t health; /* Bn */
+        u_int8_t ft;
+        u_int8_t en;
+        u_int8_t p1;
+        u_int8_t p2;
+        u_int8_t m;
+        int8_t dtau;
+        int8_t ax, ay, az;
+        u_int8_t fill[3];
+        int32_t x, y, z;
+        int32_t vx, vy, vz;
+        int32_t tau;
+        int16_t gamma;
+        u_int8_t fill2[2];
+};
+
+/* GLONASS almanac of one slot, raw integers in ICD units */
+struct supl_glo_almanac_s {
+        u_int16_t na; /* day of the four year interval */
+        u_int8_t slot;
+        u_int8_t ha; /* frequency channel, 25..31 for -7..-1 */
+        u_int8_t c;
+        u_int8_t m;
+        int8_t delta_tdot;
+        u_int8_t fill[1];
+        int32_t lambda;
+        u_int32_t tlambda;
+        int32_t delta_i;
+        int32_t delta_t;
+        u_int16_t epsilon;
+        int16_t omega;
+        int16_t tau;
+        u_int8_t fill2[2];
+};
+
+/* GANSS time relative to GPS time, RRLP GANSSTimeModelElement */
+struct supl_ganss_time_s {
+        u_int16_t ref; /* 2^4 s */
+        int8_t a2; /* 2^-68 s/s^2 */
+        u_int8_t fill[1];
+        int32_t a0; /* 2^-35 s */
+        int32_t a1; /* 2^-51 s/s */
+};
+
+/* BDT-UTC, the GPS model without tot and wnt */
+struct supl_bds_utc_s {
+        int32_t a0;
+        int32_t a1;
+        int8_t delta_tls;
+        int8_t delta_tlsf;
+        u_int8_t wnlsf;
+        u_int8_t dn;
+};
+
 struct supl_ionospheric_s {
         int8_t a0, a1, a2, a3, b0, b1, b2, b3;
 };
@@ -148,7 +285,7 @@ typedef struct supl_rrlp_ctx_s {
 
         struct {
                 long gps_tow, gps_week;
-                struct timeval stamp;
+                struct timeval stamp;           // CLOCK_MONOTONIC of its arrival
         } time;
 
         struct {
@@ -171,6 +308,22 @@ typedef struct supl_rrlp_ctx_s {
         int acq_time;
         struct supl_acquis_s acq[MAX_EPHEMERIS];
 
+        /* GANSS, see supl_request() */
+        struct {
+                int cnt_eph;
+                struct supl_bds_ephemeris_s eph[MAX_BDS_EPHEMERIS];
+                struct supl_bds_utc_s utc;
+                struct supl_ionospheric_s iono; /* Klobuchar, as broadcast in D1 */
+        } bds;
+
+        struct {
+                int cnt_eph;
+                struct supl_glo_ephemeris_s eph[MAX_GLO_EPHEMERIS];
+                int cnt_alm;
+                struct supl_glo_almanac_s alm[MAX_GLO_EPHEMERIS];
+                struct supl_ganss_time_s time;
+        } glo;
+
 } supl_assist_t;
 
 typedef struct supl_param_s {
@@ -196,8 +349,22 @@ typedef struct supl_param_s {
         } known;
 
         char msisdn[8];
+
+        /* assistance already held, only the rest is requested */
+        int have; /* SUPL_RRLP_ASSIST_* */
+        struct {
+                int week, toe, n; /* toe of the oldest, hours */
+                struct {
+                        int prn, iode;
+                } sat[MAX_EPHEMERIS];
+        } nav;
 } supl_param_t;
 
+/* each RRLP segment as it is decoded, set holds the flags it brought and
+ * last is 1 for the final one. new ephemerides and almanacs are appended to
+ * assist, see supl_set_segment_cb() */
+typedef void (*supl_segment_cb)(void *arg, supl_assist_t *assist, int set, int last);
+
 typedef struct supl_ctx_s {
         supl_param_t p;
 
@@ -210,6 +377,29 @@ typedef struct supl_ctx_s {
                 size_t size;
         } slp_session_id;
 
+        /* non-blocking session, see supl_session_start() */
+        int state;
+        int events;
+        int err;
+        long long started_at, state_at, deadline;
+        int wake_fd; /* resolver done */
+        int race_fd; /* epoll over the connect attempts */
+        int race[SUPL_ADDR_MAX];
+        int nrace;
+        struct sockaddr_storage addr[SUPL_ADDR_MAX];
+        socklen_t addr_len[SUPL_ADDR_MAX];
+        int naddr, next_addr;
+        long long connect_deadline, next_attempt;
+        char host[64], port[8];
+        supl_assist_t *assist;
+        int tx_pending;
+        size_t rx_len;
+        struct timeval rx_time;
+        struct supl_ulp_s *tx, *rx;
+        supl_segment_cb segment_cb;
+        void *segment_arg;
+        int segment_set, segment_last, segment_pending;
+
 } supl_ctx_t;
 
 int supl_ctx_new(supl_ctx_t *ctx);
@@ -223,8 +413,19 @@ void supl_set_gsm_cell_known(supl_ctx_t *ctx, int mcc, int mns, int lac, int ci,
 void supl_set_server(supl_ctx_t *ctx, char *server, char *port);
 void supl_set_fd(supl_ctx_t *ctx, int fd);
 void supl_request(supl_ctx_t *ctx, int flags);
+void supl_set_have(supl_ctx_t *ctx, int have);
+void supl_add_have_eph(supl_ctx_t *ctx, int prn, int iode, int week, int toe);
 
 int supl_get_assist(supl_ctx_t *ctx, char *server, char *port, supl_assist_t *assist);
+
+int supl_session_start(supl_ctx_t *ctx, char *server, char *port, supl_assist_t *assist, long long now);
+int supl_session_handle(supl_ctx_t *ctx, long long now);
+int supl_session_timeout(supl_ctx_t *ctx, long long now);
+void supl_session_cancel(supl_ctx_t *ctx);
+int supl_session_fd(supl_ctx_t *ctx);
+void supl_set_segment_cb(supl_ctx_t *ctx, supl_segment_cb cb, void *arg);
+void supl_set_tls_cache(const char *path);
+void supl_set_connect_timeout(int ms);
 void supl_set_debug(FILE *log, int flags);
 
 /*
@@ -251,7 +452,6 @@ int supl_ulp_decode(supl_ulp_t *pdu);
 int supl_decode_rrlp(supl_ulp_t *pdu, PDU_t **rrlp);
 int supl_collect_rrlp(supl_assist_t *assist, PDU_t *rrlp, struct timeval *t);
 
-int supl_server_connect(supl_ctx_t *ctx, char *server, char *port);
 void supl_close(supl_ctx_t *ctx);
 int supl_ulp_send(supl_ctx_t *ctx, supl_ulp_t *pdu);
 int supl_ulp_recv(supl_ctx_t *ctx, supl_ulp_t *pdu);
@@ -0,0 +1,360 @@
+/*
+ * compact on-device track history.
+ *
+ * the reader thread delta encodes every new fix into the current block,
+ * zigzag varints for time, position, altitude and speed, single bytes for
+ * the rest, about 10 bytes per fix at 1 Hz. full blocks are queued to a
+ * writer thread that puts each one down as a single page into a ring file,
+ * so flash sees one page write per few hundred fixes and no rewrites.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+#include "crc32.h"
+#include "track.h"
+
+#define GPS_DEBUG  1
+
+#if GPS_DEBUG
+#  define  D(f, ...)   LOGD("%s: line = %d, " f, __func__, __LINE__, ##__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define RECORD_MAX              32              // 5 varints and 4 bytes
+#define DEFAULT_DT              1000
+#define TRACK_MAX_GAP           (1LL << 30)     // ms, about 12 days
+#define TRACK_MAX_BACK          60000           // ms, a larger step back is a new track
+
+struct track_state {
+        int64_t                 time;
+        int32_t                 lat;
+        int32_t                 lon;
+        int32_t                 alt;
+        int32_t                 dt;
+        int32_t                 speed;
+};
+
+static int track_fd = -1;
+static int track_blocks;
+static uint32_t track_seq;
+static int64_t last_time;
+static struct track_state prev;
+static int have_prev;
+
+static unsigned char cur[TRACK_BLOCK_SIZE];
+static int cur_count, cur_len;
+
+static unsigned char queue[TRACK_QUEUE][TRACK_BLOCK_SIZE];
+static int q_head, q_tail;                      // q_head - q_tail blocks queued
+static int q_quit;
+static int dropped;
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+
+static int
+put_varint(unsigned char *p, int32_t v) {
+        uint32_t u = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);      // zigzag
+        int n = 0;
+
+        while (u >= 0x80) {
+                p[n++] = (u & 0x7F) | 0x80;
+                u >>= 7;
+        }
+        p[n++] = u;
+        return n;
+}
+
+static int
+get_varint(const unsigned char *p, const unsigned char *end, int32_t *v) {
+        uint32_t u = 0;
+        int n = 0, shift = 0;
+
+        do {
+                if (p + n >= end || shift > 28)
+                        return -1;
+                u |= (uint32_t)(p[n] & 0x7F) << shift;
+                shift += 7;
+        } while (p[n++] & 0x80);
+        *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+        return n;
+}
+
+static unsigned char
+clamp_u8(double v) {
+        return v < 0 ? 0 : v > 255 ? 255 : (unsigned char)(v + 0.5);
+}
+
+static void *
+track_writer(void *arg) {
+        const TrackBlockHead *h;
+        unsigned char *block;
+
+        (void)arg;
+        for (;;) {
+                pthread_mutex_lock(&q_lock);
+                while (q_head == q_tail && !q_quit)
+                        pthread_cond_wait(&q_cond, &q_lock);
+                if (q_head == q_tail) {
+                        pthread_mutex_unlock(&q_lock);
+                        break;
+                }
+                block = queue[q_tail % TRACK_QUEUE];
+                pthread_mutex_unlock(&q_lock);
+
+                // the slot stays ours until q_tail moves
+                h = (const TrackBlockHead *)block;
+                if (pwrite(track_fd, block, TRACK_BLOCK_SIZE,
+                                (off_t)(h->seq % track_blocks) * TRACK_BLOCK_SIZE) != TRACK_BLOCK_SIZE)
+                        D("track write failed, errno = %d", errno);
+                else
+                        fdatasync(track_fd);
+
+                pthread_mutex_lock(&q_lock);
+                q_tail += 1;
+                pthread_mutex_unlock(&q_lock);
+        }
+        return NULL;
+}
+
+static void
+block_seal() {
+        TrackBlockHead *h = (TrackBlockHead *)cur;
+        uint32_t crc;
+
+        h->count = cur_count;
+        h->len = cur_len;
+        crc = crc32_buf(cur, TRACK_BLOCK_SIZE - 4);
+        memcpy(cur + TRACK_BLOCK_SIZE - 4, &crc, 4);
+
+        pthread_mutex_lock(&q_lock);
+        if (q_head - q_tail < TRACK_QUEUE) {
+                memcpy(queue[q_head % TRACK_QUEUE], cur, TRACK_BLOCK_SIZE);
+                q_head += 1;
+                pthread_cond_signal(&q_cond);
+        } else {
+                dropped += 1;
+        }
+        pthread_mutex_unlock(&q_lock);
+
+        cur_count = 0;
+        cur_len = 0;
+}
+
+/* the head holds the state the first record is a delta against */
+static void
+block_start() {
+        TrackBlockHead *h = (TrackBlockHead *)cur;
+
+        memset(cur, 0, TRACK_BLOCK_SIZE);
+        h->magic = TRACK_MAGIC;
+        h->seq   = track_seq++;
+        h->time  = prev.time;
+        h->lat   = prev.lat;
+        h->lon   = prev.lon;
+        h->alt   = prev.alt;
+        h->dt    = prev.dt;
+        h->speed = prev.speed;
+}
+
+int
+track_open(const char *path, int blocks) {
+        TrackBlockHead h;
+        off_t size;
+        int i, have = 0;
+
+        if (track_fd >= 0)
+                return 0;
+        if (blocks <= 0)
+                blocks = TRACK_BLOCKS;
+
+        track_fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (track_fd < 0) {
+                D("Can not open track %s, errno = %d", path, errno);
+                return -1;
+        }
+        size = lseek(track_fd, 0, SEEK_END);
+        if (size < (off_t)blocks * TRACK_BLOCK_SIZE && ftruncate(track_fd, (off_t)blocks * TRACK_BLOCK_SIZE) < 0) {
+                D("Can not size track, errno = %d", errno);
+                close(track_fd);
+                track_fd = -1;
+                return -1;
+        }
+
+        // carry on after the newest block
+        track_seq = 0;
+        for (i = 0; i < blocks; i++) {
+                if (pread(track_fd, &h, sizeof(h), (off_t)i * TRACK_BLOCK_SIZE) != sizeof(h) || h.magic != TRACK_MAGIC)
+                        continue;
+                if (!have || (int32_t)(h.seq - track_seq) >= 0)
+                        track_seq = h.seq + 1;
+                have = 1;
+        }
+
+        track_blocks = blocks;
+        cur_count = 0;
+        cur_len = 0;
+        have_prev = 0;
+        last_time = 0;
+        q_head = q_tail = 0;
+        q_quit = 0;
+        dropped = 0;
+        if (pthread_create(&writer, NULL, track_writer, NULL) != 0) {
+                close(track_fd);
+                track_fd = -1;
+                return -1;
+        }
+        D("track %s, %d blocks, next seq %u", path, blocks, track_seq);
+        return 0;
+}
+
+void
+track_close() {
+        if (track_fd < 0)
+                return;
+
+        if (cur_count > 0)
+                block_seal();
+        pthread_mutex_lock(&q_lock);
+        q_quit = 1;
+        pthread_cond_signal(&q_cond);
+        pthread_mutex_unlock(&q_lock);
+        pthread_join(writer, NULL);
+
+        if (dropped)
+                D("track dropped %d blocks", dropped);
+        close(track_fd);
+        track_fd = -1;
+}
+
+/* called once per epoch from the reader thread */
+void
+track_record(const GpsLocation *fix, const GpsSvStatus *sv_status) {
+        unsigned char rec[RECORD_MAX];
+        struct track_state s;
+        int i, n = 0, nused = 0;
+
+        if (track_fd < 0 || !(fix->flags & GPS_LOCATION_HAS_LAT_LONG))
+                return;
+        // a repeated or slightly late epoch is dropped, the deltas only run forward;
+        // a bad time already recorded must not stall the track, so a real step
+        // back seals the block and starts over
+        if (fix->timestamp <= last_time) {
+                if (last_time - fix->timestamp <= TRACK_MAX_BACK)
+                        return;
+                D("track time stepped back %lld ms", (long long)(last_time - fix->timestamp));
+                if (cur_count > 0)
+                        block_seal();
+                have_prev = 0;
+        }
+        last_time = fix->timestamp;
+
+        s.time  = fix->timestamp;
+        s.lat   = (int32_t)lrint(fix->latitude * 1e7);
+        s.lon   = (int32_t)lrint(fix->longitude * 1e7);
+        s.alt   = (int32_t)lrint(fix->altitude * 10);
+        s.speed = (int32_t)lrint(fix->speed * 100);
+        if (s.speed > 0xFFFF)
+                s.speed = 0xFFFF;
+        // a gap the time delta can not span starts over in a new block
+        if (have_prev && s.time - prev.time > TRACK_MAX_GAP) {
+                if (cur_count > 0)
+                        block_seal();
+                have_prev = 0;
+        }
+        if (!have_prev) {
+                prev = s;
+                prev.time = s.time - DEFAULT_DT;
+                prev.dt = DEFAULT_DT;
+                have_prev = 1;
+        }
+        s.dt = (int32_t)(s.time - prev.time);
+
+        for (i = 0; i < sv_status->num_svs; i++) {
+                if (sv_status->sv_list[i].azimuth >= 720)
+                        nused += 1;
+        }
+
+        n += put_varint(rec + n, s.dt - prev.dt);
+        n += put_varint(rec + n, s.lat - prev.lat);
+        n += put_varint(rec + n, s.lon - prev.lon);
+        n += put_varint(rec + n, s.alt - prev.alt);
+        n += put_varint(rec + n, s.speed - prev.speed);
+        rec[n++] = (unsigned char)lrint(fmod(fix->bearing + 360.0, 360.0) * 256 / 360) & 0xFF;
+        rec[n++] = clamp_u8(fix->accuracy * 10);
+        rec[n++] = clamp_u8(sv_status->num_svs);
+        rec[n++] = clamp_u8(nused);
+
+        if (cur_count > 0 && cur_len + n > (int)TRACK_PAYLOAD)
+                block_seal();
+        if (cur_count == 0)
+                block_start();
+
+        memcpy(cur + sizeof(TrackBlockHead) + cur_len, rec, n);
+        cur_len += n;
+        cur_count += 1;
+        prev = s;
+}
+
+/* returns the number of fixes, -1 for a block that is empty or damaged */
+int
+track_decode_block(const unsigned char *block, track_fix_callback cb, void *arg) {
+        const TrackBlockHead *h = (const TrackBlockHead *)block;
+        const unsigned char *p, *end;
+        struct track_state s;
+        TrackFix f;
+        uint32_t crc;
+        int32_t v[5];
+        int i, k, n;
+
+        memcpy(&crc, block + TRACK_BLOCK_SIZE - 4, 4);
+        if (h->magic != TRACK_MAGIC || h->len > TRACK_PAYLOAD || crc != crc32_buf(block, TRACK_BLOCK_SIZE - 4))
+                return -1;
+
+        s.time  = h->time;
+        s.lat   = h->lat;
+        s.lon   = h->lon;
+        s.alt   = h->alt;
+        s.dt    = h->dt;
+        s.speed = h->speed;
+        p = block + sizeof(TrackBlockHead);
+        end = p + h->len;
+        for (i = 0; i < h->count; i++) {
+                for (k = 0; k < 5; k++) {
+                        n = get_varint(p, end, &v[k]);
+                        if (n < 0)
+                                return -1;
+                        p += n;
+                }
+                if (p + 4 > end)
+                        return -1;
+
+                s.dt    += v[0];
+                s.time  += s.dt;
+                s.lat   += v[1];
+                s.lon   += v[2];
+                s.alt   += v[3];
+                s.speed += v[4];
+
+                f.time      = s.time;
+                f.latitude  = s.lat * 1e-7;
+                f.longitude = s.lon * 1e-7;
+                f.altitude  = s.alt * 0.1;
+                f.speed     = s.speed * 0.01f;
+                f.bearing   = p[0] * 360.0f / 256;
+                f.accuracy  = p[1] * 0.1f;
+                f.nsv       = p[2];
+                f.nused     = p[3];
+                p += 4;
+                if (cb)
+                        cb(arg, &f);
+        }
+        return h->count;
+}
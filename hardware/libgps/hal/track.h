@@ -0,0 +1,51 @@
+#ifndef TRACK_H
+#define TRACK_H
+#include <stdint.h>
+#include <hardware/gps.h>
+
+#define TRACK_MAGIC             0x314b5254      // "TRK1"
+#define TRACK_BLOCK_SIZE        4096            // one page, written once
+#define TRACK_BLOCKS            2048            // default ring length, 8M
+#define TRACK_QUEUE             8               // full blocks waiting for the writer
+
+/* block: head, varint records, crc32 of everything before it in the last
+ * 4 bytes. the head carries the first fix in full, every record is a delta
+ * to the one before, so each block decodes on its own. seq increases by
+ * one per block and orders the ring.
+ */
+typedef struct {
+        uint32_t                magic;
+        uint32_t                seq;
+        int64_t                 time;           // ms
+        int32_t                 lat;            // 1e-7 deg
+        int32_t                 lon;
+        int32_t                 alt;            // dm
+        int32_t                 dt;             // ms, fix interval
+        uint16_t                speed;          // cm/s
+        uint16_t                count;          // records
+        uint16_t                len;            // record bytes
+        uint16_t                reserved;
+} TrackBlockHead;
+
+#define TRACK_PAYLOAD           (TRACK_BLOCK_SIZE - sizeof(TrackBlockHead) - 4)
+
+typedef struct {
+        int64_t                 time;
+        double                  latitude;
+        double                  longitude;
+        double                  altitude;
+        float                   speed;
+        float                   bearing;
+        float                   accuracy;
+        int                     nsv;
+        int                     nused;
+} TrackFix;
+
+typedef void (*track_fix_callback)(void *arg, const TrackFix *fix);
+
+int track_open(const char *path, int blocks);
+void track_close();
+void track_record(const GpsLocation *fix, const GpsSvStatus *sv_status);
+
+int track_decode_block(const unsigned char *block, track_fix_callback cb, void *arg);
+#endif
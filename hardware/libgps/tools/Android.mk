@@ -0,0 +1,72 @@
+LOCAL_PATH := $(call my-dir)
+
+# offline log analyzer, runs the HAL parser on the build host
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := nmealog
+LOCAL_SRC_FILES := nmealog.c
+LOCAL_SRC_FILES += logindex.c
+LOCAL_SRC_FILES += ../hal/aidq.c
+LOCAL_SRC_FILES += ../hal/casic.c
+LOCAL_SRC_FILES += ../hal/crc32.c
+LOCAL_SRC_FILES += ../hal/epoch_shm.c
+LOCAL_SRC_FILES += ../hal/geofence.c
+LOCAL_SRC_FILES += ../hal/lastfix.c
+LOCAL_SRC_FILES += ../hal/measurement.c
+LOCAL_SRC_FILES += ../hal/motion.c
+LOCAL_SRC_FILES += ../hal/navmsg.c
+LOCAL_SRC_FILES += ../hal/power.c
+LOCAL_SRC_FILES += ../hal/rawfan.c
+LOCAL_SRC_FILES += ../hal/track.c
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_CFLAGS := -DHAVE_GPS_HARDWARE -O2
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lm
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+# time index for large logs
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := nmeaidx
+LOCAL_SRC_FILES := nmeaidx.c
+LOCAL_SRC_FILES += logindex.c
+LOCAL_CFLAGS := -O2
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+# decoder for the on-device track ring
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := trackdump
+LOCAL_SRC_FILES := trackdump.c
+LOCAL_SRC_FILES += ../hal/crc32.c
+LOCAL_SRC_FILES += ../hal/track.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../hal
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_CFLAGS := -O2
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lm
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+# receiver emulator on a pty, replays a log and honours restarts
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gnssemu
+LOCAL_SRC_FILES := gnssemu.c
+LOCAL_SRC_FILES += ../hal/casic.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../hal
+LOCAL_CFLAGS := -O2
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# cold, warm and hot start ttff through the installed HAL
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := ttffbench
+LOCAL_SRC_FILES := ttffbench.c
+LOCAL_SHARED_LIBRARIES := libhardware
+LOCAL_CFLAGS := -O2
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,308 @@
+/*
+ * receiver emulator on a pty, for running the HAL and ttffbench without the
+ * hardware. an NMEA log is replayed one epoch (up to the RMC) per second and
+ * wraps at the end.
+ *
+ * the commands of a real receiver that matter for start times are honoured:
+ * PCGDC IDLEON/IDLEOFF stop and resume the output, PCAS10 restarts it. after
+ * a restart the sentences go out without a fix (GGA quality 0, RMC V, GSA
+ * mode 1) for the hot, warm or cold acquisition time, each spread by the
+ * jitter. CASIC aid frames (ephemeris or AID-INI) arriving while acquiring
+ * cut a warm or cold start down to the aided time. every aid frame is
+ * answered with ACK-ACK, but for the fraction -d which is left unanswered
+ * to exercise the retries.
+ *
+ *   gnssemu [-l link] [-c cold] [-w warm] [-h hot] [-a aided] [-j jitter] [-d drop] log
+ *
+ * times in seconds, jitter and drop as a fraction. point TTY_NAME in gnss.conf
+ * at the printed pty or at the -l link.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "casic.h"
+
+#define EPOCH_MS                1000
+#define LINE_MAX_SIZE           256
+
+typedef struct {
+        char                    **lines;
+        int                     nlines;
+        int                     *epochs;        // first line of each epoch
+        int                     nepochs;
+} Log;
+
+static double acquire_s[3] = { 2, 30, 45 };     // hot, warm, cold
+static double aided_s = 8;
+static double jitter = 0.2;
+static double ack_drop = 0;
+
+static int idle;
+static long long restart_at;
+static long long fixed_at;
+static int restart_type = -1;
+
+static long long
+now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long
+spread(double s) {
+        double f = 1.0 + jitter * (2.0 * rand() / RAND_MAX - 1.0);
+        return (long long)(s * f * 1000);
+}
+
+static int
+load_log(const char *path, Log *log) {
+        char line[LINE_MAX_SIZE];
+        FILE *fp = fopen(path, "r");
+        int cap = 0;
+
+        if (fp == NULL)
+                return -1;
+        memset(log, 0, sizeof(*log));
+        while (fgets(line, sizeof(line), fp) != NULL) {
+                char *p = strchr(line, '$');
+                size_t n;
+
+                // neither CASIC frames nor commands in the log are replayed
+                if (p == NULL || p[1] == 'P' || strchr(p, '*') == NULL)
+                        continue;
+                n = strcspn(p, "\r\n");
+                p[n] = 0;
+                if (log->nlines == cap) {
+                        cap = cap ? cap * 2 : 1024;
+                        log->lines = realloc(log->lines, cap * sizeof(char *));
+                        log->epochs = realloc(log->epochs, cap * sizeof(int));
+                }
+                if (log->nlines == 0 || !memcmp(log->lines[log->nlines - 1] + 3, "RMC", 3))
+                        log->epochs[log->nepochs++] = log->nlines;
+                log->lines[log->nlines++] = strdup(p);
+        }
+        fclose(fp);
+        return log->nepochs > 0 ? 0 : -1;
+}
+
+/* field n (0 is the talker) of a sentence in place, NULL if missing */
+static char *
+field(char *s, int n) {
+        while (n-- > 0) {
+                s = strchr(s, ',');
+                if (s == NULL)
+                        return NULL;
+                s += 1;
+        }
+        return s;
+}
+
+/* the sentence as the receiver would send it without a fix */
+static int
+unfixed(const char *in, char *out, int size) {
+        unsigned char sum = 0;
+        char body[LINE_MAX_SIZE];
+        char *f, *p;
+
+        snprintf(body, sizeof(body), "%s", in + 1);
+        p = strchr(body, '*');
+        if (p != NULL)
+                *p = 0;
+        if (!memcmp(body + 2, "GGA", 3) && (f = field(body, 6)) != NULL && *f != ',')
+                *f = '0';
+        else if (!memcmp(body + 2, "RMC", 3) && (f = field(body, 2)) != NULL && *f != ',')
+                *f = 'V';
+        else if (!memcmp(body + 2, "GSA", 3) && (f = field(body, 2)) != NULL && *f != ',')
+                *f = '1';
+        for (p = body; *p; p++)
+                sum ^= (unsigned char)*p;
+        return snprintf(out, size, "$%s*%02X\r\n", body, sum);
+}
+
+static void
+send_epoch(int fd, const Log *log, int e, int fixed) {
+        char out[LINE_MAX_SIZE + 8];
+        int i, end = e + 1 < log->nepochs ? log->epochs[e + 1] : log->nlines;
+        int n;
+
+        for (i = log->epochs[e]; i < end; i++) {
+                if (fixed)
+                        n = snprintf(out, sizeof(out), "%s\r\n", log->lines[i]);
+                else
+                        n = unfixed(log->lines[i], out, sizeof(out));
+                // nobody on the other side, drop it like a real uart would
+                if (write(fd, out, n) < 0 && errno != EAGAIN && errno != EIO)
+                        perror("write");
+        }
+}
+
+static void
+restart(int type) {
+        long long now = now_ms();
+
+        // a factory reset acquires like a cold start
+        if (type < 0 || type > 2)
+                type = 2;
+        restart_type = type;
+        restart_at = now;
+        fixed_at = now + spread(acquire_s[type]);
+        fprintf(stderr, "restart %d, fix in %.1f s\n", type, (fixed_at - now) / 1000.0);
+}
+
+static void
+on_command(const char *line) {
+        if (!strncmp(line, "$PCGDC,IDLEON", 13)) {
+                idle = 1;
+                fprintf(stderr, "idle\n");
+        } else if (!strncmp(line, "$PCGDC,IDLEOFF", 14)) {
+                idle = 0;
+                fprintf(stderr, "awake\n");
+        } else if (!strncmp(line, "$PCAS10,", 8)) {
+                restart(atoi(line + 8));
+        }
+}
+
+/* ACK-ACK for the frame of type id: class, message id, two reserved bytes */
+static void
+ack(int fd, int id) {
+        int payload = id & 0xFFFF;
+        unsigned char frame[CASIC_HEAD_SIZE + 4 + CASIC_CKSUM_SIZE];
+        int n = cas_make_msg(ID_ACK_ACK, &payload, 4, frame);
+
+        if (write(fd, frame, n) < 0 && errno != EAGAIN && errno != EIO)
+                perror("write");
+}
+
+static void
+on_frame(void *arg, int id, const unsigned char *payload, int len) {
+        long long now = now_ms(), aided;
+        int cls = id & 0xFF;
+
+        // RXM ephemerides and AID-INI, an empty one is a poll
+        if ((cls != 0x08 && cls != 0x0B) || len == 0)
+                return;
+        if (ack_drop <= 0 || (double)rand() / RAND_MAX >= ack_drop)
+                ack(*(int *)arg, id);
+        if (restart_type <= 0 || now >= fixed_at)
+                return;
+        aided = restart_at + spread(aided_s);
+        if (aided < fixed_at) {
+                fixed_at = aided > now ? aided : now;
+                fprintf(stderr, "aided, fix in %.1f s\n", (fixed_at - now) / 1000.0);
+        }
+}
+
+static void
+usage() {
+        fprintf(stderr, "usage: gnssemu [-l link] [-c cold] [-w warm] [-h hot] [-a aided] [-j jitter] [-d drop] log\n");
+        exit(2);
+}
+
+int
+main(int argc, char **argv) {
+        static CasicParser casic;
+        char line[LINE_MAX_SIZE];
+        const char *in = NULL, *link_path = NULL;
+        struct termios tio;
+        long long next;
+        Log log;
+        int i, fd, e = 0, nline = 0;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "-l") && i + 1 < argc)
+                        link_path = argv[++i];
+                else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+                        acquire_s[2] = atof(argv[++i]);
+                else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+                        acquire_s[1] = atof(argv[++i]);
+                else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+                        acquire_s[0] = atof(argv[++i]);
+                else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+                        aided_s = atof(argv[++i]);
+                else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+                        jitter = atof(argv[++i]);
+                else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+                        ack_drop = atof(argv[++i]);
+                else if (argv[i][0] == '-' || in != NULL)
+                        usage();
+                else
+                        in = argv[i];
+        }
+        if (in == NULL)
+                usage();
+        if (load_log(in, &log) < 0) {
+                fprintf(stderr, "no NMEA epochs in %s\n", in);
+                return 1;
+        }
+
+        fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+                perror("pty");
+                return 1;
+        }
+        if (tcgetattr(fd, &tio) == 0) {
+                cfmakeraw(&tio);
+                tcsetattr(fd, TCSANOW, &tio);
+        }
+        if (link_path != NULL) {
+                unlink(link_path);
+                if (symlink(ptsname(fd), link_path) < 0)
+                        perror(link_path);
+        }
+        printf("%s\n", ptsname(fd));
+        fflush(stdout);
+
+        srand(time(NULL));
+        casic_parser_init(&casic, on_frame, &fd);
+        // a power on is a cold start
+        restart(2);
+
+        next = now_ms();
+        for (;;) {
+                unsigned char buff[2048];
+                struct pollfd pfd = { fd, POLLIN, 0 };
+                long long now = now_ms();
+                int n, nn;
+
+                if (now >= next) {
+                        if (!idle)
+                                send_epoch(fd, &log, e, now >= fixed_at);
+                        e = (e + 1) % log.nepochs;
+                        next += EPOCH_MS;
+                        continue;
+                }
+                if (poll(&pfd, 1, (int)(next - now)) <= 0)
+                        continue;
+                n = read(fd, buff, sizeof(buff));
+                if (n <= 0) {
+                        // EIO while the HAL has the pty closed
+                        usleep(100 * 1000);
+                        continue;
+                }
+                for (nn = 0; nn < n; ) {
+                        if (casic_parser_busy(&casic) || buff[nn] == BIN_HEADER0) {
+                                nn += casic_parser_feed(&casic, buff + nn, n - nn);
+                                continue;
+                        }
+                        if (buff[nn] == '\n' || buff[nn] == '\r') {
+                                line[nline] = 0;
+                                if (nline > 0)
+                                        on_command(line);
+                                nline = 0;
+                        } else if (nline < LINE_MAX_SIZE - 1) {
+                                line[nline++] = buff[nn];
+                        }
+                        nn += 1;
+                }
+        }
+        return 0;
+}
@@ -0,0 +1,324 @@
+/*
+ * time index for receiver logs.
+ *
+ * one streaming pass over the mapped log picks the utc time out of GGA, RMC
+ * and ZDA (RMC and ZDA carry the date GGA lacks) and every `every` epochs
+ * writes the time and the byte offset of the sentence that opened the epoch.
+ * entries are kept strictly increasing so a lookup is a binary search.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logindex.h"
+
+#define DAY_MS                  86400000LL
+
+struct scan_state {
+        int64_t                 day;            // ms of 00:00 of the current date, -1 unknown
+        int64_t                 utc;            // time of the current epoch
+        int64_t                 last;           // time of the last entry written
+        uint32_t                epochs;
+};
+
+static int64_t
+days_from_civil(int y, int m, int d) {
+        int era, yoe, doy, doe;
+
+        y -= m <= 2;
+        era = (y >= 0 ? y : y - 399) / 400;
+        yoe = y - era * 400;
+        doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return (int64_t)era * 146097 + doe - 719468;
+}
+
+static int
+num(const char *p, int n) {
+        int v = 0;
+
+        while (n-- > 0) {
+                if (*p < '0' || *p > '9')
+                        return -1;
+                v = v * 10 + (*p++ - '0');
+        }
+        return v;
+}
+
+/* start of field i of a sentence, fields counted from the id at 0 */
+static const char *
+field(const char *s, const char *end, int i, int *len) {
+        const char *q;
+
+        while (i-- > 0) {
+                s = memchr(s, ',', end - s);
+                if (s == NULL)
+                        return NULL;
+                s += 1;
+        }
+        q = s;
+        while (q < end && *q != ',' && *q != '*')
+                q++;
+        *len = q - s;
+        return s;
+}
+
+static int64_t
+tod_ms(const char *s, int len) {
+        int h, m, sec, ms = 0;
+
+        if (len < 6)
+                return -1;
+        h = num(s, 2);
+        m = num(s + 2, 2);
+        sec = num(s + 4, 2);
+        if (h < 0 || m < 0 || sec < 0)
+                return -1;
+        if (len >= 8 && s[6] == '.')
+                ms = num(s + 7, 1) * 100 + (len >= 9 ? num(s + 8, 1) * 10 : 0);
+        return ((h * 60 + m) * 60 + sec) * 1000LL + (ms > 0 ? ms : 0);
+}
+
+static int
+hex(char c) {
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        return -1;
+}
+
+static int
+cksum_ok(const char *s, const char *end) {
+        const char *star = memchr(s, '*', end - s);
+        unsigned char sum = 0;
+
+        if (star == NULL || star + 3 > end)
+                return 0;
+        for (s += 1; s < star; s++)
+                sum ^= (unsigned char)*s;
+        return sum == ((hex(star[1]) << 4) | hex(star[2]));
+}
+
+static int
+is_time_sentence(const char *s) {
+        return !memcmp(s + 3, "GGA", 3) || !memcmp(s + 3, "RMC", 3) || !memcmp(s + 3, "ZDA", 3);
+}
+
+/* utc of a GGA, RMC or ZDA, -1 while the date is not known */
+static int64_t
+sentence_utc(struct scan_state *st, const char *s, const char *end) {
+        const char *f;
+        int64_t tod;
+        int len, d, m, y;
+
+        if (!memcmp(s + 3, "RMC", 3)) {
+                f = field(s, end, 9, &len);
+                if (f && len == 6 && (d = num(f, 2)) > 0 && (m = num(f + 2, 2)) > 0 && (y = num(f + 4, 2)) >= 0)
+                        st->day = days_from_civil(2000 + y, m, d) * DAY_MS;
+        } else if (!memcmp(s + 3, "ZDA", 3)) {
+                const char *fd, *fm, *fy;
+                int ld = 0, lm = 0, ly = 0;
+                fd = field(s, end, 2, &ld);
+                fm = field(s, end, 3, &lm);
+                fy = field(s, end, 4, &ly);
+                if (fd && fm && fy && ld == 2 && lm == 2 && ly == 4 &&
+                                (d = num(fd, 2)) > 0 && (m = num(fm, 2)) > 0 && (y = num(fy, 4)) > 0)
+                        st->day = days_from_civil(y, m, d) * DAY_MS;
+        }
+
+        f = field(s, end, 1, &len);
+        if (f == NULL || st->day < 0 || (tod = tod_ms(f, len)) < 0)
+                return -1;
+
+        // GGA past midnight, before RMC brought the new date
+        if (st->day + tod < st->utc - DAY_MS / 2)
+                st->day += DAY_MS;
+        return st->day + tod;
+}
+
+int
+logindex_build(const char *log, int every) {
+        char path[4096], tmp[4096 + 8];
+        struct scan_state st;
+        LogIndexHeader head;
+        LogIndexEntry e;
+        struct stat sb;
+        const char *base, *p, *end;
+        FILE *out;
+        int fd;
+
+        if (every < 1)
+                every = LOGINDEX_EVERY;
+        snprintf(path, sizeof(path), "%s%s", log, LOGINDEX_SUFFIX);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+        fd = open(log, O_RDONLY);
+        if (fd < 0 || fstat(fd, &sb) < 0) {
+                fprintf(stderr, "can not open %s: %s\n", log, strerror(errno));
+                return -1;
+        }
+        base = sb.st_size ? mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        close(fd);
+        if (base == MAP_FAILED) {
+                fprintf(stderr, "can not map %s: %s\n", log, strerror(errno));
+                return -1;
+        }
+        if (base)
+                madvise((void *)base, sb.st_size, MADV_SEQUENTIAL);
+
+        out = fopen(tmp, "wb");
+        if (out == NULL) {
+                fprintf(stderr, "can not create %s: %s\n", tmp, strerror(errno));
+                if (base)
+                        munmap((void *)base, sb.st_size);
+                return -1;
+        }
+        memset(&head, 0, sizeof(head));
+        head.magic = LOGINDEX_MAGIC;
+        head.version = LOGINDEX_VERSION;
+        head.every = every;
+        head.log_size = sb.st_size;
+        head.log_mtime = sb.st_mtime;
+        fwrite(&head, sizeof(head), 1, out);
+
+        st.day = -1;
+        st.utc = -1;
+        st.last = -1;
+        st.epochs = 0;
+        end = base + sb.st_size;
+        for (p = base; p < end; ) {
+                const char *nl = memchr(p, '\n', end - p);
+                const char *eol = nl ? nl : end;
+                int64_t utc;
+
+                // binary frames and broken lines never pass the checksum
+                if (eol - p > 7 && p[0] == '$' && is_time_sentence(p) && cksum_ok(p, eol) &&
+                                (utc = sentence_utc(&st, p, eol)) >= 0 && utc != st.utc) {
+                        if (utc > st.last && st.epochs % every == 0) {
+                                e.utc = utc;
+                                e.offset = p - base;
+                                fwrite(&e, sizeof(e), 1, out);
+                                head.count += 1;
+                                st.last = utc;
+                        }
+                        st.utc = utc;
+                        st.epochs += 1;
+                }
+                p = eol + 1;
+        }
+        if (base)
+                munmap((void *)base, sb.st_size);
+
+        fseek(out, 0, SEEK_SET);
+        fwrite(&head, sizeof(head), 1, out);
+        if (fclose(out) != 0 || rename(tmp, path) < 0) {
+                fprintf(stderr, "can not write %s: %s\n", path, strerror(errno));
+                unlink(tmp);
+                return -1;
+        }
+        return head.count;
+}
+
+int
+logindex_open(LogIndex *idx, const char *log) {
+        char path[4096];
+        struct stat sb, lb;
+        const LogIndexHeader *h;
+        void *p;
+        int fd;
+
+        memset(idx, 0, sizeof(*idx));
+        snprintf(path, sizeof(path), "%s%s", log, LOGINDEX_SUFFIX);
+        if (stat(log, &lb) < 0)
+                return -1;
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &sb) < 0 || sb.st_size < (off_t)sizeof(LogIndexHeader)) {
+                close(fd);
+                return -1;
+        }
+        p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+                return -1;
+
+        h = p;
+        if (h->magic != LOGINDEX_MAGIC || h->version != LOGINDEX_VERSION ||
+                        sizeof(*h) + (uint64_t)h->count * sizeof(LogIndexEntry) > (uint64_t)sb.st_size) {
+                munmap(p, sb.st_size);
+                return -1;
+        }
+        // the log was appended to or replaced since
+        if (h->log_size != (uint64_t)lb.st_size || h->log_mtime != lb.st_mtime) {
+                munmap(p, sb.st_size);
+                return -2;
+        }
+
+        idx->head = h;
+        idx->entry = (const LogIndexEntry *)(h + 1);
+        idx->map_size = sb.st_size;
+        return 0;
+}
+
+void
+logindex_close(LogIndex *idx) {
+        if (idx->head)
+                munmap((void *)idx->head, idx->map_size);
+        memset(idx, 0, sizeof(*idx));
+}
+
+/* offset to start reading at for data from utc on */
+uint64_t
+logindex_find(const LogIndex *idx, int64_t utc) {
+        uint32_t lo = 0, hi = idx->head->count;
+
+        // first entry after utc, step back one
+        while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (idx->entry[mid].utc <= utc)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo ? idx->entry[lo - 1].offset : 0;
+}
+
+/* offset to stop reading at for data up to utc */
+uint64_t
+logindex_find_end(const LogIndex *idx, int64_t utc) {
+        uint32_t lo = 0, hi = idx->head->count;
+
+        while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (idx->entry[mid].utc <= utc)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo < idx->head->count ? idx->entry[lo].offset : idx->head->log_size;
+}
+
+/* "2026-10-19T14:02:10[.5]", a space works for the T, or unix seconds */
+int64_t
+logindex_parse_time(const char *s) {
+        int y, mo, d, h, mi;
+        double sec;
+        char sep;
+
+        if (sscanf(s, "%d-%d-%d%c%d:%d:%lf", &y, &mo, &d, &sep, &h, &mi, &sec) == 7 &&
+                        (sep == 'T' || sep == ' '))
+                return days_from_civil(y, mo, d) * DAY_MS + (h * 3600 + mi * 60) * 1000LL +
+                       (int64_t)(sec * 1000 + 0.5);
+        if (sscanf(s, "%lf", &sec) == 1 && strchr(s, '-') == NULL)
+                return (int64_t)(sec * 1000 + 0.5);
+        return -1;
+}
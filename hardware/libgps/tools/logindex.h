@@ -0,0 +1,40 @@
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOGINDEX_MAGIC          0x5844494e      // "NIDX"
+#define LOGINDEX_VERSION        1
+#define LOGINDEX_EVERY          10              // default epochs between entries
+#define LOGINDEX_SUFFIX         ".idx"
+
+/* sidecar file: header, then entries sorted by time.
+ * log_size and log_mtime tie it to the log it was built from.
+ */
+typedef struct {
+        uint32_t                magic;
+        uint32_t                version;
+        uint32_t                every;
+        uint32_t                count;
+        uint64_t                log_size;
+        int64_t                 log_mtime;
+} LogIndexHeader;
+
+typedef struct {
+        int64_t                 utc;            // ms since 1970, from GGA/RMC/ZDA
+        uint64_t                offset;         // first byte of the sentence carrying it
+} LogIndexEntry;
+
+typedef struct {
+        const LogIndexHeader    *head;
+        const LogIndexEntry     *entry;
+        size_t                  map_size;
+} LogIndex;
+
+int logindex_build(const char *log, int every);
+int logindex_open(LogIndex *idx, const char *log);
+void logindex_close(LogIndex *idx);
+uint64_t logindex_find(const LogIndex *idx, int64_t utc);
+uint64_t logindex_find_end(const LogIndex *idx, int64_t utc);
+int64_t logindex_parse_time(const char *s);
+#endif
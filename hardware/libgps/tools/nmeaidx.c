@@ -0,0 +1,137 @@
+/*
+ * build and query the time index of a receiver log.
+ *
+ *   nmeaidx build [-n epochs] log      write log.idx
+ *   nmeaidx find log time              print the offset to read from
+ *   nmeaidx cut log time seconds       copy the window around time to stdout
+ *
+ * time is "2026-10-19T14:02:10" in utc, or unix seconds. the cut output is
+ * a plain log again, ready for nmealog or for replay into a pty.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logindex.h"
+
+static void
+usage() {
+        fprintf(stderr, "usage: nmeaidx build [-n epochs] log\n"
+                        "       nmeaidx find log time\n"
+                        "       nmeaidx cut log time seconds\n");
+        exit(2);
+}
+
+static int
+open_index(LogIndex *idx, const char *log) {
+        int ret = logindex_open(idx, log);
+
+        if (ret == -2)
+                fprintf(stderr, "%s%s is stale, rebuild it\n", log, LOGINDEX_SUFFIX);
+        else if (ret < 0)
+                fprintf(stderr, "no index for %s, run nmeaidx build first\n", log);
+        return ret;
+}
+
+static int
+cmd_build(int argc, char **argv) {
+        struct timespec t0, t1;
+        int every = LOGINDEX_EVERY;
+        const char *log = NULL;
+        double secs;
+        int i, n;
+
+        for (i = 0; i < argc; i++) {
+                if (!strcmp(argv[i], "-n") && i + 1 < argc)
+                        every = atoi(argv[++i]);
+                else if (log == NULL)
+                        log = argv[i];
+                else
+                        usage();
+        }
+        if (log == NULL)
+                usage();
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        n = logindex_build(log, every);
+        if (n < 0)
+                return 1;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("%s%s: %d entries, one per %d epochs, %.3f s\n", log, LOGINDEX_SUFFIX, n, every, secs);
+        return 0;
+}
+
+static int
+cmd_find(int argc, char **argv) {
+        LogIndex idx;
+        int64_t t;
+
+        if (argc != 2)
+                usage();
+        if ((t = logindex_parse_time(argv[1])) < 0) {
+                fprintf(stderr, "bad time %s\n", argv[1]);
+                return 2;
+        }
+        if (open_index(&idx, argv[0]) < 0)
+                return 1;
+        printf("%llu\n", (unsigned long long)logindex_find(&idx, t));
+        logindex_close(&idx);
+        return 0;
+}
+
+static int
+cmd_cut(int argc, char **argv) {
+        char buff[65536];
+        LogIndex idx;
+        uint64_t from, to;
+        int64_t t, half;
+        int fd, n;
+
+        if (argc != 3)
+                usage();
+        if ((t = logindex_parse_time(argv[1])) < 0) {
+                fprintf(stderr, "bad time %s\n", argv[1]);
+                return 2;
+        }
+        half = (int64_t)(atof(argv[2]) * 500);
+        if (open_index(&idx, argv[0]) < 0)
+                return 1;
+        from = logindex_find(&idx, t - half);
+        to = logindex_find_end(&idx, t + half);
+        logindex_close(&idx);
+
+        fd = open(argv[0], O_RDONLY);
+        if (fd < 0 || lseek(fd, from, SEEK_SET) < 0) {
+                fprintf(stderr, "can not read %s: %s\n", argv[0], strerror(errno));
+                return 1;
+        }
+        while (from < to) {
+                n = read(fd, buff, to - from < sizeof(buff) ? to - from : sizeof(buff));
+                if (n <= 0)
+                        break;
+                if (fwrite(buff, 1, n, stdout) != (size_t)n)
+                        break;
+                from += n;
+        }
+        close(fd);
+        return from < to;
+}
+
+int
+main(int argc, char **argv) {
+        if (argc < 3)
+                usage();
+        if (!strcmp(argv[1], "build"))
+                return cmd_build(argc - 2, argv + 2);
+        if (!strcmp(argv[1], "find"))
+                return cmd_find(argc - 2, argv + 2);
+        if (!strcmp(argv[1], "cut"))
+                return cmd_cut(argc - 2, argv + 2);
+        usage();
+        return 2;
+}
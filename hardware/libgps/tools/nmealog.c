@@ -0,0 +1,530 @@
+/*
+ * offline analyzer for receiver logs, NMEA with interleaved CASIC frames.
+ *
+ * the HAL source is compiled in as is, so every sentence goes through the
+ * same tokenizer and nmea_reader_parse() the device runs. the mapped log is
+ * cut into chunks right after an RMC, where the parser ends an epoch, and
+ * the chunks are parsed on all cores with one NmeaReader per chunk. epochs
+ * are merged back in file order for the track and the statistics.
+ *
+ * with -a the log.idx time index (see logindex.c, built on first use) narrows
+ * the parse to the window of -w seconds around that time.
+ *
+ *   nmealog [-j threads] [-o track.csv] [-a time [-w seconds]] log
+ */
+#define  LOG_TAG  "gps_zkw"
+#include <cutils/log.h>
+
+// the per sentence debug of the HAL costs more than the parsing
+#undef  LOGD
+#define LOGD(...)   ((void)0)
+
+#include "../hal/gps_zkw.c"
+#include "logindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHUNK_MIN               (1024 * 1024)
+#define CHUNK_SCAN              (1024 * 1024)   // how far to look for an RMC
+#define SESSION_GAP             10000           // ms, a time jump this big starts a new session
+#define DAY_MS                  86400000LL
+#define WINDOW_DEFAULT          30              // seconds
+
+typedef struct {
+        long long               tod;            // ms of day from GGA/RMC, -1 if none
+        int                     fixed;
+        int                     nsv;
+        int                     nused;
+        GpsLocation             fix;
+} Epoch;
+
+typedef struct {
+        const unsigned char     *p;
+        size_t                  len;
+
+        Epoch                   *epochs;
+        int                     nepochs;
+        int                     cap;
+
+        Epoch                   cur;            // epoch being collected
+        long long               sentences;
+        long long               bad_cksum;
+        long long               frames;
+} Chunk;
+
+static __thread Chunk *chunk;
+
+static Chunk *chunks;
+static int nchunks;
+static int next_chunk = 0;
+
+static long long
+tod_of(Token tok) {
+        if (tok.p + 6 > tok.end)
+                return -1;
+        return str2int(tok.p, tok.p + 2) * 3600000LL +
+               str2int(tok.p + 2, tok.p + 4) * 60000LL +
+               (long long)(str2float(tok.p + 4, tok.end) * 1000 + 0.5);
+}
+
+static int
+hex2int(char c) {
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        return -1;
+}
+
+static int
+nmea_cksum_ok(const char *s, int len) {
+        const char *star = memchr(s, '*', len);
+        unsigned char sum = 0;
+        int i;
+
+        if (len < 1 || s[0] != '$' || star == NULL || star + 3 > s + len)
+                return 0;
+        for (i = 1; s + i < star; i++)
+                sum ^= (unsigned char)s[i];
+        return sum == ((hex2int(star[1]) << 4) | hex2int(star[2]));
+}
+
+static void
+chunk_location_cb(GpsLocation *loc) {
+        chunk->cur.fix = *loc;
+        chunk->cur.fixed = 1;
+}
+
+/* the reader reports sv status once per epoch, right after RMC */
+static void
+chunk_sv_status_cb(GpsSvStatus *sv) {
+        Chunk *c = chunk;
+        Epoch *e;
+        int i;
+
+        if (c->nepochs == c->cap) {
+                c->cap = c->cap ? c->cap * 2 : 1024;
+                c->epochs = realloc(c->epochs, c->cap * sizeof(Epoch));
+                if (c->epochs == NULL) {
+                        fprintf(stderr, "out of memory\n");
+                        exit(1);
+                }
+        }
+        e = &c->epochs[c->nepochs++];
+        *e = c->cur;
+        e->nsv = sv->num_svs;
+        e->nused = 0;
+        for (i = 0; i < sv->num_svs; i++) {
+                if (sv->sv_list[i].azimuth >= 720)
+                        e->nused += 1;
+        }
+
+        memset(&c->cur, 0, sizeof(c->cur));
+        c->cur.tod = -1;
+}
+
+static void
+chunk_nmea_cb(GpsUtcTime timestamp, const char *nmea, int length) {
+        Chunk *c = chunk;
+        NmeaTokenizer tzer[1];
+        Token tok;
+
+        (void)timestamp;
+        c->sentences += 1;
+        if (!nmea_cksum_ok(nmea, length)) {
+                c->bad_cksum += 1;
+                return;
+        }
+
+        nmea_tokenizer_init(tzer, nmea, nmea + length);
+        tok = nmea_tokenizer_get(tzer, 0);
+        if (tok.p + 5 > tok.end)
+                return;
+        if (!memcmp(tok.p + 2, "GGA", 3)) {
+                c->cur.tod = tod_of(nmea_tokenizer_get(tzer, 1));
+        } else if (!memcmp(tok.p + 2, "RMC", 3)) {
+                // rmc closed the epoch already, without a GGA it carries the time
+                if (c->nepochs > 0 && c->epochs[c->nepochs - 1].tod < 0)
+                        c->epochs[c->nepochs - 1].tod = tod_of(nmea_tokenizer_get(tzer, 1));
+        }
+}
+
+static void
+chunk_casic_frame(void *arg, int id, const unsigned char *payload, int len) {
+        (void)id; (void)payload; (void)len;
+        ((Chunk *)arg)->frames += 1;
+}
+
+/* same byte loop as gps_state_thread() */
+static void
+chunk_parse(Chunk *c) {
+        NmeaReader reader[1];
+        CasicParser casic[1];
+        size_t nn = 0;
+
+        chunk = c;
+        memset(&c->cur, 0, sizeof(c->cur));
+        c->cur.tod = -1;
+
+        nmea_reader_init(reader);
+        nmea_reader_set_callback(reader, chunk_location_cb);
+        nmea_reader_set_sv_callback(reader, chunk_sv_status_cb);
+        nmea_reader_set_nmea_callback(reader, chunk_nmea_cb);
+        casic_parser_init(casic, chunk_casic_frame, c);
+
+        while (nn < c->len) {
+                if (casic_parser_busy(casic) || c->p[nn] == BIN_HEADER0) {
+                        nn += casic_parser_feed(casic, c->p + nn, c->len - nn);
+                        continue;
+                }
+                nmea_reader_addc(reader, c->p[nn]);
+                nn += 1;
+        }
+}
+
+static void *
+worker(void *arg) {
+        int i;
+
+        (void)arg;
+        while ((i = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_RELAXED)) < nchunks)
+                chunk_parse(&chunks[i]);
+        return NULL;
+}
+
+/* utc of an epoch, unfixed ones only know the time of day */
+static long long
+epoch_utc(const Epoch *e, long long near) {
+        long long t;
+
+        if (e->fixed)
+                return e->fix.timestamp;
+        if (e->tod < 0)
+                return -1;
+        t = near - near % DAY_MS + e->tod;
+        if (t < near - DAY_MS / 2)
+                t += DAY_MS;
+        else if (t > near + DAY_MS / 2)
+                t -= DAY_MS;
+        return t;
+}
+
+/* narrow base/size to the indexed window [from, to] */
+static int
+window_range(const char *in, long long from, long long to, size_t *start, size_t *end) {
+        LogIndex idx;
+
+        if (logindex_open(&idx, in) < 0) {
+                fprintf(stderr, "indexing %s\n", in);
+                if (logindex_build(in, LOGINDEX_EVERY) < 0 || logindex_open(&idx, in) < 0)
+                        return -1;
+        }
+        *start = logindex_find(&idx, from);
+        *end = logindex_find_end(&idx, to);
+        logindex_close(&idx);
+        return 0;
+}
+
+/* first offset after off that ends an RMC line, else the next line start */
+static size_t
+chunk_boundary(const unsigned char *base, size_t size, size_t off) {
+        const unsigned char *p = base + off, *end = base + size;
+        const unsigned char *limit = size - off > CHUNK_SCAN ? p + CHUNK_SCAN : end;
+        const unsigned char *first = NULL;
+
+        while (p < limit) {
+                const unsigned char *nl = memchr(p, '\n', limit - p);
+                if (nl == NULL || nl + 1 >= end)
+                        break;
+                p = nl + 1;
+                if (p[0] != '$')
+                        continue;
+                if (first == NULL)
+                        first = p;
+                if (end - p > 6 && !memcmp(p + 3, "RMC", 3)) {
+                        nl = memchr(p, '\n', end - p);
+                        return nl ? (size_t)(nl + 1 - base) : size;
+                }
+        }
+        return first ? (size_t)(first - base) : size;
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+        double x = *(const double *)a, y = *(const double *)b;
+        return x < y ? -1 : x > y;
+}
+
+static int
+cmp_ll(const void *a, const void *b) {
+        long long x = *(const long long *)a, y = *(const long long *)b;
+        return x < y ? -1 : x > y;
+}
+
+static void
+report(Epoch **ep, long long n, FILE *track) {
+        long long i, nfix = 0, nsess = 0, nttff = 0, outages = 0;
+        long long used_sum = 0, sv_sum = 0;
+        int used_max = 0, used_min = 1 << 30;
+        long long *ttff = NULL;
+        long long sess_start = -1, prev_tod = -1;
+        int sess_fixed = 0, prev_fixed = 0;
+        double lat0 = 0, lon0 = 0, acc_sum = 0;
+        double *dist = NULL;
+
+        ttff = calloc(n + 1, sizeof(long long));
+        dist = calloc(n + 1, sizeof(double));
+        if (ttff == NULL || dist == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+        }
+
+        if (track)
+                fprintf(track, "time_ms,lat,lon,alt,speed,bearing,accuracy,svs,used\n");
+
+        for (i = 0; i < n; i++) {
+                Epoch *e = ep[i];
+                long long gap = (e->tod >= 0 && prev_tod >= 0) ? e->tod - prev_tod : 0;
+
+                if (gap < -DAY_MS / 2)
+                        gap += DAY_MS;
+                if (i == 0 || gap < 0 || gap >= SESSION_GAP) {
+                        nsess += 1;
+                        sess_start = e->tod;
+                        // a session that starts fixed is a log cut, not a start
+                        sess_fixed = e->fixed;
+                        prev_fixed = 0;
+                }
+                if (e->tod >= 0)
+                        prev_tod = e->tod;
+
+                sv_sum += e->nsv;
+                if (!e->fixed) {
+                        if (prev_fixed)
+                                outages += 1;
+                        prev_fixed = 0;
+                        continue;
+                }
+
+                if (!sess_fixed && sess_start >= 0 && e->tod >= 0) {
+                        long long t = e->tod - sess_start;
+                        ttff[nttff++] = t < 0 ? t + DAY_MS : t;
+                }
+                sess_fixed = 1;
+                prev_fixed = 1;
+
+                lat0 += e->fix.latitude;
+                lon0 += e->fix.longitude;
+                acc_sum += e->fix.accuracy;
+                used_sum += e->nused;
+                if (e->nused > used_max)
+                        used_max = e->nused;
+                if (e->nused < used_min)
+                        used_min = e->nused;
+                nfix += 1;
+
+                if (track)
+                        fprintf(track, "%lld,%.8f,%.8f,%.2f,%.2f,%.1f,%.2f,%d,%d\n",
+                                (long long)e->fix.timestamp, e->fix.latitude, e->fix.longitude,
+                                e->fix.altitude, e->fix.speed, e->fix.bearing,
+                                e->fix.accuracy, e->nsv, e->nused);
+        }
+
+        printf("epochs          %lld\n", n);
+        printf("fixed epochs    %lld (%.1f%%)\n", nfix, n ? 100.0 * nfix / n : 0.0);
+        printf("sessions        %lld\n", nsess);
+        printf("fix outages     %lld\n", outages);
+        printf("mean svs        %.1f\n", n ? (double)sv_sum / n : 0.0);
+
+        if (nfix > 0) {
+                long long k = 0;
+                double clat;
+
+                if (nttff > 0) {
+                        qsort(ttff, nttff, sizeof(long long), cmp_ll);
+                        printf("ttff            min %.1f s, median %.1f s, max %.1f s over %lld sessions\n",
+                               ttff[0] / 1000.0, ttff[nttff / 2] / 1000.0, ttff[nttff - 1] / 1000.0, nttff);
+                }
+
+                printf("used svs        min %d, mean %.1f, max %d\n",
+                       used_min, (double)used_sum / nfix, used_max);
+                printf("mean accuracy   %.2f\n", acc_sum / nfix);
+
+                // scatter about the mean position, meaningful for static logs
+                lat0 /= nfix;
+                lon0 /= nfix;
+                clat = cos(lat0 * M_PI / 180.0);
+                for (i = 0; i < n; i++) {
+                        double dn, de;
+                        if (!ep[i]->fixed)
+                                continue;
+                        dn = (ep[i]->fix.latitude - lat0) * M_PI / 180.0 * EARTH_RADIUS;
+                        de = (ep[i]->fix.longitude - lon0) * M_PI / 180.0 * EARTH_RADIUS * clat;
+                        dist[k++] = sqrt(dn * dn + de * de);
+                }
+                qsort(dist, k, sizeof(double), cmp_double);
+                printf("horizontal      cep50 %.2f m, cep95 %.2f m, max %.2f m\n",
+                       dist[k / 2], dist[(k * 95) / 100 < k ? (k * 95) / 100 : k - 1], dist[k - 1]);
+        }
+
+        free(ttff);
+        free(dist);
+}
+
+static void
+usage() {
+        fprintf(stderr, "usage: nmealog [-j threads] [-o track.csv] [-a time [-w seconds]] log\n");
+        exit(2);
+}
+
+int
+main(int argc, char **argv) {
+        const char *in = NULL, *out = NULL;
+        int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        long long at = -1, win_from = 0, win_to = 0;
+        double window = WINDOW_DEFAULT;
+        unsigned char *base, *map;
+        size_t size, map_size, step, off;
+        struct stat st;
+        struct timespec t0, t1;
+        pthread_t *tids;
+        Epoch **ep;
+        long long n, sentences = 0, bad = 0, frames = 0;
+        FILE *track = NULL;
+        double secs;
+        int fd, i, j;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "-j") && i + 1 < argc)
+                        nthreads = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+                        out = argv[++i];
+                else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+                        at = logindex_parse_time(argv[++i]);
+                        if (at < 0)
+                                usage();
+                }
+                else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+                        window = atof(argv[++i]);
+                else if (argv[i][0] == '-' || in != NULL)
+                        usage();
+                else
+                        in = argv[i];
+        }
+        if (in == NULL)
+                usage();
+        if (nthreads < 1)
+                nthreads = 1;
+
+        // the parser converts fix times with mktime(), keep them in utc
+        setenv("TZ", "UTC0", 1);
+        tzset();
+
+        fd = open(in, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+                fprintf(stderr, "can not open %s: %s\n", in, strerror(errno));
+                return 1;
+        }
+        size = st.st_size;
+        if (size == 0) {
+                fprintf(stderr, "%s is empty\n", in);
+                return 1;
+        }
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+                fprintf(stderr, "can not map %s: %s\n", in, strerror(errno));
+                return 1;
+        }
+        map_size = size;
+        base = map;
+        if (at >= 0) {
+                size_t start, end;
+
+                win_from = at - (long long)(window * 500);
+                win_to = at + (long long)(window * 500);
+                if (window_range(in, win_from, win_to, &start, &end) < 0)
+                        return 1;
+                if (end > size)
+                        end = size;
+                if (start >= end) {
+                        fprintf(stderr, "nothing in the window\n");
+                        return 1;
+                }
+                base = map + start;
+                size = end - start;
+        }
+        madvise(base, size, MADV_SEQUENTIAL);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        // a few chunks per thread keeps the cores busy to the end
+        step = size / (nthreads * 4);
+        if (step < CHUNK_MIN)
+                step = CHUNK_MIN;
+        chunks = calloc(size / step + 2, sizeof(Chunk));
+        if (chunks == NULL) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+        }
+        for (off = 0; off < size; ) {
+                size_t end = off + step < size ? chunk_boundary(base, size, off + step) : size;
+                chunks[nchunks].p = base + off;
+                chunks[nchunks].len = end - off;
+                nchunks += 1;
+                off = end;
+        }
+
+        tids = calloc(nthreads, sizeof(pthread_t));
+        for (i = 0; i < nthreads; i++)
+                pthread_create(&tids[i], NULL, worker, NULL);
+        for (i = 0; i < nthreads; i++)
+                pthread_join(tids[i], NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+        // merge in file order
+        for (i = 0, n = 0; i < nchunks; i++)
+                n += chunks[i].nepochs;
+        ep = calloc(n + 1, sizeof(Epoch *));
+        for (i = 0, n = 0; i < nchunks; i++) {
+                for (j = 0; j < chunks[i].nepochs; j++) {
+                        Epoch *e = &chunks[i].epochs[j];
+                        long long t = at >= 0 ? epoch_utc(e, at) : -1;
+
+                        // the index is coarse, trim to the window
+                        if (t >= 0 && (t < win_from || t > win_to))
+                                continue;
+                        ep[n++] = e;
+                }
+                sentences += chunks[i].sentences;
+                bad += chunks[i].bad_cksum;
+                frames += chunks[i].frames;
+        }
+
+        if (out != NULL) {
+                track = fopen(out, "w");
+                if (track == NULL) {
+                        fprintf(stderr, "can not create %s: %s\n", out, strerror(errno));
+                        return 1;
+                }
+        }
+
+        printf("input           %s, %.1f MB\n", in, size / 1e6);
+        printf("parsed          %.3f s, %.1f MB/s, %d threads, %d chunks\n",
+               secs, size / 1e6 / secs, nthreads, nchunks);
+        printf("sentences       %lld, %lld bad checksum\n", sentences, bad);
+        printf("casic frames    %lld\n", frames);
+        report(ep, n, track);
+
+        if (track)
+                fclose(track);
+        munmap(map, map_size);
+        return 0;
+}
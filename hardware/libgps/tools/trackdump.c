@@ -0,0 +1,88 @@
+/*
+ * stream a track ring file (see hal/track.c) out as csv, oldest fix first.
+ *
+ *   trackdump track.bin > track.csv
+ *
+ * only the block heads are read up front to order the ring, the blocks
+ * themselves are decoded one at a time.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "track.h"
+
+struct slot {
+        uint32_t                seq;
+        uint32_t                index;
+};
+
+static int
+cmp_slot(const void *a, const void *b) {
+        const struct slot *x = a, *y = b;
+        int32_t d = (int32_t)(x->seq - y->seq);
+        return d < 0 ? -1 : d > 0;
+}
+
+static void
+print_fix(void *arg, const TrackFix *f) {
+        long long *n = arg;
+
+        printf("%lld,%.7f,%.7f,%.1f,%.2f,%.1f,%.1f,%d,%d\n",
+               (long long)f->time, f->latitude, f->longitude, f->altitude,
+               f->speed, f->bearing, f->accuracy, f->nsv, f->nused);
+        *n += 1;
+}
+
+int
+main(int argc, char **argv) {
+        unsigned char block[TRACK_BLOCK_SIZE];
+        TrackBlockHead h;
+        struct slot *slots;
+        struct stat st;
+        long long fixes = 0;
+        int fd, i, nblocks, nslots = 0, bad = 0;
+
+        if (argc != 2) {
+                fprintf(stderr, "usage: trackdump track.bin\n");
+                return 2;
+        }
+        fd = open(argv[1], O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+                fprintf(stderr, "can not open %s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+        nblocks = st.st_size / TRACK_BLOCK_SIZE;
+        slots = calloc(nblocks + 1, sizeof(*slots));
+        if (slots == NULL) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+        }
+
+        for (i = 0; i < nblocks; i++) {
+                if (pread(fd, &h, sizeof(h), (off_t)i * TRACK_BLOCK_SIZE) != sizeof(h) || h.magic != TRACK_MAGIC)
+                        continue;
+                slots[nslots].seq = h.seq;
+                slots[nslots].index = i;
+                nslots += 1;
+        }
+        // seq wraps, order relative to the newest
+        qsort(slots, nslots, sizeof(*slots), cmp_slot);
+
+        printf("time_ms,lat,lon,alt,speed,bearing,accuracy,svs,used\n");
+        for (i = 0; i < nslots; i++) {
+                if (pread(fd, block, TRACK_BLOCK_SIZE, (off_t)slots[i].index * TRACK_BLOCK_SIZE) != TRACK_BLOCK_SIZE ||
+                                track_decode_block(block, print_fix, &fixes) < 0)
+                        bad += 1;
+        }
+        close(fd);
+
+        fprintf(stderr, "%d blocks, %lld fixes, %.1f bytes per fix, %d damaged\n",
+                nslots, fixes, fixes ? (double)nslots * TRACK_BLOCK_SIZE / fixes : 0.0, bad);
+        free(slots);
+        return 0;
+}
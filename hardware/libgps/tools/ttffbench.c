@@ -0,0 +1,245 @@
+/*
+ * time to first fix benchmark through the installed GPS HAL.
+ *
+ * every start of a kind is forced with delete_aiding_data the way the
+ * framework does it: cold forgets almanac, ephemeris, position and time,
+ * warm only the ephemeris, hot nothing and restarts within the standby hold
+ * time. the time from start() to the first location with a position is the
+ * ttff, the runs of a kind are summarised as p50/p90/p99.
+ *
+ *   ttffbench [-n starts] [-k cold,warm,hot] [-t timeout] [-g gap] [-x]
+ *
+ * a cold start keeps the ephemerides the HAL holds for the receiver (and
+ * SUPL, where built in, is fetched again) unless -x drops them as well with
+ * GPS_DELETE_ALL. run it against the receiver or gnssemu; with and without
+ * SUPL means the HAL built with and without SUPL_ENABLED.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/gps.h>
+#include <hardware/hardware.h>
+
+#define STARTS_DEFAULT          10
+#define TIMEOUT_DEFAULT         300             // s
+#define GAP_DEFAULT             5               // s, stopped between runs
+
+enum { KIND_COLD = 0, KIND_WARM, KIND_HOT, KINDS };
+
+static const char *kind_name[KINDS] = { "cold", "warm", "hot" };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond;
+static int waiting;
+static long long fix_ms;
+
+struct thread_start {
+        void                    (*start)(void *);
+        void                    *arg;
+};
+
+static long long
+now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+on_location(GpsLocation *loc) {
+        if (!(loc->flags & GPS_LOCATION_HAS_LAT_LONG))
+                return;
+        pthread_mutex_lock(&lock);
+        if (waiting) {
+                waiting = 0;
+                fix_ms = now_ms();
+                pthread_cond_signal(&cond);
+        }
+        pthread_mutex_unlock(&lock);
+}
+
+static void on_status(GpsStatus *status) { }
+static void on_sv_status(GpsSvStatus *sv) { }
+static void on_nmea(GpsUtcTime t, const char *nmea, int len) { }
+static void on_capabilities(uint32_t caps) { }
+static void on_wakelock() { }
+static void on_utc_request() { }
+
+static void *
+thread_main(void *arg) {
+        struct thread_start ts = *(struct thread_start *)arg;
+
+        free(arg);
+        ts.start(ts.arg);
+        return NULL;
+}
+
+static pthread_t
+on_create_thread(const char *name, void (*start)(void *), void *arg) {
+        struct thread_start *ts = malloc(sizeof(*ts));
+        pthread_t tid;
+
+        ts->start = start;
+        ts->arg = arg;
+        if (pthread_create(&tid, NULL, thread_main, ts) != 0) {
+                free(ts);
+                return 0;
+        }
+        return tid;
+}
+
+static GpsCallbacks callbacks = {
+        .size = sizeof(GpsCallbacks),
+        .location_cb = on_location,
+        .status_cb = on_status,
+        .sv_status_cb = on_sv_status,
+        .nmea_cb = on_nmea,
+        .set_capabilities_cb = on_capabilities,
+        .acquire_wakelock_cb = on_wakelock,
+        .release_wakelock_cb = on_wakelock,
+        .create_thread_cb = on_create_thread,
+        .request_utc_time_cb = on_utc_request,
+};
+
+/* one start to the first fix, returns the ttff in ms or -1 on timeout */
+static long long
+run_start(const GpsInterface *gps, int timeout) {
+        struct timespec deadline;
+        long long t0, ttff = -1;
+        int err = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout;
+
+        pthread_mutex_lock(&lock);
+        waiting = 1;
+        pthread_mutex_unlock(&lock);
+
+        t0 = now_ms();
+        gps->start();
+
+        pthread_mutex_lock(&lock);
+        while (waiting && err != ETIMEDOUT)
+                err = pthread_cond_timedwait(&cond, &lock, &deadline);
+        if (!waiting)
+                ttff = fix_ms - t0;
+        waiting = 0;
+        pthread_mutex_unlock(&lock);
+
+        gps->stop();
+        return ttff;
+}
+
+static int
+cmp_ll(const void *a, const void *b) {
+        long long x = *(const long long *)a, y = *(const long long *)b;
+        return x < y ? -1 : x > y;
+}
+
+/* nearest rank */
+static long long
+percentile(const long long *v, int n, int p) {
+        int i = (p * n + 99) / 100 - 1;
+        return v[i < 0 ? 0 : i];
+}
+
+static void
+usage() {
+        fprintf(stderr, "usage: ttffbench [-n starts] [-k cold,warm,hot] [-t timeout] [-g gap] [-x]\n");
+        exit(2);
+}
+
+int
+main(int argc, char **argv) {
+        const GpsInterface *gps;
+        const hw_module_t *module;
+        hw_device_t *device;
+        pthread_condattr_t attr;
+        long long *ttff;
+        int starts = STARTS_DEFAULT, timeout = TIMEOUT_DEFAULT, gap = GAP_DEFAULT;
+        int kinds[KINDS] = { 1, 1, 1 };
+        int drop_cache = 0;
+        int i, k;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "-n") && i + 1 < argc)
+                        starts = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+                        timeout = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+                        gap = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-x"))
+                        drop_cache = 1;
+                else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+                        const char *list = argv[++i];
+                        for (k = 0; k < KINDS; k++)
+                                kinds[k] = strstr(list, kind_name[k]) != NULL;
+                }
+                else
+                        usage();
+        }
+        if (starts <= 0)
+                usage();
+
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cond, &attr);
+
+        if (hw_get_module(GPS_HARDWARE_MODULE_ID, &module) != 0 ||
+                        module->methods->open(module, GPS_HARDWARE_MODULE_ID, &device) != 0) {
+                fprintf(stderr, "no gps hal\n");
+                return 1;
+        }
+        gps = ((struct gps_device_t *)device)->get_gps_interface((struct gps_device_t *)device);
+        if (gps == NULL || gps->init(&callbacks) != 0) {
+                fprintf(stderr, "gps hal init failed\n");
+                return 1;
+        }
+        gps->set_position_mode(GPS_POSITION_MODE_STANDALONE, GPS_POSITION_RECURRENCE_PERIODIC, 1000, 0, 0);
+
+        ttff = calloc(starts, sizeof(*ttff));
+        // warm and hot need a receiver that has seen the sky
+        if ((kinds[KIND_WARM] || kinds[KIND_HOT]) && run_start(gps, timeout) < 0)
+                fprintf(stderr, "no fix to start from, warm and hot runs will be cold\n");
+
+        printf("kind,starts,fixed,p50_ms,p90_ms,p99_ms,min_ms,max_ms\n");
+        for (k = 0; k < KINDS; k++) {
+                int n = 0;
+
+                if (!kinds[k])
+                        continue;
+                for (i = 0; i < starts; i++) {
+                        long long t;
+
+                        sleep(gap);
+                        if (k == KIND_COLD)
+                                gps->delete_aiding_data(drop_cache ? GPS_DELETE_ALL :
+                                                        GPS_DELETE_EPHEMERIS | GPS_DELETE_ALMANAC |
+                                                        GPS_DELETE_POSITION | GPS_DELETE_TIME |
+                                                        GPS_DELETE_IONO | GPS_DELETE_UTC | GPS_DELETE_HEALTH);
+                        else if (k == KIND_WARM)
+                                gps->delete_aiding_data(GPS_DELETE_EPHEMERIS);
+                        t = run_start(gps, timeout);
+                        fprintf(stderr, "%s %d/%d: %lld ms\n", kind_name[k], i + 1, starts, t);
+                        if (t >= 0)
+                                ttff[n++] = t;
+                }
+                qsort(ttff, n, sizeof(*ttff), cmp_ll);
+                if (n > 0)
+                        printf("%s,%d,%d,%lld,%lld,%lld,%lld,%lld\n", kind_name[k], starts, n,
+                               percentile(ttff, n, 50), percentile(ttff, n, 90), percentile(ttff, n, 99),
+                               ttff[0], ttff[n - 1]);
+                else
+                        printf("%s,%d,0,,,,,\n", kind_name[k], starts);
+                fflush(stdout);
+        }
+
+        gps->cleanup();
+        free(ttff);
+        return 0;
+}